@@ -1,17 +1,19 @@
 #include "args.h"
 #include "io_utils.h"
 
+#include <charconv>
 #include <format>
 #include <print>
 #include <stdexcept>
 #include <string_view>
+#include <system_error>
 
 namespace {
 
 // The limits quoted in displayInfo() below are prose, so pin them to the
 // constants they describe: the help text cannot silently drift out of date.
-static_assert(MAX_COVER_IMAGE_SIZE == 8ULL * 1024 * 1024,
-	"displayInfo() quotes an 8 MB cover-image limit; keep it in step with MAX_COVER_IMAGE_SIZE.");
+static_assert(MAX_COVER_IMAGE_SIZE == 64ULL * 1024 * 1024,
+	"displayInfo() quotes a 64 MB cover-image limit; keep it in step with MAX_COVER_IMAGE_SIZE.");
 
 void displayInfo() {
 	std::print("\n\nPNG Data Vehicle (pdvrdt v{})\n", PDVRDT_VERSION);
@@ -38,14 +40,14 @@ Usage
 ──────────────────────────
 
   pdvrdt conceal [-m] <cover_image> <secret_file>
-  pdvrdt recover <cover_image>
+  pdvrdt recover [--range OFFSET:LEN] <cover_image>
   pdvrdt --info
 
 ──────────────────────────
 Platform compatibility & size limits
 ──────────────────────────
 
-Input limit: the PNG cover image must be 8 MB or smaller. The secret data file
+Input limit: the PNG cover image must be 64 MB or smaller. The secret data file
 has no separate input limit; what constrains it is the output limit below.
 
 Share your "file-embedded" PNG image on the following compatible sites.
@@ -75,6 +77,18 @@ Modes
   recover - Decrypts, uncompresses and extracts the concealed data file from a PNG cover image
             (recovery PIN required).
 
+──────────────────────────
+Range option for recover mode
+──────────────────────────
+
+  --range OFFSET:LEN : Extracts only LEN bytes of the concealed file, starting at byte OFFSET
+                       (decimal). A range running past the end of the file stops there.
+
+      $ pdvrdt recover --range 1048576:4096 prdt_531618.png
+
+  For a large file concealed in default mode, only the parts of the payload holding the
+  range are decrypted and uncompressed.
+
 ──────────────────────────
 Platform option for conceal mode
 ──────────────────────────
@@ -114,7 +128,7 @@ Notes
 [[nodiscard]] std::string buildUsage(std::string_view prog) {
 	return std::format(
 		"Usage: {} conceal [-m] <cover_image> <secret_file>\n"
-		"       {} recover <cover_image>\n"
+		"       {} recover [--range OFFSET:LEN] <cover_image>\n"
 		"       {} --info",
 		prog, prog, prog
 	);
@@ -143,14 +157,44 @@ Notes
 	return out;
 }
 
-[[nodiscard]] ProgramArgs parseRecoverArgs(int argc, char** argv, const std::string& usage) {
-	if (argc != 3 || argAt(argc, argv, 2).empty()) {
-		dieUsage(usage);
+// OFFSET:LEN, both decimal; LEN must be non-zero.
+[[nodiscard]] std::optional<ByteRange> parseByteRange(std::string_view text) {
+	const std::size_t colon = text.find(':');
+	if (colon == std::string_view::npos) {
+		return std::nullopt;
+	}
+	auto parseSize = [](std::string_view digits, std::size_t& value) {
+		const char* const end = digits.data() + digits.size();
+		const auto [ptr, ec] = std::from_chars(digits.data(), end, value);
+		return !digits.empty() && ec == std::errc{} && ptr == end;
+	};
+	ByteRange range{};
+	if (!parseSize(text.substr(0, colon), range.offset) ||
+		!parseSize(text.substr(colon + 1), range.length) ||
+		range.length == 0) {
+		return std::nullopt;
 	}
+	return range;
+}
 
+[[nodiscard]] ProgramArgs parseRecoverArgs(int argc, char** argv, const std::string& usage) {
 	ProgramArgs out{};
 	out.mode = Mode::recover;
-	out.image_file_path = fs::path(argAt(argc, argv, 2));
+
+	int i = 2;
+	if (argAt(argc, argv, i) == "--range") {
+		out.range = parseByteRange(argAt(argc, argv, i + 1));
+		if (!out.range) {
+			dieUsage(usage);
+		}
+		i += 2;
+	}
+
+	if (argc != i + 1 || argAt(argc, argv, i).empty()) {
+		dieUsage(usage);
+	}
+
+	out.image_file_path = fs::path(argAt(argc, argv, i));
 	return out;
 }
 
@@ -9,6 +9,7 @@ struct ProgramArgs {
 	Option option{Option::None};
 	fs::path image_file_path{};
 	fs::path data_file_path{};
+	std::optional<ByteRange> range{};
 
 	static std::optional<ProgramArgs> parse(int argc, char** argv);
 };
@@ -114,3 +114,9 @@ struct SensitiveU64 {
 
 enum class Mode   : Byte { conceal, recover };
 enum class Option : Byte { None, Mastodon };
+
+// Part of the recovered file, for `recover --range OFFSET:LEN`.
+struct ByteRange {
+	std::size_t offset{};
+	std::size_t length{};
+};
@@ -1,24 +1,35 @@
 #include "compression.h"
 #include "io_utils.h"
+#include "png_utils.h"
+#include "spsc_ring.h"
+#include "thread_pool.h"
 
 #include <libdeflate.h>
 #include <unistd.h>
 #include <zlib.h>
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cerrno>
+#include <cstring>
+#include <exception>
 #include <format>
+#include <future>
 #include <limits>
 #include <memory>
+#include <optional>
 #include <stdexcept>
 #include <string>
 #include <string_view>
 #include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
 
 namespace {
 
 constexpr std::size_t ZLIB_BUFSIZE = 2 * 1024 * 1024;
-constexpr std::size_t MAX_INFLATED_OUTPUT_SIZE = 3ULL * 1024 * 1024 * 1024;
 constexpr std::size_t MIN_INFLATE_INITIAL_RESERVE = 256 * 1024;
 constexpr std::size_t MAX_INFLATE_INITIAL_RESERVE = 64ULL * 1024 * 1024;
 
@@ -50,17 +61,21 @@ void refillZlibInput(z_stream& strm, std::span<const Byte> input, std::size_t& o
 
 // Owns a z_stream's lifetime. The init/end halves must match, so they are picked
 // together by one flag rather than by two near-identical classes. A failed init
-// throws, so the destructor never runs on an uninitialised stream.
+// throws, so the destructor never runs on an uninitialised stream. Negative
+// `window_bits` selects a raw deflate stream with no zlib header or trailer.
 template <bool deflate_stream>
 struct ZlibStreamGuard {
 	z_stream strm{};
 
-	explicit ZlibStreamGuard(int level = 0) {
+	explicit ZlibStreamGuard(int level = 0, int window_bits = MAX_WBITS) {
 		if constexpr (deflate_stream) {
-			if (deflateInit(&strm, level) != Z_OK) throw std::runtime_error("zlib deflateInit failed.");
+			constexpr int DEFAULT_MEM_LEVEL = 8;
+			if (deflateInit2(&strm, level, Z_DEFLATED, window_bits, DEFAULT_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+				throw std::runtime_error("zlib deflateInit failed.");
+			}
 		} else {
 			(void)level;
-			if (inflateInit(&strm) != Z_OK) throw std::runtime_error("zlib inflateInit failed.");
+			if (inflateInit2(&strm, window_bits) != Z_OK) throw std::runtime_error("zlib inflateInit failed.");
 		}
 	}
 
@@ -153,10 +168,9 @@ void inflateDriver(std::span<const Byte> input, std::size_t max_output_size, Out
 // RFC 1950 zlib stream, so the recover-side inflate decodes either one and the
 // pair must always describe the same intent.
 //
-// Z_DEFAULT_COMPRESSION (level 6), not Z_BEST_COMPRESSION (9): for the >64 MiB
-// zlib streaming path, level 9 costs far more time for ~1-2% ratio. Measured on
-// real corpora, libdeflate L9 costs ~2.6-2.9x the time of L6 for only ~1-2%
-// smaller output (L10-12 are far worse). L6 is the ratio/time sweet spot, and it
+// Level 6, not 9, on both sides: level 9 costs far more time for ~1-2% ratio.
+// Measured on real corpora, libdeflate L9 costs ~2.6-2.9x the time of L6 for
+// only ~1-2% smaller output (L10-12 are far worse). L6 is the ratio/time sweet spot, and it
 // matches the level lodepng already re-encodes the PNG IDAT at (see
 // lodepng_zlib_adapter::compress). Do NOT raise this back toward 9-12 without
 // re-measuring.
@@ -169,37 +183,48 @@ constexpr DeflateLevels
 	STORED_LEVELS  { Z_NO_COMPRESSION,      0 },
 	DEFLATE_LEVELS { Z_DEFAULT_COMPRESSION, 6 };
 
-// Level choice for the secret payload. Inputs that already live in a compressed
-// container gain ~0% from a second deflate pass but cost real time, so they are
-// stored. This holds in every mode: the Mastodon budget is the tightest one, but
-// deflating a .zip/.mp4 does not buy any of it back either.
+// Level choice for the secret payload. Inputs that probeIncompressibleFd() finds
+// already compressed gain ~0% from a second deflate pass but cost real time, so
+// they are stored. This holds in every mode: the Mastodon budget is the tightest
+// one, but deflating a .zip/.mp4 does not buy any of it back either.
 [[nodiscard]] constexpr DeflateLevels payloadLevels(bool is_compressed_file) {
 	return is_compressed_file ? STORED_LEVELS : DEFLATE_LEVELS;
 }
 
 // ----------------------------- libdeflate fast path -----------------------------
 //
-// Inputs at or below this size are deflated in a single whole-buffer libdeflate
-// call (peak RSS ~= input + compressBound, ~2x input). Larger inputs fall back
-// to the zlib streaming path, which holds only fixed-size chunks. Both paths
-// emit a standard RFC 1950 zlib stream, so the recover-side zlib inflate
-// decodes either one.
+// zlibStoreSpan wraps inputs at or below this size in a single whole-buffer
+// libdeflate call (peak RSS ~= input + compressBound, ~2x input), and so does
+// zlibDeflateFd for inputs that fit one window. Larger payloads go to the
+// parallel window deflater below, which holds only a bounded number of
+// fixed-size windows. Every path emits a standard RFC 1950 zlib stream, so the
+// recover-side zlib inflate decodes any of them.
 constexpr std::size_t LIBDEFLATE_WHOLE_BUFFER_LIMIT = 64ULL * 1024 * 1024;
 
+// As ZlibStreamGuard, a failed allocation throws, so `c` is never null.
 struct LibdeflateCompressorGuard {
 	libdeflate_compressor* c{nullptr};
-	explicit LibdeflateCompressorGuard(int level) : c(libdeflate_alloc_compressor(level)) {}
+	explicit LibdeflateCompressorGuard(int level) : c(libdeflate_alloc_compressor(level)) {
+		if (!c) throw std::runtime_error("libdeflate: failed to allocate compressor.");
+	}
 	~LibdeflateCompressorGuard() { if (c) libdeflate_free_compressor(c); }
 	LibdeflateCompressorGuard(const LibdeflateCompressorGuard&) = delete;
 	LibdeflateCompressorGuard& operator=(const LibdeflateCompressorGuard&) = delete;
 };
 
+struct LibdeflateDecompressorGuard {
+	libdeflate_decompressor* d{nullptr};
+	LibdeflateDecompressorGuard() : d(libdeflate_alloc_decompressor()) {
+		if (!d) throw std::runtime_error("libdeflate: failed to allocate decompressor.");
+	}
+	~LibdeflateDecompressorGuard() { if (d) libdeflate_free_decompressor(d); }
+	LibdeflateDecompressorGuard(const LibdeflateDecompressorGuard&) = delete;
+	LibdeflateDecompressorGuard& operator=(const LibdeflateDecompressorGuard&) = delete;
+};
+
 // Whole-buffer zlib-format deflate of `input`, emitted through `on_chunk`.
 void libdeflateZlibCompress(std::span<const Byte> input, int level, const DeflateChunkHandler& on_chunk) {
 	LibdeflateCompressorGuard compressor(level);
-	if (!compressor.c) {
-		throw std::runtime_error("libdeflate: failed to allocate compressor.");
-	}
 
 	const std::size_t bound = libdeflate_zlib_compress_bound(compressor.c, input.size());
 	ScratchBuffer out(bound);
@@ -212,61 +237,85 @@ void libdeflateZlibCompress(std::span<const Byte> input, int level, const Deflat
 	on_chunk(std::span<const Byte>(out.data(), produced));
 }
 
-[[nodiscard]] ssize_t preadRetry(int fd, Byte* buffer, std::size_t size, std::size_t offset) {
-	if (offset > static_cast<std::size_t>(std::numeric_limits<off_t>::max())) {
-		throw std::runtime_error("Failed to read input file: offset exceeds platform limit.");
-	}
-	while (true) {
-		const ssize_t rc = ::pread(
-			fd,
-			buffer,
-			size,
-			static_cast<off_t>(offset)
-		);
-		if (rc < 0 && errno == EINTR) continue;
-		return rc;
-	}
-}
-
-[[noreturn]] void throwReadError() {
-	const std::error_code ec(errno, std::generic_category());
-	throw std::runtime_error(std::format("Failed to read input file: {}", ec.message()));
-}
-
-void verifyExpectedEof(int fd, std::size_t expected_size) {
-	Byte extra{};
-	const ssize_t rc = preadRetry(fd, &extra, 1, expected_size);
-	if (rc < 0) throwReadError();
-	if (rc != 0) {
-		throw std::runtime_error("Failed to read file reliably: file grew while being read.");
-	}
-}
-
 // Read an entire already-open regular file into memory at its validated size.
 [[nodiscard]] vBytes readWholeFile(int fd, std::size_t size) {
 	vBytes buffer(size);
 	ScopedWipe buffer_wiper{buffer};
-	std::size_t offset = 0;
-	while (offset < size) {
-		const std::size_t chunk_size = std::min<std::size_t>(
-			size - offset,
-			static_cast<std::size_t>(std::numeric_limits<ssize_t>::max())
-		);
-		const ssize_t rc = preadRetry(
-			fd,
-			buffer.data() + static_cast<std::ptrdiff_t>(offset),
-			chunk_size,
-			offset
-		);
-		if (rc < 0) throwReadError();
-		if (rc == 0) throw std::runtime_error("Failed to read full file: partial read");
-		offset += static_cast<std::size_t>(rc);
-	}
+	readExactAt(fd, buffer.data(), size, 0);
 	verifyExpectedEof(fd, size);
 	buffer_wiper.release();
 	return buffer;
 }
 
+// ----------------------------- compressibility probe -----------------------------
+//
+// A few evenly spaced samples of the payload are trial-compressed with libdeflate
+// level 1, which costs ~1-2 ms whatever the file size. Content decides, not the
+// filename: a renamed .bin that is really a zip is stored, and an .exe or .mp4
+// that still has slack in it is deflated.
+constexpr std::size_t
+	PROBE_SAMPLE_SIZE  = 64 * 1024,
+	PROBE_SAMPLE_COUNT = 8;
+
+constexpr int PROBE_TRIAL_LEVEL = 1;
+
+// Smallest saving, in percent of the sampled bytes, that makes deflating the
+// whole payload worth its time. A container that announces its own compression
+// must show a clearly larger saving before its magic is overruled: some members
+// of a zip or tar.gz may be stored, but deflate rarely finds much in the rest.
+constexpr std::size_t
+	PROBE_MIN_SAVING_PERCENT           = 3,
+	PROBE_CONTAINER_MIN_SAVING_PERCENT = 10;
+
+struct ContainerMagic {
+	std::size_t offset;
+	std::string_view bytes;
+};
+
+// Formats whose body is already entropy coded.
+constexpr std::array<ContainerMagic, 16> COMPRESSED_CONTAINER_MAGIC {{
+	{ 0, "PK\x03\x04" },                     // zip, jar, docx, apk
+	{ 0, "\x1F\x8B" },                       // gzip
+	{ 0, "BZh" },                            // bzip2
+	{ 0, { "\xFD" "7zXZ\x00", 6 } },         // xz
+	{ 0, "7z\xBC\xAF\x27\x1C" },             // 7z
+	{ 0, "Rar!\x1A\x07" },                   // rar
+	{ 0, "\x28\xB5\x2F\xFD" },               // zstd
+	{ 0, "\x04\x22\x4D\x18" },               // lz4 frame
+	{ 0, "\xFF\xD8\xFF" },                   // jpeg
+	{ 0, "\x89PNG" },                        // png
+	{ 0, "GIF8" },                           // gif
+	{ 8, "WEBP" },                           // webp (RIFF container)
+	{ 4, "ftyp" },                           // mp4, mov, heic
+	{ 0, "OggS" },                           // ogg
+	{ 0, "fLaC" },                           // flac
+	{ 0, "ID3" },                            // mp3 with ID3 tag
+}};
+
+[[nodiscard]] bool hasCompressedContainerMagic(std::span<const Byte> head) {
+	return std::ranges::any_of(COMPRESSED_CONTAINER_MAGIC, [head](const ContainerMagic& magic) {
+		return magic.offset <= head.size() &&
+			magic.bytes.size() <= head.size() - magic.offset &&
+			std::memcmp(head.data() + magic.offset, magic.bytes.data(), magic.bytes.size()) == 0;
+	});
+}
+
+// Size of a trial deflate of `sample`, capped at the sample size. `scratch` must
+// hold the compressor's bound for the sample, which makes a failed trial
+// impossible; one still counts as "no saving".
+[[nodiscard]] std::size_t trialDeflatedSize(
+	const LibdeflateCompressorGuard& trial,
+	std::span<const Byte> sample,
+	std::span<Byte> scratch) {
+	const std::size_t produced = libdeflate_deflate_compress(
+		trial.c, sample.data(), sample.size(), scratch.data(), scratch.size());
+	return (produced == 0) ? sample.size() : std::min(produced, sample.size());
+}
+
+[[nodiscard]] constexpr bool savesAtLeast(std::size_t sampled, std::size_t compressed, std::size_t percent) {
+	return (sampled - compressed) * 100 >= sampled * percent;
+}
+
 template <typename RefillInput>
 void deflateDriver(int level, const DeflateChunkHandler& on_chunk, RefillInput&& refill_input) {
 	ZlibDeflateGuard guard(level);
@@ -301,6 +350,354 @@ void deflateDriver(int level, const DeflateChunkHandler& on_chunk, RefillInput&&
 	}
 }
 
+// ----------------------------- parallel window deflate -----------------------------
+//
+// Payloads larger than one window are cut into fixed-size windows that are
+// compressed concurrently on the shared thread pool, pigz-style. Each window is
+// raw deflate with no dictionary shared across the boundary, so no window
+// depends on another. No block in a window is final: deflated runs end with
+// zlib's Z_SYNC_FLUSH marker and stored runs are written non-final, so every
+// window ends byte aligned, and one empty final stored block after the last
+// window ends the stream. Behind one zlib header, and followed by the Adler-32
+// combined from the per-window checksums, the concatenation is a single ordinary
+// RFC 1950 stream: inflateDriver, or any stock inflate(), decodes it exactly as
+// it decodes zlib's own output.
+//
+// The ratio cost of restarting the 32 KiB history every window is negligible at
+// this size, and peak memory stays at a few windows whatever the input size.
+constexpr std::size_t PARALLEL_DEFLATE_WINDOW_SIZE = 8ULL * 1024 * 1024;
+
+// Windows in flight beyond one per worker: one being read while every worker is
+// busy, and one draining to the handler.
+constexpr std::size_t PARALLEL_DEFLATE_EXTRA_WINDOWS = 2;
+
+constexpr std::size_t
+	SEGMENT_INDEX_HEADER_BYTES = 8,
+	SEGMENT_INDEX_ENTRY_BYTES  = 8,
+	// Segment sizes a decoded index may declare; each in-flight segment holds
+	// one output buffer of this size.
+	MIN_SEGMENT_SIZE = 64 * 1024,
+	MAX_SEGMENT_SIZE = 16 * 1024 * 1024;
+
+static_assert(PARALLEL_DEFLATE_WINDOW_SIZE >= MIN_SEGMENT_SIZE && PARALLEL_DEFLATE_WINDOW_SIZE <= MAX_SEGMENT_SIZE);
+
+// Appended to a non-final segment to close it: an empty fixed-Huffman block
+// with BFINAL set, so the segment decodes as a complete raw deflate stream.
+constexpr std::array<Byte, 2> FINAL_EMPTY_BLOCK{ 0x03, 0x00 };
+
+static_assert(FINAL_EMPTY_BLOCK.size() == DEFLATE_SEGMENT_SLACK_BYTES);
+
+constexpr std::size_t
+	ZLIB_HEADER_BYTES  = 2,
+	ZLIB_TRAILER_BYTES = 4,
+	// Sync-flush marker: up to one byte to hold the empty stored block's 3 header
+	// bits, then its LEN/NLEN. deflateBound() assumes Z_FINISH and leaves it out.
+	SYNC_FLUSH_MAX_BYTES = 5;
+
+// Stored block framing: a byte holding the 3 header bits plus alignment, then
+// LEN/NLEN.
+constexpr std::size_t STORED_BLOCK_HEADER_BYTES = 5;
+
+// Granularity of the per-window store/deflate decision. Large mixed inputs
+// (disk images, tarballs holding media) switch between text-like and
+// already-compressed content far more often than one payload-wide level can
+// follow. Each region is judged from a few small level-1 trial slices, about 3%
+// of its bytes, so high-entropy regions are copied at memcpy speed and deflate
+// time is only spent where it still saves space.
+constexpr std::size_t
+	ADAPTIVE_REGION_SIZE      = 1024 * 1024,
+	ADAPTIVE_TRIAL_SLICE_SIZE = 8 * 1024,
+	ADAPTIVE_TRIAL_SLICES     = 4;
+
+// The two-byte header deflate() itself writes for `level`: CM 8 with a 32 KiB
+// window, FLEVEL from the level, and FCHECK making the pair a multiple of 31.
+[[nodiscard]] std::array<Byte, ZLIB_HEADER_BYTES> zlibStreamHeader(int level) {
+	constexpr Byte CMF_DEFLATE_32K = 0x78;
+	const int effective_level = (level == Z_DEFAULT_COMPRESSION) ? 6 : level;
+	const unsigned flevel =
+		effective_level < 2 ? 0U :
+		effective_level < 6 ? 1U :
+		effective_level == 6 ? 2U : 3U;
+	unsigned flg = flevel << 6;
+	flg += 31U - ((CMF_DEFLATE_32K * 256U + flg) % 31U);
+	return { CMF_DEFLATE_32K, static_cast<Byte>(flg) };
+}
+
+struct DeflateBlock {
+	ScratchBuffer input;
+	ScratchBuffer output;
+	std::size_t input_size{};
+	std::size_t output_size{};
+	std::uint32_t adler{};
+
+	DeflateBlock(std::size_t input_capacity, std::size_t output_capacity)
+		: input(input_capacity), output(output_capacity) {}
+
+	[[nodiscard]] std::span<const Byte> compressed() const noexcept {
+		return std::span<const Byte>(output.data(), output_size);
+	}
+};
+
+// Append stored blocks holding `data` at `output[0]`, which must sit on a byte
+// boundary, returning the bytes written. BFINAL is set on the last block only if
+// `is_final`. The stream stays byte aligned afterwards.
+[[nodiscard]] std::size_t writeStoredBlocks(std::span<Byte> output, std::span<const Byte> data, bool is_final) {
+	constexpr std::size_t MAX_STORED_BLOCK = 0xFFFF;
+	std::size_t written = 0;
+	std::size_t offset = 0;
+	do {
+		const std::size_t length = std::min(MAX_STORED_BLOCK, data.size() - offset);
+		const bool is_final_block = is_final && offset + length == data.size();
+		if (STORED_BLOCK_HEADER_BYTES + length > output.size() - written) {
+			throw std::runtime_error("zlib deflate failed: stored block exceeded its output bound.");
+		}
+		Byte* header = output.data() + written;
+		header[0] = is_final_block ? 1 : 0;
+		header[1] = static_cast<Byte>(length);
+		header[2] = static_cast<Byte>(length >> 8);
+		header[3] = static_cast<Byte>(~length);
+		header[4] = static_cast<Byte>(~length >> 8);
+		std::memcpy(header + STORED_BLOCK_HEADER_BYTES, data.data() + offset, length);
+		written += STORED_BLOCK_HEADER_BYTES + length;
+		offset += length;
+	} while (offset < data.size());
+	return written;
+}
+
+// True if the level-1 trial of a few slices of `region` saves too little for
+// deflate to be worth its time there.
+[[nodiscard]] bool isIncompressibleRegion(
+	const LibdeflateCompressorGuard& trial,
+	std::span<const Byte> region,
+	std::span<Byte> scratch) {
+	const std::size_t slice_size = std::min(region.size(), ADAPTIVE_TRIAL_SLICE_SIZE);
+	const std::size_t slice_count = std::min(ADAPTIVE_TRIAL_SLICES, region.size() / slice_size);
+	std::size_t sampled = 0;
+	std::size_t compressed = 0;
+	for (std::size_t i = 0; i < slice_count; ++i) {
+		const std::size_t offset = (slice_count == 1)
+			? 0
+			: (region.size() - slice_size) / (slice_count - 1) * i;
+		sampled += slice_size;
+		compressed += trialDeflatedSize(trial, region.subspan(offset, slice_size), scratch);
+	}
+	return !savesAtLeast(sampled, compressed, PROBE_MIN_SAVING_PERCENT);
+}
+
+// Worst-case raw deflate size of `size` bytes at `level`, its sync-flush marker
+// included.
+[[nodiscard]] std::size_t rawDeflateRunBound(int level, std::size_t size) {
+	ZlibDeflateGuard guard(level, -MAX_WBITS);
+	return static_cast<std::size_t>(deflateBound(&guard.strm, static_cast<uLong>(size))) + SYNC_FLUSH_MAX_BYTES;
+}
+
+// Worker body: encode one window as raw deflate into its preallocated output,
+// with no final block; the last window is followed by the stream's empty final
+// stored block.
+//
+// At a deflating level the window is judged one ADAPTIVE_REGION_SIZE region at a
+// time: runs of regions the trial finds incompressible are copied into stored
+// blocks, and the remaining runs are deflated by zlib and closed with a
+// Z_SYNC_FLUSH. Each deflated run is primed with the window's preceding 32 KiB
+// as its dictionary, so matches may reach back into an earlier run of the same
+// window but never into another window. A stored payload level skips the trials
+// and copies the whole window.
+void deflateBlock(DeflateBlock& block, const DeflateLevels& levels, bool is_last) {
+	const std::span<const Byte> input(block.input.data(), block.input_size);
+	const std::span<Byte> output = block.output.bytes;
+	std::size_t written = 0;
+
+	std::optional<ZlibDeflateGuard> compressor;
+	auto emitRun = [&](std::size_t offset, std::size_t length, bool stored) {
+		const std::span<const Byte> run = input.subspan(offset, length);
+		if (stored) {
+			written += writeStoredBlocks(output.subspan(written), run, false);
+			return;
+		}
+		if (!compressor) {
+			compressor.emplace(levels.zlib, -MAX_WBITS);
+		} else if (deflateReset(&compressor->strm) != Z_OK) {
+			throw std::runtime_error("zlib deflateReset failed.");
+		}
+		z_stream& strm = compressor->strm;
+		constexpr std::size_t MAX_DICTIONARY = std::size_t{1} << MAX_WBITS;
+		const std::size_t dictionary = std::min(offset, MAX_DICTIONARY);
+		if (dictionary != 0 &&
+			deflateSetDictionary(&strm, input.data() + offset - dictionary, static_cast<uInt>(dictionary)) != Z_OK) {
+			throw std::runtime_error("zlib deflateSetDictionary failed.");
+		}
+		// Runs and windows are far below uInt range, and the output holds the
+		// run's bound, so one call consumes the run and completes the flush.
+		strm.next_in = const_cast<Byte*>(run.data());
+		strm.avail_in = static_cast<uInt>(run.size());
+		strm.next_out = output.data() + written;
+		strm.avail_out = static_cast<uInt>(output.size() - written);
+		const int ret = deflate(&strm, Z_SYNC_FLUSH);
+		if (ret != Z_OK) {
+			throwZlibError("deflate", strm, ret);
+		}
+		if (strm.avail_in != 0 || strm.avail_out == 0) {
+			throw std::runtime_error("zlib deflate failed: run exceeded its output bound.");
+		}
+		written = output.size() - strm.avail_out;
+	};
+
+	if (levels.zlib == STORED_LEVELS.zlib) {
+		emitRun(0, input.size(), true);
+	} else {
+		const LibdeflateCompressorGuard trial(PROBE_TRIAL_LEVEL);
+		ScratchBuffer scratch(libdeflate_deflate_compress_bound(trial.c, ADAPTIVE_TRIAL_SLICE_SIZE));
+		auto regionIsStored = [&](std::size_t offset) {
+			const std::size_t length = std::min(ADAPTIVE_REGION_SIZE, input.size() - offset);
+			return isIncompressibleRegion(trial, input.subspan(offset, length), scratch.bytes);
+		};
+
+		std::size_t run_start = 0;
+		bool run_stored = regionIsStored(0);
+		for (std::size_t offset = ADAPTIVE_REGION_SIZE; offset < input.size(); offset += ADAPTIVE_REGION_SIZE) {
+			const bool stored = regionIsStored(offset);
+			if (stored != run_stored) {
+				emitRun(run_start, offset - run_start, run_stored);
+				run_start = offset;
+				run_stored = stored;
+			}
+		}
+		emitRun(run_start, input.size() - run_start, run_stored);
+	}
+	if (is_last) {
+		written += writeStoredBlocks(output.subspan(written), {}, true);
+	}
+
+	block.output_size = written;
+	block.adler = libdeflate_adler32(1, block.input.data(), block.input_size);
+}
+
+// A window handed to the pool, in input order: its slot and the future that
+// completes once the worker has encoded it.
+struct PendingWindow {
+	std::size_t slot{};
+	std::future<void> done;
+};
+
+// Three stages joined by bounded rings, so wall time approaches the slowest
+// stage instead of the sum of all three:
+//
+//   reader   (calling thread)  pread the next window into a free slot, submit it
+//   encoders (shared pool)     deflate windows concurrently
+//   emitter  (own thread)      take windows back in order and hand them to
+//                              `on_chunk` -- for conceal, encrypt and write
+//
+// `filled` carries pending windows from reader to emitter; `free_slots` returns
+// drained slots to the reader, which is what bounds memory at `depth` windows.
+// The emitter is a dedicated thread rather than a pool task because it blocks on
+// pool futures. Every exit, a failure in any stage included, joins the emitter
+// only after it has waited out every submitted window, so no worker can outlive
+// the slot it writes into.
+void parallelDeflateFd(
+	int fd,
+	std::size_t expected_size,
+	const DeflateLevels& levels,
+	const DeflateChunkHandler& on_chunk,
+	DeflateSegmentIndex* segments) {
+	ThreadPool& pool = sharedThreadPool();
+	const std::size_t depth = pool.size() + PARALLEL_DEFLATE_EXTRA_WINDOWS;
+	// Each region may start its own run, so a window needs room for the bound of
+	// every region, sync-flush marker included, plus the stream's final block.
+	// Stored runs fit inside the same bound: their framing costs less than
+	// deflate's worst case.
+	constexpr std::size_t REGIONS_PER_WINDOW = PARALLEL_DEFLATE_WINDOW_SIZE / ADAPTIVE_REGION_SIZE;
+	const std::size_t output_capacity = checkedAddSize(
+		checkedMulSize(
+			rawDeflateRunBound(levels.zlib, ADAPTIVE_REGION_SIZE),
+			REGIONS_PER_WINDOW,
+			"zlib deflate: window bound overflow."),
+		STORED_BLOCK_HEADER_BYTES,
+		"zlib deflate: window bound overflow.");
+
+	// Declared before the rings and the emitter so it outlives both.
+	std::vector<std::unique_ptr<DeflateBlock>> slots(depth);
+	SpscRing<PendingWindow> filled(depth);
+	SpscRing<std::size_t> free_slots(depth);
+	for (std::size_t slot = 0; slot < depth; ++slot) {
+		(void)free_slots.push(slot);
+	}
+
+	const auto header = zlibStreamHeader(levels.zlib);
+	on_chunk(header);
+	if (segments != nullptr) {
+		segments->segment_size = PARALLEL_DEFLATE_WINDOW_SIZE;
+		segments->compressed_sizes.clear();
+	}
+
+	std::uint32_t adler = 1;
+	std::exception_ptr emit_error;
+	std::atomic<bool> stop{false};
+	{
+		std::jthread emitter([&] {
+			while (std::optional<PendingWindow> window = filled.pop()) {
+				try {
+					window->done.get();
+					if (!stop.load(std::memory_order_relaxed)) {
+						const DeflateBlock& block = *slots[window->slot];
+						adler = static_cast<std::uint32_t>(adler32_combine(
+							adler, block.adler, static_cast<z_off_t>(block.input_size)));
+						if (segments != nullptr) {
+							segments->compressed_sizes.push_back(block.output_size);
+						}
+						on_chunk(block.compressed());
+					}
+				} catch (...) {
+					if (!emit_error) emit_error = std::current_exception();
+					stop.store(true, std::memory_order_relaxed);
+					free_slots.close();
+				}
+				(void)free_slots.push(window->slot);
+			}
+		});
+		// Runs before the emitter's join on every exit: ending the stream is what
+		// lets the emitter drain what is left and return.
+		struct CloseOnExit {
+			SpscRing<PendingWindow>& ring;
+			~CloseOnExit() { ring.close(); }
+		} close_filled{filled};
+
+		try {
+			std::size_t input_offset = 0;
+			while (input_offset < expected_size && !stop.load(std::memory_order_relaxed)) {
+				const std::optional<std::size_t> slot = free_slots.pop();
+				if (!slot) break;
+				if (!slots[*slot]) {
+					slots[*slot] = std::make_unique<DeflateBlock>(PARALLEL_DEFLATE_WINDOW_SIZE, output_capacity);
+				}
+				DeflateBlock& block = *slots[*slot];
+
+				block.input_size = std::min(PARALLEL_DEFLATE_WINDOW_SIZE, expected_size - input_offset);
+				readExactAt(fd, block.input.data(), block.input_size, input_offset);
+				input_offset += block.input_size;
+				const bool is_last = input_offset == expected_size;
+				if (is_last) {
+					verifyExpectedEof(fd, expected_size);
+				}
+				(void)filled.push(PendingWindow{ *slot, pool.submit([&block, levels, is_last] {
+					deflateBlock(block, levels, is_last);
+				}) });
+			}
+		} catch (...) {
+			stop.store(true, std::memory_order_relaxed);
+			throw;
+		}
+	}
+	if (emit_error) {
+		std::rethrow_exception(emit_error);
+	}
+
+	std::array<Byte, ZLIB_TRAILER_BYTES> trailer{};
+	for (std::size_t i = 0; i < trailer.size(); ++i) {
+		trailer[i] = static_cast<Byte>(adler >> (8 * (trailer.size() - 1 - i)));
+	}
+	on_chunk(trailer);
+}
+
 } // namespace
 
 void zlibStoreSpan(std::span<const Byte> data, const DeflateChunkHandler& on_chunk) {
@@ -321,7 +718,98 @@ void zlibStoreSpan(std::span<const Byte> data, const DeflateChunkHandler& on_chu
 	});
 }
 
-void zlibDeflateFd(int fd, std::size_t expected_size, bool is_compressed_file, const DeflateChunkHandler& on_chunk) {
+bool probeIncompressibleFd(int fd, std::size_t size) {
+	if (fd < 0) {
+		throw std::invalid_argument("probeIncompressibleFd: valid input descriptor is required.");
+	}
+	if (size == 0) return false;
+
+	// Small inputs are read whole as contiguous samples; larger ones are sampled at
+	// evenly spaced offsets that always include the head and the tail.
+	const std::size_t sample_size = std::min(size, PROBE_SAMPLE_SIZE);
+	const std::size_t sample_count = std::min(PROBE_SAMPLE_COUNT, (size + sample_size - 1) / sample_size);
+
+	LibdeflateCompressorGuard compressor(PROBE_TRIAL_LEVEL);
+	const std::size_t bound = libdeflate_deflate_compress_bound(compressor.c, sample_size);
+	ScratchBuffer sample(sample_size);
+	ScratchBuffer trial(bound);
+
+	bool has_container_magic = false;
+	std::size_t sampled = 0;
+	std::size_t compressed = 0;
+	for (std::size_t i = 0; i < sample_count; ++i) {
+		const std::size_t offset = (sample_count == 1)
+			? 0
+			: (size - sample_size) / (sample_count - 1) * i;
+		const std::size_t length = std::min(sample_size, size - offset);
+		readExactAt(fd, sample.data(), length, offset);
+		if (i == 0) {
+			has_container_magic = hasCompressedContainerMagic(std::span<const Byte>(sample.data(), length));
+		}
+
+		sampled += length;
+		compressed += trialDeflatedSize(compressor, std::span<const Byte>(sample.data(), length), trial.bytes);
+	}
+
+	const std::size_t min_saving_percent = has_container_magic
+		? PROBE_CONTAINER_MIN_SAVING_PERCENT
+		: PROBE_MIN_SAVING_PERCENT;
+	return !savesAtLeast(sampled, compressed, min_saving_percent);
+}
+
+std::size_t zlibDeflatedSizeBound(std::size_t expected_size, bool is_compressed_file) {
+	constexpr std::string_view OVERFLOW_ERROR = "File Size Error: Compressed payload size overflow.";
+	constexpr std::size_t MAX_STORED_BLOCK = 0xFFFF;
+
+	// Both encoders cut a window into blocks independently of its neighbours, so
+	// the whole is the full windows plus the remainder window. One window for
+	// inputs that take the whole-buffer path.
+	const std::size_t full_windows = expected_size / PARALLEL_DEFLATE_WINDOW_SIZE;
+	const std::size_t last_window = expected_size % PARALLEL_DEFLATE_WINDOW_SIZE;
+
+	// A multi-window stream ends in its own empty final stored block.
+	std::size_t encoded = (expected_size > PARALLEL_DEFLATE_WINDOW_SIZE) ? STORED_BLOCK_HEADER_BYTES : 0;
+	if (payloadLevels(is_compressed_file).libdeflate == STORED_LEVELS.libdeflate) {
+		// Exact: libdeflate's level 0 and writeStoredBlocks() both emit maximal
+		// stored blocks, and an empty window still carries one empty block.
+		auto storedSize = [](std::size_t window) {
+			const std::size_t blocks = std::max<std::size_t>(1, (window + MAX_STORED_BLOCK - 1) / MAX_STORED_BLOCK);
+			return window + blocks * STORED_BLOCK_HEADER_BYTES;
+		};
+		encoded = checkedAddSize(encoded,
+			checkedMulSize(full_windows, storedSize(PARALLEL_DEFLATE_WINDOW_SIZE), OVERFLOW_ERROR), OVERFLOW_ERROR);
+		if (last_window != 0 || full_windows == 0) {
+			encoded = checkedAddSize(encoded, storedSize(last_window), OVERFLOW_ERROR);
+		}
+	} else {
+		// Upper bound: every region of a window may start its own run and end in
+		// a sync-flush marker, and both bounds are subadditive, so this covers
+		// any split the region trials choose. A single window is deflated whole
+		// by libdeflate and a larger payload by zlib, so each region takes the
+		// larger of the two bounds.
+		const LibdeflateCompressorGuard compressor(DEFLATE_LEVELS.libdeflate);
+		auto deflatedBound = [&](std::size_t window) {
+			const std::size_t regions = std::max<std::size_t>(1, (window + ADAPTIVE_REGION_SIZE - 1) / ADAPTIVE_REGION_SIZE);
+			const std::size_t region = std::min(window, ADAPTIVE_REGION_SIZE);
+			return regions * std::max(
+				libdeflate_deflate_compress_bound(compressor.c, region) + SYNC_FLUSH_MAX_BYTES,
+				rawDeflateRunBound(DEFLATE_LEVELS.zlib, region));
+		};
+		encoded = checkedAddSize(encoded,
+			checkedMulSize(full_windows, deflatedBound(PARALLEL_DEFLATE_WINDOW_SIZE), OVERFLOW_ERROR), OVERFLOW_ERROR);
+		if (last_window != 0 || full_windows == 0) {
+			encoded = checkedAddSize(encoded, deflatedBound(last_window), OVERFLOW_ERROR);
+		}
+	}
+	return checkedAddSize(encoded, ZLIB_HEADER_BYTES + ZLIB_TRAILER_BYTES, OVERFLOW_ERROR);
+}
+
+void zlibDeflateFd(
+	int fd,
+	std::size_t expected_size,
+	bool is_compressed_file,
+	const DeflateChunkHandler& on_chunk,
+	DeflateSegmentIndex* segments) {
 	if (!on_chunk) {
 		throw std::invalid_argument("zlibDeflateFd: output handler is required.");
 	}
@@ -331,7 +819,10 @@ void zlibDeflateFd(int fd, std::size_t expected_size, bool is_compressed_file, c
 
 	const DeflateLevels levels = payloadLevels(is_compressed_file);
 
-	if (expected_size <= LIBDEFLATE_WHOLE_BUFFER_LIMIT) {
+	if (expected_size <= PARALLEL_DEFLATE_WINDOW_SIZE) {
+		if (segments != nullptr) {
+			*segments = DeflateSegmentIndex{};
+		}
 		vBytes input = readWholeFile(fd, expected_size);
 		ScopedWipe input_wiper{input};
 		libdeflateZlibCompress(
@@ -341,31 +832,104 @@ void zlibDeflateFd(int fd, std::size_t expected_size, bool is_compressed_file, c
 		return;
 	}
 
-	ScratchBuffer input_buffer(ZLIB_BUFSIZE);
-	bool reached_eof = false;
-	std::size_t input_offset = 0;
+	parallelDeflateFd(fd, expected_size, levels, on_chunk, segments);
+}
 
-	deflateDriver(levels.zlib, on_chunk, [&](z_stream& strm) {
-		if (strm.avail_in == 0 && !reached_eof) {
-			if (input_offset == expected_size) {
-				verifyExpectedEof(fd, expected_size);
-				reached_eof = true;
-			} else {
-				const std::size_t request_size = std::min(ZLIB_BUFSIZE, expected_size - input_offset);
-				const ssize_t rc = preadRetry(fd, input_buffer.data(), request_size, input_offset);
-				if (rc < 0) throwReadError();
-				if (rc == 0) throw std::runtime_error("Failed to read full file: partial read");
-				strm.next_in = input_buffer.data();
-				strm.avail_in = static_cast<uInt>(rc);
-				input_offset += static_cast<std::size_t>(rc);
-				if (input_offset == expected_size) {
-					verifyExpectedEof(fd, expected_size);
-					reached_eof = true;
-				}
-			}
+std::size_t deflateSegmentIndexSize(std::size_t expected_size) {
+	if (expected_size <= PARALLEL_DEFLATE_WINDOW_SIZE) {
+		return 0;
+	}
+	const std::size_t windows = expected_size / PARALLEL_DEFLATE_WINDOW_SIZE +
+		(expected_size % PARALLEL_DEFLATE_WINDOW_SIZE != 0 ? 1 : 0);
+	return SEGMENT_INDEX_HEADER_BYTES + windows * SEGMENT_INDEX_ENTRY_BYTES;
+}
+
+vBytes encodeDeflateSegmentIndex(const DeflateSegmentIndex& index) {
+	vBytes encoded(SEGMENT_INDEX_HEADER_BYTES + index.compressed_sizes.size() * SEGMENT_INDEX_ENTRY_BYTES);
+	storeLe(encoded.data(), index.segment_size, 4);
+	storeLe(encoded.data() + 4, index.compressed_sizes.size(), 4);
+	for (std::size_t i = 0; i < index.compressed_sizes.size(); ++i) {
+		storeLe(encoded.data() + SEGMENT_INDEX_HEADER_BYTES + i * SEGMENT_INDEX_ENTRY_BYTES,
+			index.compressed_sizes[i], SEGMENT_INDEX_ENTRY_BYTES);
+	}
+	return encoded;
+}
+
+DeflateSegmentIndex decodeDeflateSegmentIndex(
+	std::span<const Byte> encoded, std::size_t original_size, std::size_t compressed_size) {
+	constexpr const char* CORRUPT_INDEX_ERROR = "zlib inflate failed: corrupt segment index.";
+	if (encoded.size() < SEGMENT_INDEX_HEADER_BYTES || original_size == 0) {
+		throw std::runtime_error(CORRUPT_INDEX_ERROR);
+	}
+
+	DeflateSegmentIndex index;
+	index.segment_size = static_cast<std::size_t>(loadLe(encoded.data(), 4));
+	const std::size_t count = static_cast<std::size_t>(loadLe(encoded.data() + 4, 4));
+	if (index.segment_size < MIN_SEGMENT_SIZE || index.segment_size > MAX_SEGMENT_SIZE ||
+		count != original_size / index.segment_size + (original_size % index.segment_size != 0 ? 1 : 0) ||
+		(encoded.size() - SEGMENT_INDEX_HEADER_BYTES) / SEGMENT_INDEX_ENTRY_BYTES != count ||
+		(encoded.size() - SEGMENT_INDEX_HEADER_BYTES) % SEGMENT_INDEX_ENTRY_BYTES != 0) {
+		throw std::runtime_error(CORRUPT_INDEX_ERROR);
+	}
+
+	// Generous against the window deflater's own bound; only there to stop a
+	// hostile entry from sizing a segment buffer.
+	const std::size_t max_segment_bytes = index.segment_size + index.segment_size / 8 + 64 * 1024;
+	std::size_t total = ZLIB_HEADER_BYTES + ZLIB_TRAILER_BYTES;
+	index.compressed_sizes.resize(count);
+	for (std::size_t i = 0; i < count; ++i) {
+		const std::uint64_t size = loadLe(encoded.data() + SEGMENT_INDEX_HEADER_BYTES + i * SEGMENT_INDEX_ENTRY_BYTES,
+			SEGMENT_INDEX_ENTRY_BYTES);
+		if (size == 0 || size > max_segment_bytes || size > compressed_size - total) {
+			throw std::runtime_error(CORRUPT_INDEX_ERROR);
 		}
-		return reached_eof && strm.avail_in == 0;
-	});
+		index.compressed_sizes[i] = static_cast<std::size_t>(size);
+		total += index.compressed_sizes[i];
+	}
+	if (total != compressed_size) {
+		throw std::runtime_error(CORRUPT_INDEX_ERROR);
+	}
+	return index;
+}
+
+DeflateSegmentSpan deflateSegmentAt(
+	const DeflateSegmentIndex& index, std::size_t original_size, std::size_t segment) {
+	if (segment >= index.compressed_sizes.size()) {
+		throw std::invalid_argument("deflateSegmentAt: segment out of range.");
+	}
+	DeflateSegmentSpan span{
+		.compressed_offset = ZLIB_HEADER_BYTES,
+		.compressed_size = index.compressed_sizes[segment],
+		.output_offset = segment * index.segment_size
+	};
+	for (std::size_t i = 0; i < segment; ++i) {
+		span.compressed_offset += index.compressed_sizes[i];
+	}
+	span.output_size = segment + 1 == index.compressed_sizes.size()
+		? original_size - span.output_offset
+		: index.segment_size;
+	return span;
+}
+
+std::uint32_t inflateDeflateSegment(std::span<Byte> input, bool is_last, std::span<Byte> out) {
+	if (input.size() < DEFLATE_SEGMENT_SLACK_BYTES) {
+		throw std::invalid_argument("inflateDeflateSegment: input has no room for the closing block.");
+	}
+	std::size_t input_size = input.size() - DEFLATE_SEGMENT_SLACK_BYTES;
+	if (!is_last) {
+		std::memcpy(input.data() + input_size, FINAL_EMPTY_BLOCK.data(), FINAL_EMPTY_BLOCK.size());
+		input_size += FINAL_EMPTY_BLOCK.size();
+	}
+
+	const LibdeflateDecompressorGuard decompressor;
+	std::size_t in_used = 0;
+	std::size_t out_used = 0;
+	const libdeflate_result result = libdeflate_deflate_decompress_ex(
+		decompressor.d, input.data(), input_size, out.data(), out.size(), &in_used, &out_used);
+	if (result != LIBDEFLATE_SUCCESS || in_used != input_size || out_used != out.size()) {
+		throw std::runtime_error("zlib inflate failed: corrupt segment.");
+	}
+	return static_cast<std::uint32_t>(libdeflate_adler32(1, out.data(), out.size()));
 }
 
 vBytes zlibInflatePrefix(std::span<const Byte> data, std::size_t prefix_size) {
@@ -407,6 +971,26 @@ vBytes zlibInflatePrefix(std::span<const Byte> data, std::size_t prefix_size) {
 	return prefix;
 }
 
+void zlibInflateExact(std::span<const Byte> data, std::span<Byte> out) {
+	const LibdeflateDecompressorGuard decompressor;
+	std::size_t in_used = 0;
+	std::size_t out_used = 0;
+	const libdeflate_result result = libdeflate_zlib_decompress_ex(
+		decompressor.d, data.data(), data.size(), out.data(), out.size(), &in_used, &out_used);
+	if (result == LIBDEFLATE_INSUFFICIENT_SPACE) {
+		throw std::runtime_error("zlib inflate failed: output is larger than recorded.");
+	}
+	if (result != LIBDEFLATE_SUCCESS) {
+		throw std::runtime_error("zlib inflate failed: corrupt stream.");
+	}
+	if (out_used != out.size()) {
+		throw std::runtime_error("zlib inflate failed: output is smaller than recorded.");
+	}
+	if (in_used != data.size()) {
+		throw std::runtime_error("zlib inflate failed: trailing data after stream end.");
+	}
+}
+
 vBytes zlibInflateSpanBounded(std::span<const Byte> data, std::size_t max_output_size) {
 	vBytes result;
 	result.reserve(inflateReserveHint(data.size(), max_output_size));
@@ -417,14 +1001,228 @@ vBytes zlibInflateSpanBounded(std::span<const Byte> data, std::size_t max_output
 	return result;
 }
 
-std::size_t zlibInflateToFd(const vBytes& data_vec, int fd) {
-	std::size_t total_written = 0;
-	inflateDriver(data_vec, MAX_INFLATED_OUTPUT_SIZE, [&](const Byte* buf, std::size_t len) {
-		writeAllToFd(fd, std::span<const Byte>(buf, len));
-		total_written += len;
-	});
-	if (total_written == 0) {
-		throw std::runtime_error("Zlib Compression Error: Output file is empty. Inflating file failed.");
+struct ZlibInflateStream::State {
+	ZlibInflateGuard guard;
+	ScratchBuffer buffer{ZLIB_BUFSIZE};
+	InflateChunkHandler on_output;
+	std::size_t max_output_size{};
+	std::size_t total_output{};
+	bool ended{false};
+
+	// One inflate() call into the scratch buffer, its output handed on. True
+	// while zlib may still have output pending for the same input.
+	[[nodiscard]] bool step(int& ret) {
+		z_stream& strm = guard.strm;
+		strm.next_out = buffer.data();
+		strm.avail_out = static_cast<uInt>(ZLIB_BUFSIZE);
+		ret = inflate(&strm, Z_NO_FLUSH);
+		const std::size_t produced = ZLIB_BUFSIZE - strm.avail_out;
+		if (produced > 0) {
+			if (produced > max_output_size || total_output > max_output_size - produced) {
+				throw std::runtime_error("Zlib Compression Error: Inflated data exceeds maximum program size limit.");
+			}
+			on_output(std::span<const Byte>(buffer.data(), produced));
+			total_output += produced;
+		}
+		if (ret == Z_STREAM_END) {
+			ended = true;
+			return false;
+		}
+		if (ret != Z_OK && ret != Z_BUF_ERROR) {
+			throwZlibError("inflate", strm, ret);
+		}
+		return strm.avail_out == 0;
+	}
+};
+
+ZlibInflateStream::ZlibInflateStream(std::size_t max_output_size, InflateChunkHandler on_output)
+	: state_(std::make_unique<State>()) {
+	if (!on_output) {
+		throw std::invalid_argument("ZlibInflateStream: output handler is required.");
+	}
+	state_->on_output = std::move(on_output);
+	state_->max_output_size = max_output_size;
+}
+
+ZlibInflateStream::~ZlibInflateStream() = default;
+
+void ZlibInflateStream::feed(std::span<const Byte> input) {
+	if (input.empty()) return;
+	if (state_->ended) {
+		throw std::runtime_error("zlib inflate failed: trailing data after stream end.");
+	}
+
+	z_stream& strm = state_->guard.strm;
+	std::size_t input_offset = 0;
+	int ret = Z_OK;
+	bool output_pending = false;
+	while (true) {
+		refillZlibInput(strm, input, input_offset);
+		if (strm.avail_in == 0 && !output_pending) return;
+		output_pending = state_->step(ret);
+		if (state_->ended) {
+			if (strm.avail_in != 0 || input_offset != input.size()) {
+				throw std::runtime_error("zlib inflate failed: trailing data after stream end.");
+			}
+			return;
+		}
+		if (ret == Z_BUF_ERROR && strm.avail_in != 0 && !output_pending) {
+			throw std::runtime_error("zlib inflate failed: stalled stream.");
+		}
+	}
+}
+
+void ZlibInflateStream::finish() {
+	z_stream& strm = state_->guard.strm;
+	int ret = Z_OK;
+	// Flush whatever output zlib still holds for input it has already taken.
+	while (!state_->ended) {
+		strm.next_in = nullptr;
+		strm.avail_in = 0;
+		if (!state_->step(ret) && ret == Z_BUF_ERROR) break;
+	}
+	if (!state_->ended) {
+		throw std::runtime_error("zlib inflate failed: truncated stream.");
+	}
+}
+
+std::size_t ZlibInflateStream::totalOutput() const noexcept {
+	return state_->total_output;
+}
+
+struct ZlibSegmentInflater::State {
+	struct Slot {
+		std::unique_ptr<ScratchBuffer> input;
+		std::unique_ptr<ScratchBuffer> output;
+		std::future<std::uint32_t> done;
+	};
+
+	DeflateSegmentIndex index;
+	std::size_t original_size{};
+	SegmentOutputHandler on_segment;
+	std::size_t max_compressed_size{};
+	std::vector<Slot> slots;
+	std::array<Byte, ZLIB_HEADER_BYTES> header{};
+	std::array<Byte, ZLIB_TRAILER_BYTES> trailer{};
+	std::size_t header_size{};
+	std::size_t trailer_size{};
+	std::size_t fill_size{};
+	std::size_t next_segment{};
+	std::size_t consumed_segments{};
+	std::uint32_t adler{1};
+
+	~State() {
+		// Workers still reference the buffers and the handler.
+		for (auto& slot : slots) {
+			if (slot.done.valid()) slot.done.wait();
+		}
+	}
+
+	[[nodiscard]] std::size_t outputSize(std::size_t segment) const noexcept {
+		return segment + 1 == index.compressed_sizes.size()
+			? original_size - segment * index.segment_size
+			: index.segment_size;
+	}
+
+	[[nodiscard]] Slot& slotFor(std::size_t segment) {
+		return slots[segment % slots.size()];
+	}
+
+	void consumeOldest() {
+		const std::size_t segment = consumed_segments;
+		std::future<std::uint32_t> done = std::move(slotFor(segment).done);
+		adler = static_cast<std::uint32_t>(adler32_combine(
+			adler, done.get(), static_cast<z_off_t>(outputSize(segment))));
+		++consumed_segments;
+	}
+
+	// The slot for segment next_segment, its previous segment consumed first.
+	[[nodiscard]] Slot& fillSlot() {
+		Slot& slot = slotFor(next_segment);
+		if (slot.done.valid()) {
+			consumeOldest();
+		}
+		if (!slot.input) {
+			slot.input = std::make_unique<ScratchBuffer>(max_compressed_size + DEFLATE_SEGMENT_SLACK_BYTES);
+			slot.output = std::make_unique<ScratchBuffer>(index.segment_size);
+		}
+		return slot;
+	}
+
+	void submit(Slot& slot) {
+		const std::size_t segment = next_segment;
+		const bool is_last = segment + 1 == index.compressed_sizes.size();
+		const std::span<Byte> input(slot.input->data(), index.compressed_sizes[segment] + DEFLATE_SEGMENT_SLACK_BYTES);
+		const std::span<Byte> output(slot.output->data(), outputSize(segment));
+		const std::size_t output_offset = segment * index.segment_size;
+
+		slot.done = sharedThreadPool().submit([this, input, is_last, output, output_offset] {
+			const std::uint32_t checksum = inflateDeflateSegment(input, is_last, output);
+			on_segment(output_offset, output);
+			return checksum;
+		});
+		++next_segment;
+		fill_size = 0;
+	}
+};
+
+ZlibSegmentInflater::ZlibSegmentInflater(
+	DeflateSegmentIndex index, std::size_t original_size, SegmentOutputHandler on_segment)
+	: state_(std::make_unique<State>()) {
+	if (!on_segment) {
+		throw std::invalid_argument("ZlibSegmentInflater: output handler is required.");
+	}
+	if (index.compressed_sizes.empty() || index.segment_size == 0) {
+		throw std::invalid_argument("ZlibSegmentInflater: segment index is required.");
+	}
+	state_->max_compressed_size = *std::ranges::max_element(index.compressed_sizes);
+	state_->slots = std::vector<State::Slot>(
+		std::min(sharedThreadPool().size() + PARALLEL_DEFLATE_EXTRA_WINDOWS, index.compressed_sizes.size()));
+	state_->index = std::move(index);
+	state_->original_size = original_size;
+	state_->on_segment = std::move(on_segment);
+}
+
+ZlibSegmentInflater::~ZlibSegmentInflater() = default;
+
+void ZlibSegmentInflater::feed(std::span<const Byte> input) {
+	State& state = *state_;
+	while (!input.empty()) {
+		if (state.header_size < state.header.size()) {
+			if (collect(input, state.header.data(), state.header_size, state.header.size()) &&
+				((state.header[0] & 0x0F) != Z_DEFLATED || (state.header[1] & 0x20) != 0 ||
+				 (state.header[0] * 256u + state.header[1]) % 31 != 0)) {
+				throw std::runtime_error("zlib inflate failed: corrupt stream header.");
+			}
+			continue;
+		}
+		if (state.next_segment < state.index.compressed_sizes.size()) {
+			State::Slot& slot = state.fillSlot();
+			if (collect(input, slot.input->data(), state.fill_size, state.index.compressed_sizes[state.next_segment])) {
+				state.submit(slot);
+			}
+			continue;
+		}
+		if (state.trailer_size == state.trailer.size()) {
+			throw std::runtime_error("zlib inflate failed: trailing data after stream end.");
+		}
+		(void)collect(input, state.trailer.data(), state.trailer_size, state.trailer.size());
+	}
+}
+
+void ZlibSegmentInflater::finish() {
+	State& state = *state_;
+	while (state.consumed_segments < state.next_segment) {
+		state.consumeOldest();
+	}
+	if (state.next_segment != state.index.compressed_sizes.size() || state.trailer_size != state.trailer.size()) {
+		throw std::runtime_error("zlib inflate failed: truncated stream.");
+	}
+	std::uint32_t expected = 0;
+	for (const Byte byte : state.trailer) {
+		expected = (expected << 8) | byte;
+	}
+	if (expected != state.adler) {
+		throw std::runtime_error("zlib inflate failed: Adler-32 mismatch.");
 	}
-	return total_written;
 }
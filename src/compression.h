@@ -3,14 +3,84 @@
 #include "common.h"
 
 #include <functional>
+#include <memory>
 #include <span>
+#include <vector>
 
 using DeflateChunkHandler = std::function<void(std::span<const Byte>)>;
 
-// Deflate the secret payload read from `fd`. Inputs that are already in a
-// compressed container are stored rather than deflated -- see payloadLevels()
-// in compression.cpp.
-void zlibDeflateFd(int fd, std::size_t expected_size, bool is_compressed_file, const DeflateChunkHandler& on_chunk);
+// Sample `size` bytes of `fd` with pread and report whether deflate is unlikely
+// to pay for itself: magic bytes of a compressed container plus a trial
+// compression of a few blocks. Leaves the file offset untouched.
+[[nodiscard]] bool probeIncompressibleFd(int fd, std::size_t size);
+
+// Where each window of a multi-window zlib stream sits. Windows are encoded with
+// no back-references into one another and end on a byte boundary, so each is a
+// raw deflate segment that decodes on its own into a known slice of the output.
+struct DeflateSegmentIndex {
+	// Decoded bytes per segment; only the last may be shorter.
+	std::size_t segment_size{};
+	// Raw deflate bytes of each segment, in stream order, after the 2-byte zlib
+	// header.
+	std::vector<std::size_t> compressed_sizes{};
+};
+
+// Deflate the secret payload read from `fd`. Inputs that probeIncompressibleFd()
+// flags are stored rather than deflated -- see payloadLevels() in
+// compression.cpp.
+//
+// Given `segments`, also records the stream's segment index there; it is left
+// empty when the payload fits a single window, which has nothing to split.
+void zlibDeflateFd(
+	int fd,
+	std::size_t expected_size,
+	bool is_compressed_file,
+	const DeflateChunkHandler& on_chunk,
+	DeflateSegmentIndex* segments = nullptr);
+
+// Size of the encoded index zlibDeflateFd() records for `expected_size` bytes,
+// zero when there is none.
+[[nodiscard]] std::size_t deflateSegmentIndexSize(std::size_t expected_size);
+
+// Wire form of a segment index, stored beside the stream it describes:
+//   [0..4)  segment size, little-endian
+//   [4..8)  segment count, little-endian
+//   then one little-endian 64-bit compressed size per segment.
+[[nodiscard]] vBytes encodeDeflateSegmentIndex(const DeflateSegmentIndex& index);
+// Throws unless `encoded` is a well-formed index for a zlib stream of
+// `compressed_size` bytes that inflates to `original_size`.
+[[nodiscard]] DeflateSegmentIndex decodeDeflateSegmentIndex(
+	std::span<const Byte> encoded, std::size_t original_size, std::size_t compressed_size);
+
+// Where segment `segment` of a stream with `index` lies on either side of the
+// codec: its raw deflate bytes within the zlib stream, header included in the
+// offset, and the decoded bytes it inflates to.
+struct DeflateSegmentSpan {
+	std::size_t compressed_offset{};
+	std::size_t compressed_size{};
+	std::size_t output_offset{};
+	std::size_t output_size{};
+};
+
+[[nodiscard]] DeflateSegmentSpan deflateSegmentAt(
+	const DeflateSegmentIndex& index, std::size_t original_size, std::size_t segment);
+
+// Scratch a segment's input buffer needs past its compressed bytes; see
+// inflateDeflateSegment().
+inline constexpr std::size_t DEFLATE_SEGMENT_SLACK_BYTES = 2;
+
+// Decodes one segment on its own, for a reader that wants only part of the
+// stream. `input` holds the segment's raw deflate bytes followed by
+// DEFLATE_SEGMENT_SLACK_BYTES of scratch, which a non-final segment is closed
+// with. Throws unless the segment fills `out` exactly. Returns the Adler-32 of
+// the decoded bytes.
+std::uint32_t inflateDeflateSegment(std::span<Byte> input, bool is_last, std::span<Byte> out);
+
+// Size of the stream zlibDeflateFd() produces for `expected_size` bytes: exact
+// when the payload is stored, an upper bound when it is deflated. Lets callers
+// size their output once, and reject a stored payload that cannot fit before
+// any of it is read.
+[[nodiscard]] std::size_t zlibDeflatedSizeBound(std::size_t expected_size, bool is_compressed_file);
 
 // Wrap `data` in a *stored* (level 0) RFC 1950 stream. Used for the Mastodon
 // iCCP profile, whose contents are ciphertext: deflating it costs real time and
@@ -19,4 +89,68 @@ void zlibStoreSpan(std::span<const Byte> data, const DeflateChunkHandler& on_chu
 
 [[nodiscard]] vBytes zlibInflatePrefix(std::span<const Byte> data, std::size_t prefix_size);
 [[nodiscard]] vBytes zlibInflateSpanBounded(std::span<const Byte> data, std::size_t max_output_size);
-[[nodiscard]] std::size_t zlibInflateToFd(const vBytes& data_vec, int fd);
+
+using InflateChunkHandler = std::function<void(std::span<const Byte>)>;
+
+// Largest payload recover will inflate, in bytes.
+inline constexpr std::size_t MAX_INFLATED_OUTPUT_SIZE = 3ULL * 1024 * 1024 * 1024;
+
+// Largest payload recover decodes with a single zlibInflateExact() call when
+// it knows the size up front. Both sides are then held whole, so the limit is
+// what keeps recover's memory bounded.
+inline constexpr std::size_t MAX_ONE_SHOT_INFLATE_SIZE = 16ULL * 1024 * 1024;
+
+// Whole-buffer libdeflate inflate of a complete zlib stream whose decoded size
+// is known: throws unless `data` is exactly one stream that fills `out` exactly.
+void zlibInflateExact(std::span<const Byte> data, std::span<Byte> out);
+
+// Inflate a zlib stream that arrives in pieces, handing output to `on_output` as
+// it is produced, so neither side of the stream is ever held whole. Throws once
+// the output would pass `max_output_size`, on corrupt input, and on any byte fed
+// after the stream's end.
+class ZlibInflateStream {
+public:
+	ZlibInflateStream(std::size_t max_output_size, InflateChunkHandler on_output);
+	~ZlibInflateStream();
+
+	ZlibInflateStream(const ZlibInflateStream&) = delete;
+	ZlibInflateStream& operator=(const ZlibInflateStream&) = delete;
+
+	void feed(std::span<const Byte> input);
+	// Throws unless the stream ended, exactly at the last byte fed.
+	void finish();
+	[[nodiscard]] std::size_t totalOutput() const noexcept;
+
+private:
+	struct State;
+	std::unique_ptr<State> state_;
+};
+
+// Called from pool workers, concurrently and in no particular order, with one
+// decoded segment and where it belongs in the output.
+using SegmentOutputHandler = std::function<void(std::size_t output_offset, std::span<const Byte> data)>;
+
+// The parallel counterpart of ZlibInflateStream for a stream with a segment
+// index: the stream still arrives in order, but each segment is decoded on the
+// shared pool as soon as its last byte is in, up to one per worker plus two at
+// once. The Adler-32 trailer is checked against the segments' checksums
+// combined in order.
+//
+// Must be driven from a thread outside the pool: it waits on decoding tasks.
+class ZlibSegmentInflater {
+public:
+	ZlibSegmentInflater(DeflateSegmentIndex index, std::size_t original_size, SegmentOutputHandler on_segment);
+	~ZlibSegmentInflater();
+
+	ZlibSegmentInflater(const ZlibSegmentInflater&) = delete;
+	ZlibSegmentInflater& operator=(const ZlibSegmentInflater&) = delete;
+
+	void feed(std::span<const Byte> input);
+	// Waits for every segment, then throws unless the whole stream was fed and
+	// its trailer matches.
+	void finish();
+
+private:
+	struct State;
+	std::unique_ptr<State> state_;
+};
@@ -171,13 +171,6 @@ void validateDataFilename(const fs::path& data_file_path, const std::string& dat
 	}
 }
 
-[[nodiscard]] bool isLikelyCompressedInputFile(const fs::path& path) {
-	return hasFileExtension(path, {
-		".zip", ".jar", ".rar", ".7z", ".bz2", ".gz", ".xz", ".lz", ".lz4", ".cab", ".rpm", ".deb",
-		".mp4", ".mp3", ".exe", ".jpg", ".jpeg", ".jfif", ".png", ".webp", ".gif", ".ogg", ".flac"
-	});
-}
-
 [[nodiscard]] std::uint32_t checkedChunkDataSize(std::size_t payload_size, std::size_t chunk_diff) {
 	if (chunk_diff > PNG_MAX_CHUNK_DATA_SIZE || payload_size > PNG_MAX_CHUNK_DATA_SIZE - chunk_diff) {
 		throw std::runtime_error("PNG Error: Chunk payload exceeds PNG chunk size limit.");
@@ -331,12 +324,61 @@ void writeChunkFromParts(int fd, std::span<const Byte> chunk_type, std::initiali
 
 	for (const auto part : chunk_data_parts) {
 		writeAllToFd(fd, part);
-		crc = pdvrdtCrc32Update(crc, part);
+		crc = pdvrdtCrc32UpdateParallel(crc, part);
 	}
 
 	writeUint32OrThrow(fd, crc);
 }
 
+// A PNG chunk written straight to `fd` when its data length is not known up
+// front. The length field goes out as a placeholder, the CRC is folded in as the
+// data streams past, and finish() appends the CRC and patches the length in
+// place with pwrite.
+class StreamingChunkWriter {
+public:
+	StreamingChunkWriter(int fd, std::size_t chunk_offset, std::span<const Byte> chunk_type)
+		: fd_(fd), chunk_offset_(chunk_offset), crc_(pdvrdtCrc32Update(0, chunk_type)) {
+		if (chunk_type.size() != 4) {
+			throw std::invalid_argument("PNG Error: Invalid chunk type size.");
+		}
+		writeUint32OrThrow(fd_, 0);
+		writeAllToFd(fd_, chunk_type);
+	}
+
+	StreamingChunkWriter(const StreamingChunkWriter&) = delete;
+	StreamingChunkWriter& operator=(const StreamingChunkWriter&) = delete;
+
+	void write(std::span<const Byte> data) {
+		write(data, pdvrdtCrc32Update(0, data));
+	}
+
+	// For data whose CRC-32 the producer already took while it was in cache:
+	// folded in without reading the data again.
+	void write(std::span<const Byte> data, std::uint32_t data_crc) {
+		if (data.size() > PNG_MAX_CHUNK_DATA_SIZE - data_size_) {
+			throw std::runtime_error("PNG Error: Chunk payload exceeds PNG chunk size limit.");
+		}
+		writeAllToFd(fd_, data);
+		crc_ = pdvrdtCrc32Combine(crc_, data_crc, data.size());
+		data_size_ += data.size();
+	}
+
+	// Returns the total size of the finished chunk, framing included.
+	[[nodiscard]] std::size_t finish() {
+		writeUint32OrThrow(fd_, crc_);
+		std::array<Byte, 4> length{};
+		updateValue(length, 0, static_cast<std::uint32_t>(data_size_));
+		pwriteAllToFd(fd_, length, chunk_offset_);
+		return data_size_ + PNG_CHUNK_OVERHEAD;
+	}
+
+private:
+	int fd_;
+	std::size_t chunk_offset_;
+	std::uint32_t crc_;
+	std::size_t data_size_{};
+};
+
 void verifyFdSize(int fd, std::size_t expected_size) {
 	struct stat st{};
 	if (::fstat(fd, &st) != 0) {
@@ -376,16 +418,20 @@ std::vector<std::string> getCompatiblePlatforms(Option option, std::size_t outpu
 	return platforms;
 }
 
-template <typename Writer>
-void writeOutputFile(std::size_t output_size, std::uint64_t& pin, Writer&& writer) {
+// `writer` fills the new file and returns the size it meant to write, which is
+// checked against the file before anything is reported. `on_written` then gets
+// that size, ahead of the durability work and the PIN report.
+template <typename Writer, typename OnWritten>
+void writeOutputFile(std::uint64_t& pin, Writer&& writer, OnWritten&& on_written) {
 	// Wipe the PIN on every exit (success or throw after encryption).
 	ScopedWipe pin_wiper{pin};
 
 	OutputFileHandle output_file = createUniqueOutputFile();
 
 	try {
-		std::forward<Writer>(writer)(output_file.fd);
+		const std::size_t output_size = std::forward<Writer>(writer)(output_file.fd);
 		verifyFdSize(output_file.fd, output_size);
+		std::forward<OnWritten>(on_written)(output_size);
 		// Durability before the success report: the PIN is printed exactly once and
 		// exists nowhere else, so an image still sitting in the page cache when the
 		// machine loses power would be unrecoverable even though the user was told
@@ -490,49 +536,75 @@ void writeMastodonOutput(
 	validateSizeLimit(output_size, option, "Final output PNG");
 	printPlatformCompatibility(option, output_size, has_bad_dims, twitter_iccp_compatible);
 
-	writeOutputFile(output_size, pin, [&](int fd) {
+	writeOutputFile(pin, [&](int fd) {
 		writeAllToFd(fd, std::span<const Byte>(png_vec.data(), MASTODON_INSERT_INDEX));
 		writeChunkFromParts(fd, TYPE_ICCP, {
 			std::span<const Byte>(PDVRDT_ICCP_PREFIX),
 			std::span<const Byte>(compressed_profile.data(), compressed_profile.size())
 		});
 		writePngTailFrom(fd, png_vec, MASTODON_INSERT_INDEX);
-	});
+		return output_size;
+	}, [](std::size_t) {});
 }
 
+// The default layout streams: the cover's head and an IDAT header go out first,
+// the encrypted profile follows frame by frame as `encrypt` produces it, and the
+// chunk length and CRC are settled once the payload is complete. Memory stays at
+// about one frame whatever the payload size.
+//
+// `planned` sizes the output before anything is written. A stored payload's
+// plan is exact, so the size limit and platform report come first and the
+// written file must match it. A deflated payload's plan is only a bound: the
+// encryptor's budget enforces the limit as it streams, and the report waits
+// for the real size.
+template <typename Encrypt>
 void writeDefaultOutput(
 	const vBytes& png_vec,
-	const vBytes& profile_vec,
 	Option option,
 	bool has_bad_dims,
-	std::uint64_t& pin) {
+	const PlannedProfileSize& planned,
+	std::uint64_t& pin,
+	Encrypt&& encrypt) {
 
-	constexpr std::size_t
-		DEFAULT_INSERT_DIFF = 12,
-		IDAT_SIZE_DIFF = DEFAULT_IDAT_PREFIX_BYTES;
+	constexpr std::size_t DEFAULT_INSERT_DIFF = 12;
 	constexpr auto TYPE_IDAT = std::to_array<Byte>({ 0x49, 0x44, 0x41, 0x54 });
+	constexpr std::string_view OVERFLOW_ERROR = "File Size Error: Final output size overflow.";
 
 	if (png_vec.size() < DEFAULT_INSERT_DIFF) {
 		throw std::runtime_error("Image File Error: Invalid PNG insertion point for IDAT chunk.");
 	}
 
 	const std::size_t insert_index = png_vec.size() - DEFAULT_INSERT_DIFF;
-	const std::size_t output_size = checkedAddSize(
+	const std::size_t planned_output_size = checkedAddSize(
 		png_vec.size(),
-		checkedChunkTotalSize(profile_vec.size(), IDAT_SIZE_DIFF),
-		"File Size Error: Final output size overflow."
-	);
-
-	validateSizeLimit(output_size, option, "Final output PNG");
-	printPlatformCompatibility(option, output_size, has_bad_dims, false);
+		checkedAddSize(planned.size, PNG_CHUNK_OVERHEAD + DEFAULT_IDAT_PREFIX_BYTES, OVERFLOW_ERROR),
+		OVERFLOW_ERROR);
+
+	auto reportSize = [&](std::size_t output_size) {
+		validateSizeLimit(output_size, option, "Final output PNG");
+		printPlatformCompatibility(option, output_size, has_bad_dims, false);
+	};
+	if (planned.is_exact) {
+		reportSize(planned_output_size);
+	}
 
-	writeOutputFile(output_size, pin, [&](int fd) {
+	writeOutputFile(pin, [&](int fd) {
 		writeAllToFd(fd, std::span<const Byte>(png_vec.data(), insert_index));
-		writeChunkFromParts(fd, TYPE_IDAT, {
-			std::span<const Byte>(PDVRDT_IDAT_PREFIX),
-			std::span<const Byte>(profile_vec.data(), profile_vec.size())
-		});
+		StreamingChunkWriter idat(fd, insert_index, TYPE_IDAT);
+		idat.write(PDVRDT_IDAT_PREFIX);
+		std::forward<Encrypt>(encrypt)([&](std::span<const Byte> bytes, std::uint32_t crc) { idat.write(bytes, crc); });
+		const std::size_t chunk_size = idat.finish();
 		writePngTailFrom(fd, png_vec, insert_index);
+
+		const std::size_t output_size = checkedAddSize(png_vec.size(), chunk_size, OVERFLOW_ERROR);
+		if (planned.is_exact ? output_size != planned_output_size : output_size > planned_output_size) {
+			throw std::runtime_error("Internal Error: Output size does not match its plan.");
+		}
+		return output_size;
+	}, [&](std::size_t output_size) {
+		if (!planned.is_exact) {
+			reportSize(output_size);
+		}
 	});
 }
 } // namespace
@@ -556,7 +628,7 @@ void concealData(vBytes& png_vec, Option option, const fs::path& data_file_path)
 		prepareImageForMastodonEmbedding(png_vec);
 	}
 
-	const bool is_compressed = isLikelyCompressedInputFile(data_file_path);
+	const bool is_compressed = probeIncompressibleFd(data_file.fd(), data_file_size);
 
 	// Fail before spending Argon2 + encryption on a payload that provably cannot
 	// fit. Sound only for already-compressed inputs: those are *stored*, not
@@ -576,20 +648,34 @@ void concealData(vBytes& png_vec, Option option, const fs::path& data_file_path)
 	// Owns the PIN from generation until the write finishes or any post-encrypt
 	// path throws; encryptCompressedFileToProfile() fills it in place.
 	SensitiveU64 pin;
-	encryptCompressedFileToProfile(
-		pin,
-		profile_vec,
-		data_file.fd(),
-		data_file.size(),
-		data_filename,
-		is_compressed,
-		is_mastodon,
-		max_profile_size
-	);
 
 	if (is_mastodon) {
+		encryptCompressedFileToProfile(
+			pin,
+			profile_vec,
+			data_file.fd(),
+			data_file.size(),
+			data_filename,
+			is_compressed,
+			is_mastodon,
+			max_profile_size
+		);
 		writeMastodonOutput(png_vec, profile_vec, option, has_bad_dims, pin.value);
 	} else {
-		writeDefaultOutput(png_vec, profile_vec, option, has_bad_dims, pin.value);
+		const PlannedProfileSize planned = planEncryptedProfileSize(
+			profile_vec.size(), data_file_size, data_filename, is_compressed, is_mastodon);
+		writeDefaultOutput(png_vec, option, has_bad_dims, planned, pin.value, [&](const EncryptedOutputHandler& on_output) {
+			encryptCompressedFileToStream(
+				pin,
+				profile_vec,
+				data_file.fd(),
+				data_file.size(),
+				data_filename,
+				is_compressed,
+				is_mastodon,
+				max_profile_size,
+				on_output
+			);
+		});
 	}
 }
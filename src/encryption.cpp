@@ -2,6 +2,7 @@
 #include "compression.h"
 #include "io_utils.h"
 #include "png_utils.h"
+#include "thread_pool.h"
 
 #include <poll.h>
 #include <signal.h>
@@ -12,16 +13,21 @@
 #include <algorithm>
 #include <cerrno>
 #include <charconv>
+#include <cstdlib>
 #include <cstdio>
 #include <cstring>
+#include <exception>
 #include <format>
+#include <future>
 #include <limits>
+#include <memory>
 #include <print>
 #include <ranges>
 #include <span>
 #include <stdexcept>
 #include <string_view>
 #include <system_error>
+#include <vector>
 
 namespace {
 struct TermiosGuard {
@@ -216,211 +222,353 @@ struct TermiosGuard {
 	}
 };
 
+// Largest plaintext a KDF2 secretstream frame carries.
 constexpr std::size_t STREAM_CHUNK_SIZE = 1 * 1024 * 1024;
 
 using StreamHeader = std::array<Byte, crypto_secretstream_xchacha20poly1305_HEADERBYTES>;
+using FrameNonce = std::array<Byte, crypto_aead_xchacha20poly1305_ietf_NPUBBYTES>;
+using FrameTag = std::array<Byte, AEAD_TAG_BYTES>;
+
+static_assert(sizeof(FrameTag) == AEAD_TAG_BYTES, "The tag table is emitted as one contiguous span.");
+static_assert(Key{}.size() == crypto_aead_aes256gcm_KEYBYTES &&
+	Key{}.size() == crypto_aead_xchacha20poly1305_ietf_KEYBYTES,
+	"One derived key serves either payload cipher.");
+
+static_assert(StreamHeader{}.size() == FrameNonce{}.size(),
+	"KDF_NONCE_OFFSET holds either a secretstream header or a base frame nonce.");
 
 struct KdfSecrets {
 	Salt salt{};
-	StreamHeader stream_header{};
+	// KDF2: the secretstream header. KDF3: the base nonce of the frame sequence.
+	StreamHeader nonce{};
+	Byte cipher{};  // KDF3 only
 };
 
-static_assert(STREAM_FRAME_LEN_BYTES == sizeof(std::uint32_t),
-	"The frame length is written by updateValue(), which encodes exactly 32 bits.");
+// Output side of the encryptor: every byte of the profile passes through here on
+// its way to the caller's handler, so this is the one place the size budget is
+// enforced.
+class BudgetedOutput {
+public:
+	BudgetedOutput(const EncryptedOutputHandler& on_output, std::size_t max_size)
+		: on_output_(on_output), max_size_(max_size) {}
 
-[[nodiscard]] std::array<Byte, STREAM_FRAME_LEN_BYTES> encodeFrameLen(std::uint32_t frame_len) {
-	std::array<Byte, STREAM_FRAME_LEN_BYTES> bytes{};
-	updateValue(bytes, 0, frame_len);
-	return bytes;
-}
-
-void appendEncryptedFrame(
-	vBytes& encrypted,
-	std::span<const Byte> cipher_frame,
-	std::size_t max_encrypted_size) {
-	if (cipher_frame.size() > static_cast<std::size_t>(std::numeric_limits<std::uint32_t>::max())) {
-		throw std::runtime_error("crypto_secretstream frame too large.");
+	void emit(std::span<const Byte> bytes) {
+		emit(bytes, pdvrdtCrc32Update(0, bytes));
 	}
 
-	const auto frame_len = encodeFrameLen(static_cast<std::uint32_t>(cipher_frame.size()));
-	const std::size_t base = encrypted.size();
-	const std::size_t final_size = checkedAddSize(
-		checkedAddSize(base, frame_len.size(), "File Size Error: Encrypted output overflow."),
-		cipher_frame.size(),
-		"File Size Error: Encrypted output overflow."
-	);
-	if (final_size > max_encrypted_size) {
-		throw std::runtime_error(
-			"File Size Error: Compressed and encrypted payload exceeds the selected output size limit.");
+	// For bytes whose CRC-32 the caller already has.
+	void emit(std::span<const Byte> bytes, std::uint32_t crc) {
+		claim(bytes.size());
+		on_output_(bytes, crc);
 	}
 
-	encrypted.resize(final_size);
-	Byte* out = encrypted.data() + static_cast<std::ptrdiff_t>(base);
-	std::memcpy(out, frame_len.data(), frame_len.size());
-	std::memcpy(out + frame_len.size(), cipher_frame.data(), cipher_frame.size());
-}
+	// Counts bytes the caller places in the output itself.
+	void claim(std::size_t size) {
+		if (size > max_size_ - emitted_) {
+			throw std::runtime_error(
+				"File Size Error: Compressed and encrypted payload exceeds the selected output size limit.");
+		}
+		emitted_ += size;
+	}
 
-void initializeSecretStreamPush(
-	crypto_secretstream_xchacha20poly1305_state& state,
-	StreamHeader& stream_header,
-	const Key& key) {
+private:
+	const EncryptedOutputHandler& on_output_;
+	std::size_t max_size_;
+	std::size_t emitted_{};
+};
 
-	if (crypto_secretstream_xchacha20poly1305_init_push(&state, stream_header.data(), key.data()) != 0) {
-		throw std::runtime_error("crypto_secretstream init_push failed.");
+// KDF3 frames are independent AEAD messages. What ties them into one payload is
+// what each is bound to: the nonce is the base nonce with the frame index folded
+// into its first eight bytes, and the additional data repeats that index and
+// says whether this is the last frame. A reordered frame fails its tag under the
+// wrong index; a truncated payload ends on a frame that was not sealed as final.
+constexpr std::size_t FRAME_INDEX_BYTES = sizeof(std::uint64_t);
+using FrameAd = std::array<Byte, FRAME_INDEX_BYTES + 1>;
+
+[[nodiscard]] FrameNonce frameNonce(const FrameNonce& base, std::uint64_t index) {
+	FrameNonce nonce = base;
+	for (std::size_t i = 0; i < FRAME_INDEX_BYTES; ++i) {
+		nonce[i] ^= static_cast<Byte>(index >> (8 * i));
 	}
+	return nonce;
 }
 
-void appendEncryptedFrames(
-	vBytes& encrypted,
-	std::span<const Byte> plaintext,
-	crypto_secretstream_xchacha20poly1305_state& state,
-	vBytes& cipher_chunk,
-	std::size_t max_encrypted_size,
-	unsigned char final_tag = 0) {
+[[nodiscard]] FrameAd frameAd(std::uint64_t index, bool is_final) {
+	FrameAd ad{};
+	for (std::size_t i = 0; i < FRAME_INDEX_BYTES; ++i) {
+		ad[i] = static_cast<Byte>(index >> (8 * i));
+	}
+	ad[FRAME_INDEX_BYTES] = is_final ? 1 : 0;
+	return ad;
+}
 
-	if (plaintext.empty() && final_tag == 0) {
+// libsodium only provides AES-256-GCM on CPUs with AES-NI and PCLMUL, so an
+// image sealed with it cannot be opened everywhere. Checked before the PIN
+// prompt so nobody types a PIN for a payload this machine cannot decrypt.
+void requirePayloadCipherSupport(Byte cipher) {
+	if (cipher == PAYLOAD_CIPHER_XCHACHA20POLY1305) {
 		return;
 	}
+	if (cipher != PAYLOAD_CIPHER_AES256GCM) {
+		throw std::runtime_error("Internal Error: Unknown payload cipher.");
+	}
+	if (crypto_aead_aes256gcm_is_available() == 0) {
+		throw std::runtime_error(
+			"File Decryption Error: This file is encrypted with AES-256-GCM, "
+			"which this CPU does not support.");
+	}
+}
 
-	std::size_t offset = 0;
-	bool emit_empty_final = plaintext.empty() && final_tag != 0;
+// The AEAD behind a KDF3 payload, keyed once. AES-256-GCM expands its key
+// schedule up front with beforenm() so the per-frame calls only run the cipher;
+// it takes the first 12 bytes of the frame nonce, which is where the index
+// lives. seal() and open() only read the object, so any number of frames can
+// go through it at once.
+class FrameCipher {
+public:
+	FrameCipher(Byte cipher, const Key& key, const FrameNonce& base_nonce)
+		: cipher_(cipher), key_(key), base_nonce_(base_nonce) {
+		requirePayloadCipherSupport(cipher_);
+		if (cipher_ == PAYLOAD_CIPHER_AES256GCM) {
+			crypto_aead_aes256gcm_beforenm(&aes_state_, key_.data());
+		}
+	}
 
-	while (emit_empty_final || offset < plaintext.size()) {
-		const std::size_t remaining = plaintext.size() - offset;
-		const std::size_t chunk_len = std::min(remaining, STREAM_CHUNK_SIZE);
-		const bool is_final = emit_empty_final || (offset + chunk_len == plaintext.size());
-		const unsigned char tag = is_final ? final_tag : 0;
+	FrameCipher(const FrameCipher&) = delete;
+	FrameCipher& operator=(const FrameCipher&) = delete;
 
-		unsigned long long clen_ull = 0;
-		if (crypto_secretstream_xchacha20poly1305_push(
-				&state,
-				cipher_chunk.data(),
-				&clen_ull,
-				(chunk_len == 0) ? nullptr : (plaintext.data() + static_cast<std::ptrdiff_t>(offset)),
-				chunk_len,
-				nullptr,
-				0,
-				tag) != 0) {
-			throw std::runtime_error("crypto_secretstream push failed.");
-		}
+	~FrameCipher() {
+		sodium_memzero(&aes_state_, sizeof(aes_state_));
+	}
 
-		if (clen_ull > static_cast<unsigned long long>(std::numeric_limits<std::uint32_t>::max())) {
-			throw std::runtime_error("crypto_secretstream frame too large.");
+	// Seals `frame` in place and writes its detached tag.
+	void seal(std::span<Byte> frame, FrameTag& tag, std::uint64_t index, bool is_final) const {
+		const FrameNonce nonce = frameNonce(base_nonce_, index);
+		const FrameAd ad = frameAd(index, is_final);
+		const int rc = (cipher_ == PAYLOAD_CIPHER_AES256GCM)
+			? crypto_aead_aes256gcm_encrypt_detached_afternm(
+				frame.data(), tag.data(), nullptr,
+				frame.data(), frame.size(),
+				ad.data(), ad.size(),
+				nullptr, nonce.data(), &aes_state_)
+			: crypto_aead_xchacha20poly1305_ietf_encrypt_detached(
+				frame.data(), tag.data(), nullptr,
+				frame.data(), frame.size(),
+				ad.data(), ad.size(),
+				nullptr, nonce.data(), key_.data());
+		if (rc != 0) {
+			throw std::runtime_error("Payload frame encryption failed.");
 		}
-		appendEncryptedFrame(
-			encrypted,
-			std::span<const Byte>(cipher_chunk.data(), static_cast<std::size_t>(clen_ull)),
-			max_encrypted_size
-		);
+	}
 
-		offset += chunk_len;
-		emit_empty_final = false;
+	[[nodiscard]] bool open(std::span<Byte> frame, const Byte* tag, std::uint64_t index, bool is_final) const {
+		const FrameNonce nonce = frameNonce(base_nonce_, index);
+		const FrameAd ad = frameAd(index, is_final);
+		const int rc = (cipher_ == PAYLOAD_CIPHER_AES256GCM)
+			? crypto_aead_aes256gcm_decrypt_detached_afternm(
+				frame.data(), nullptr,
+				frame.data(), frame.size(),
+				tag,
+				ad.data(), ad.size(),
+				nonce.data(), &aes_state_)
+			: crypto_aead_xchacha20poly1305_ietf_decrypt_detached(
+				frame.data(), nullptr,
+				frame.data(), frame.size(),
+				tag,
+				ad.data(), ad.size(),
+				nonce.data(), key_.data());
+		return rc == 0;
 	}
-}
 
-[[nodiscard]] std::uint32_t readFrameLen(std::span<const Byte> data, std::size_t index) {
-	return getValue(data, index);
-}
+private:
+	Byte cipher_;
+	const Key& key_;
+	const FrameNonce base_nonce_;
+	crypto_aead_aes256gcm_state aes_state_{};
+};
 
-// Decrypt in place: cipher at storage[cipher_start..cipher_start+cipher_len),
-// plaintext written to storage[0..]. Plaintext write trails unread cipher by at least
-// (cipher_start + header.size() + 21*N) bytes after frame N — always safe.
-// On success, storage is resized to plaintext size. On failure, any partial plaintext is wiped.
-[[nodiscard]] bool decryptWithSecretStreamInPlace(
-	vBytes& storage,
-	std::size_t cipher_start,
-	std::size_t cipher_len,
-	const Key& key,
-	const StreamHeader& header) {
-
-	if (cipher_len < header.size()) {
-		return false;
-	}
-	if (!spanHasRange(storage, cipher_start, cipher_len)) {
-		return false;
-	}
-	if (!std::ranges::equal(
-			std::span<const Byte>(storage.data() + cipher_start, header.size()),
-			header)) {
-		return false;
+// AES-256-GCM when the CPU has it, otherwise XChaCha20-Poly1305. Setting
+// PDVRDT_PAYLOAD_CIPHER to "xchacha20poly1305" keeps an image openable on CPUs
+// without AES-NI; "aes256gcm" insists on AES. The golden tests use it to pin
+// down both formats on one machine.
+[[nodiscard]] Byte preferredPayloadCipher() {
+	if (const char* forced = std::getenv("PDVRDT_PAYLOAD_CIPHER"); forced != nullptr && *forced != '\0') {
+		const std::string_view name(forced);
+		Byte cipher = 0;
+		if (name == "xchacha20poly1305") {
+			cipher = PAYLOAD_CIPHER_XCHACHA20POLY1305;
+		} else if (name == "aes256gcm") {
+			cipher = PAYLOAD_CIPHER_AES256GCM;
+		} else {
+			throw std::runtime_error(std::format(
+				"Invalid Input Error: Unknown PDVRDT_PAYLOAD_CIPHER \"{}\" (expected xchacha20poly1305 or aes256gcm).", name));
+		}
+		if (cipher == PAYLOAD_CIPHER_AES256GCM && crypto_aead_aes256gcm_is_available() == 0) {
+			throw std::runtime_error("Invalid Input Error: PDVRDT_PAYLOAD_CIPHER asks for AES-256-GCM, which this CPU does not support.");
+		}
+		return cipher;
 	}
+	return crypto_aead_aes256gcm_is_available() != 0
+		? PAYLOAD_CIPHER_AES256GCM
+		: PAYLOAD_CIPHER_XCHACHA20POLY1305;
+}
 
-	crypto_secretstream_xchacha20poly1305_state stream_state{};
-	ScopedWipe stream_state_wipe{stream_state};
-	if (crypto_secretstream_xchacha20poly1305_init_pull(&stream_state, header.data(), key.data()) != 0) {
-		return false;
+// Size of a KDF3 profile: the template, the plaintext (filename prefix plus
+// compressed stream), one tag per frame and the sealed metadata record. Exact
+// for an exact stream size.
+[[nodiscard]] std::size_t plannedProfileSize(std::size_t template_size, std::size_t prefix_size, std::size_t compressed_size) {
+	constexpr std::string_view OVERFLOW_ERROR = "File Size Error: Encrypted output overflow.";
+	const std::size_t plain_size = checkedAddSize(prefix_size, compressed_size, OVERFLOW_ERROR);
+	const std::size_t frames = plain_size / AEAD_FRAME_SIZE + (plain_size % AEAD_FRAME_SIZE != 0 ? 1 : 0);
+	const std::size_t sealed_size = checkedAddSize(
+		checkedMulSize(frames, AEAD_TAG_BYTES, OVERFLOW_ERROR),
+		SEALED_PAYLOAD_METADATA_BYTES,
+		OVERFLOW_ERROR);
+	return checkedAddSize(
+		checkedAddSize(template_size, plain_size, OVERFLOW_ERROR),
+		sealed_size,
+		OVERFLOW_ERROR);
+}
+
+// Cuts the plaintext into AEAD_FRAME_SIZE frames and seals them on the shared
+// pool while the caller keeps feeding it. Frames are filled in a ring of
+// buffers one deeper than the pool, so every worker has a frame to seal while
+// the next is being filled; the oldest is emitted in order when its buffer is
+// needed again. The last full frame is held back until more input or finish()
+// arrives, because only then is it known whether it is the final one.
+//
+// Given `inline_output`, frames are instead laid down straight at its tail and
+// sealed where they stand, so a collected profile never passes through the ring.
+// Its capacity must already cover the planned profile: nothing may reallocate it
+// while workers hold pointers into it.
+//
+// Must be driven from a thread outside the pool: it waits on sealing tasks.
+class ParallelFrameSealer {
+public:
+	ParallelFrameSealer(BudgetedOutput& output, const FrameCipher& cipher, vBytes* inline_output = nullptr)
+		: output_(output), cipher_(cipher), inline_output_(inline_output),
+		  inline_begin_(inline_output ? inline_output->size() : 0),
+		  slots_(sharedThreadPool().size() + 2) {
+		if (inline_output_ == nullptr) {
+			for (auto& slot : slots_) {
+				slot.buffer = std::make_unique_for_overwrite<Byte[]>(AEAD_FRAME_SIZE);
+			}
+		}
 	}
 
-	vBytes plain_chunk(STREAM_CHUNK_SIZE);
-	ScopedWipe plain_chunk_wipe{plain_chunk};
+	ParallelFrameSealer(const ParallelFrameSealer&) = delete;
+	ParallelFrameSealer& operator=(const ParallelFrameSealer&) = delete;
 
-	std::size_t cipher_pos = cipher_start + header.size();
-	const std::size_t cipher_end = cipher_start + cipher_len;
-	std::size_t plain_pos = 0;
-	bool has_final_tag = false;
+	~ParallelFrameSealer() {
+		// Workers still reference the buffers and the cipher.
+		for (auto& slot : slots_) {
+			if (slot.sealed.valid()) slot.sealed.wait();
+			if (slot.buffer) sodium_memzero(slot.buffer.get(), AEAD_FRAME_SIZE);
+		}
+	}
 
-	auto fail = [&]() -> bool {
-		sodium_memzero(storage.data(), plain_pos);
-		return false;
-	};
+	void append(std::span<const Byte> plaintext) {
+		while (!plaintext.empty()) {
+			if (fill_size_ == AEAD_FRAME_SIZE) {
+				submitFillSlot(false);
+			}
+			Slot& slot = fillSlot();
+			const std::size_t take = std::min(plaintext.size(), AEAD_FRAME_SIZE - fill_size_);
+			if (inline_output_ != nullptr) {
+				output_.claim(take);
+				if (inline_output_->capacity() - inline_output_->size() < take) {
+					throw std::runtime_error("Internal Error: Encrypted profile storage was not reserved.");
+				}
+				inline_output_->insert(inline_output_->end(), plaintext.begin(), plaintext.begin() + static_cast<std::ptrdiff_t>(take));
+			} else {
+				std::memcpy(slot.buffer.get() + fill_size_, plaintext.data(), take);
+			}
+			fill_size_ += take;
+			plaintext = plaintext.subspan(take);
+		}
+	}
 
-	while (cipher_pos < cipher_end) {
-		if (cipher_end - cipher_pos < STREAM_FRAME_LEN_BYTES) {
-			return fail();
+	// Seals the held frame as final, emits every outstanding frame and then the
+	// tag table.
+	void finish() {
+		if (fill_size_ == 0) {
+			throw std::runtime_error("Internal Error: Encrypted payload has no frames.");
 		}
+		submitFillSlot(true);
+		while (emitted_frames_ < next_frame_) {
+			emitOldest();
+		}
+		output_.emit(std::span<const Byte>(
+			reinterpret_cast<const Byte*>(tags_.data()), tags_.size() * AEAD_TAG_BYTES));
+	}
 
-		const std::uint32_t frame_len = readFrameLen(storage, cipher_pos);
-		cipher_pos += STREAM_FRAME_LEN_BYTES;
+private:
+	struct Slot {
+		std::unique_ptr<Byte[]> buffer;
+		std::size_t size{};
+		FrameTag tag{};
+		std::uint32_t crc{};
+		std::future<void> sealed;
+	};
 
-		if (frame_len < crypto_secretstream_xchacha20poly1305_ABYTES ||
-			frame_len > cipher_end - cipher_pos) {
-			return fail();
-		}
+	[[nodiscard]] Slot& slotFor(std::uint64_t frame) {
+		return slots_[static_cast<std::size_t>(frame % slots_.size())];
+	}
 
-		const std::size_t max_plain_chunk = static_cast<std::size_t>(frame_len) - crypto_secretstream_xchacha20poly1305_ABYTES;
-		if (max_plain_chunk > plain_chunk.size()) {
-			return fail();
+	// The buffer for frame next_frame_, drained of its previous frame first.
+	[[nodiscard]] Slot& fillSlot() {
+		Slot& slot = slotFor(next_frame_);
+		if (slot.sealed.valid()) {
+			emitOldest();
 		}
+		return slot;
+	}
 
-		unsigned long long mlen = 0;
-		unsigned char tag = 0;
-		if (crypto_secretstream_xchacha20poly1305_pull(
-				&stream_state,
-				plain_chunk.data(),
-				&mlen,
-				&tag,
-				storage.data() + cipher_pos,
-				frame_len,
-				nullptr,
-				0) != 0) {
-			return fail();
-		}
-		if (mlen > max_plain_chunk) {
-			return fail();
-		}
-		if (mlen > 0) {
-			std::memcpy(storage.data() + plain_pos, plain_chunk.data(), mlen);
-			plain_pos += mlen;
-		}
-
-		cipher_pos += frame_len;
-		if (tag == crypto_secretstream_xchacha20poly1305_TAG_FINAL) {
-			has_final_tag = true;
-			break;
+	[[nodiscard]] Byte* frameData(const Slot& slot, std::uint64_t index) const {
+		if (inline_output_ != nullptr) {
+			return inline_output_->data() + inline_begin_ + static_cast<std::size_t>(index) * AEAD_FRAME_SIZE;
 		}
+		return slot.buffer.get();
 	}
 
-	if (!has_final_tag || cipher_pos != cipher_end) {
-		return fail();
+	void submitFillSlot(bool is_final) {
+		Slot& slot = fillSlot();
+		slot.size = fill_size_;
+		const std::uint64_t index = next_frame_;
+		const std::span<Byte> frame(frameData(slot, index), slot.size);
+		slot.sealed = sharedThreadPool().submit([&slot, this, frame, index, is_final] {
+			cipher_.seal(frame, slot.tag, index, is_final);
+			// A streamed frame is about to be wrapped in a PNG chunk: take its CRC
+			// now, while the ciphertext is still in this worker's cache.
+			if (inline_output_ == nullptr) {
+				slot.crc = pdvrdtCrc32Update(0, frame);
+			}
+		});
+		++next_frame_;
+		fill_size_ = 0;
 	}
 
-	// Wipe trailing ciphertext bytes before truncating.
-	if (plain_pos < storage.size()) {
-		sodium_memzero(storage.data() + plain_pos, storage.size() - plain_pos);
+	void emitOldest() {
+		Slot& slot = slotFor(emitted_frames_);
+		std::future<void> sealed = std::move(slot.sealed);
+		sealed.get();
+		tags_.push_back(slot.tag);
+		if (inline_output_ == nullptr) {
+			output_.emit(std::span<const Byte>(slot.buffer.get(), slot.size), slot.crc);
+		}
+		++emitted_frames_;
 	}
-	storage.resize(plain_pos);
-	return true;
-}
+
+	BudgetedOutput& output_;
+	const FrameCipher& cipher_;
+	vBytes* inline_output_;
+	std::size_t inline_begin_;
+	std::vector<Slot> slots_;
+	std::vector<FrameTag> tags_;
+	std::uint64_t next_frame_{};
+	std::uint64_t emitted_frames_{};
+	std::size_t fill_size_{};
+};
 
 void deriveKeyFromPin(Key& out_key, std::uint64_t pin, const Salt& salt) {
 	std::array<char, 32> pin_buf{};
@@ -492,21 +640,23 @@ void writeKdfMetadata(
 	vBytes& profile_vec,
 	const ProfileOffsets& offsets,
 	const Salt& salt,
-	const StreamHeader& stream_header,
+	Byte cipher,
+	const FrameNonce& base_nonce,
 	std::string_view corrupt_profile_error) {
 
 	// The whole region is randomised first, so the bytes around the fields below
 	// stay indistinguishable padding.
 	Byte* const region = profile_vec.data() + offsets.kdf_metadata;
 	randombytes_buf(region, KDF_METADATA_REGION_BYTES);
-	std::memcpy(region + KDF_MAGIC_OFFSET, KDF_METADATA_MAGIC_V2.data(), KDF_METADATA_MAGIC_V2.size());
+	std::memcpy(region + KDF_MAGIC_OFFSET, KDF_METADATA_MAGIC_V3.data(), KDF_METADATA_MAGIC_V3.size());
 	region[KDF_ALG_OFFSET] = KDF_ALG_ARGON2ID13;
 	region[KDF_SENTINEL_OFFSET] = KDF_SENTINEL;
+	region[KDF_CIPHER_OFFSET] = cipher;
 
 	requireSpanRange(profile_vec, offsets.kdf_metadata + KDF_SALT_OFFSET, salt.size(), corrupt_profile_error);
-	requireSpanRange(profile_vec, offsets.kdf_metadata + KDF_NONCE_OFFSET, stream_header.size(), corrupt_profile_error);
+	requireSpanRange(profile_vec, offsets.kdf_metadata + KDF_NONCE_OFFSET, base_nonce.size(), corrupt_profile_error);
 	std::memcpy(region + KDF_SALT_OFFSET, salt.data(), salt.size());
-	std::memcpy(region + KDF_NONCE_OFFSET, stream_header.data(), stream_header.size());
+	std::memcpy(region + KDF_NONCE_OFFSET, base_nonce.data(), base_nonce.size());
 }
 
 [[nodiscard]] KdfSecrets readKdfSecrets(
@@ -516,49 +666,533 @@ void writeKdfMetadata(
 
 	KdfSecrets secrets;
 	requireSpanRange(data, offsets.kdf_metadata + KDF_SALT_OFFSET, secrets.salt.size(), corrupt_file_error);
-	requireSpanRange(data, offsets.kdf_metadata + KDF_NONCE_OFFSET, secrets.stream_header.size(), corrupt_file_error);
+	requireSpanRange(data, offsets.kdf_metadata + KDF_NONCE_OFFSET, secrets.nonce.size(), corrupt_file_error);
 
 	const Byte* const region = data.data() + offsets.kdf_metadata;
 	std::memcpy(secrets.salt.data(), region + KDF_SALT_OFFSET, secrets.salt.size());
-	std::memcpy(secrets.stream_header.data(), region + KDF_NONCE_OFFSET, secrets.stream_header.size());
+	std::memcpy(secrets.nonce.data(), region + KDF_NONCE_OFFSET, secrets.nonce.size());
+	secrets.cipher = region[KDF_CIPHER_OFFSET];
 	return secrets;
 }
 
-[[nodiscard]] std::string extractFilenamePrefix(vBytes& payload) {
-	constexpr const char* CORRUPT_FILE_ERROR = "File Recovery Error: Embedded profile is corrupt.";
-	if (payload.empty()) {
+using PayloadMetadataRecord = std::array<Byte, PAYLOAD_METADATA_BYTES>;
+
+[[nodiscard]] PayloadMetadataRecord encodePayloadMetadata(const PayloadMetadata& metadata) {
+	PayloadMetadataRecord record{};
+	record[0] = PAYLOAD_METADATA_VERSION;
+	record[1] = metadata.codec;
+	record[2] = metadata.flags;
+	storeLe(record.data() + 4, metadata.frame_size, 4);
+	storeLe(record.data() + 8, metadata.original_size, 8);
+	storeLe(record.data() + 16, metadata.compressed_size, 8);
+	storeLe(record.data() + 24, metadata.block_index_size, 8);
+	return record;
+}
+
+// Only called on an authenticated record, so anything unexpected is a payload
+// from a newer release rather than tampering.
+[[nodiscard]] PayloadMetadata decodePayloadMetadata(const PayloadMetadataRecord& record) {
+	if (record[0] != PAYLOAD_METADATA_VERSION) {
+		throw std::runtime_error(
+			"File Decryption Error: Unsupported payload metadata version. "
+			"Use a newer pdvrdt release to recover this file.");
+	}
+	PayloadMetadata metadata{
+		.original_size = loadLe(record.data() + 8, 8),
+		.compressed_size = loadLe(record.data() + 16, 8),
+		.block_index_size = loadLe(record.data() + 24, 8),
+		.frame_size = static_cast<std::uint32_t>(loadLe(record.data() + 4, 4)),
+		.codec = record[1],
+		.flags = record[2]
+	};
+	if (metadata.codec != PAYLOAD_CODEC_ZLIB || (metadata.flags & ~PAYLOAD_FLAG_SEGMENT_INDEX) != 0 || record[3] != 0) {
+		throw std::runtime_error(
+			"File Decryption Error: Unsupported payload encoding. "
+			"Use a newer pdvrdt release to recover this file.");
+	}
+	const bool has_segment_index = (metadata.flags & PAYLOAD_FLAG_SEGMENT_INDEX) != 0;
+	if (metadata.frame_size < MIN_AEAD_FRAME_SIZE || metadata.frame_size > MAX_AEAD_FRAME_SIZE ||
+		has_segment_index != (metadata.block_index_size != 0)) {
+		throw std::runtime_error("File Recovery Error: Embedded profile is corrupt.");
+	}
+	return metadata;
+}
+
+constexpr const char* CORRUPT_FILE_ERROR = "File Recovery Error: Embedded profile is corrupt.";
+
+// Thrown from inside a replay when a frame fails authentication. It unwinds the
+// caller's reader and turns back into decryptDataStream()'s false; deliberately
+// not a std::exception, so no handler on the way can mistake it for an I/O error.
+struct PayloadAuthenticationFailure {};
+
+// Splits decrypted plaintext into the embedded filename and the compressed
+// payload behind it, as it arrives.
+class PlaintextSink {
+public:
+	PlaintextSink(
+		const RecoveredHeaderHandler& on_header,
+		const DecryptedOutputHandler& on_payload,
+		const std::optional<PayloadMetadata>& metadata,
+		const vBytes& segment_index)
+		: on_header_(on_header), on_payload_(on_payload), metadata_(metadata), segment_index_(segment_index) {}
+
+	PlaintextSink(const PlaintextSink&) = delete;
+	PlaintextSink& operator=(const PlaintextSink&) = delete;
+
+	~PlaintextSink() {
+		sodium_memzero(prefix_.bytes.data(), prefix_.bytes.size());
+	}
+
+	void feed(std::span<const Byte> plaintext) {
+		if (!has_filename_ && !plaintext.empty()) {
+			if (prefix_.size == 0 && plaintext[0] == 0) {
+				throw std::runtime_error(CORRUPT_FILE_ERROR);
+			}
+			const std::size_t wanted = 1 + (prefix_.size == 0 ? plaintext[0] : prefix_.bytes[0]);
+			if (!collect(plaintext, prefix_.bytes.data(), prefix_.size, wanted)) {
+				return;
+			}
+			std::string filename(reinterpret_cast<const char*>(prefix_.bytes.data() + 1), prefix_.size - 1);
+			ScopedWipe filename_wipe{filename};
+			has_filename_ = true;
+			on_header_(filename, metadata_, segment_index_);
+		}
+		if (!plaintext.empty()) {
+			payload_size_ += plaintext.size();
+			on_payload_(plaintext);
+		}
+	}
+
+	void finish() const {
+		if (!has_filename_) {
+			throw std::runtime_error(CORRUPT_FILE_ERROR);
+		}
+		// The record is authenticated, so a mismatch is a malformed payload
+		// rather than a wrong PIN.
+		if (metadata_ && payload_size_ != metadata_->compressed_size + metadata_->block_index_size) {
+			throw std::runtime_error(CORRUPT_FILE_ERROR);
+		}
+	}
+
+private:
+	const RecoveredHeaderHandler& on_header_;
+	const DecryptedOutputHandler& on_payload_;
+	const std::optional<PayloadMetadata>& metadata_;
+	const vBytes& segment_index_;
+	FilenamePrefix prefix_;
+	std::size_t payload_size_{};
+	bool has_filename_{false};
+};
+
+// KDF2 ciphertext as it streams in: the secretstream header, then frames of a
+// big-endian length and a secretstream message, ending on the TAG_FINAL frame.
+class SecretStreamReader {
+public:
+	SecretStreamReader(const Key& key, const StreamHeader& header, PlaintextSink& sink)
+		: key_(key), header_(header), sink_(sink),
+		  frame_(std::make_unique_for_overwrite<Byte[]>(MAX_FRAME_SIZE)),
+		  plain_(std::make_unique_for_overwrite<Byte[]>(STREAM_CHUNK_SIZE)) {}
+
+	SecretStreamReader(const SecretStreamReader&) = delete;
+	SecretStreamReader& operator=(const SecretStreamReader&) = delete;
+
+	~SecretStreamReader() {
+		sodium_memzero(&state_, sizeof(state_));
+		sodium_memzero(plain_.get(), STREAM_CHUNK_SIZE);
+	}
+
+	void feed(std::span<const Byte> ciphertext) {
+		while (!ciphertext.empty()) {
+			if (has_final_tag_) {
+				throw PayloadAuthenticationFailure{};
+			}
+			if (!has_header_) {
+				if (!collect(ciphertext, received_header_.data(), have_, received_header_.size())) return;
+				if (received_header_ != header_ ||
+					crypto_secretstream_xchacha20poly1305_init_pull(&state_, header_.data(), key_.data()) != 0) {
+					throw PayloadAuthenticationFailure{};
+				}
+				has_header_ = true;
+				have_ = 0;
+				continue;
+			}
+			if (frame_len_ == 0) {
+				if (!collect(ciphertext, len_bytes_.data(), have_, len_bytes_.size())) return;
+				frame_len_ = getValue(len_bytes_, 0);
+				have_ = 0;
+				if (frame_len_ < crypto_secretstream_xchacha20poly1305_ABYTES || frame_len_ > MAX_FRAME_SIZE) {
+					throw PayloadAuthenticationFailure{};
+				}
+				continue;
+			}
+			if (!collect(ciphertext, frame_.get(), have_, frame_len_)) return;
+			pullFrame();
+		}
+	}
+
+	void finish() const {
+		if (!has_final_tag_) {
+			throw PayloadAuthenticationFailure{};
+		}
+	}
+
+private:
+	static constexpr std::size_t MAX_FRAME_SIZE = STREAM_CHUNK_SIZE + crypto_secretstream_xchacha20poly1305_ABYTES;
+
+	void pullFrame() {
+		unsigned long long mlen = 0;
+		unsigned char tag = 0;
+		if (crypto_secretstream_xchacha20poly1305_pull(
+				&state_, plain_.get(), &mlen, &tag, frame_.get(), frame_len_, nullptr, 0) != 0 ||
+			mlen > STREAM_CHUNK_SIZE) {
+			throw PayloadAuthenticationFailure{};
+		}
+		frame_len_ = 0;
+		have_ = 0;
+		has_final_tag_ = tag == crypto_secretstream_xchacha20poly1305_TAG_FINAL;
+		sink_.feed(std::span<const Byte>(plain_.get(), static_cast<std::size_t>(mlen)));
+	}
+
+	const Key& key_;
+	const StreamHeader& header_;
+	PlaintextSink& sink_;
+	crypto_secretstream_xchacha20poly1305_state state_{};
+	StreamHeader received_header_{};
+	std::array<Byte, STREAM_FRAME_LEN_BYTES> len_bytes_{};
+	std::unique_ptr<Byte[]> frame_;
+	std::unique_ptr<Byte[]> plain_;
+	std::size_t have_{};
+	std::size_t frame_len_{};
+	bool has_header_{false};
+	bool has_final_tag_{false};
+};
+
+// How a KDF3 ciphertext of frames and tags divides up. The frame count
+// follows from the length alone: every frame but the last is full, and a last
+// frame of zero bytes is never written.
+struct AeadFrameGeometry {
+	std::size_t frame_size{};
+	std::size_t frame_count{};
+	std::size_t plain_len{};
+};
+
+[[nodiscard]] std::optional<AeadFrameGeometry> aeadFrameGeometry(std::size_t sealed_len, std::size_t frame_size) {
+	const std::size_t sealed_frame_size = frame_size + AEAD_TAG_BYTES;
+	const std::size_t frame_count =
+		sealed_len / sealed_frame_size + (sealed_len % sealed_frame_size != 0 ? 1 : 0);
+	if (frame_count == 0 || sealed_len - frame_count * AEAD_TAG_BYTES <= (frame_count - 1) * frame_size) {
+		return std::nullopt;
+	}
+	return AeadFrameGeometry{
+		.frame_size = frame_size,
+		.frame_count = frame_count,
+		.plain_len = sealed_len - frame_count * AEAD_TAG_BYTES
+	};
+}
+
+// KDF3 ciphertext as it streams in: full frames (the last one shorter) back
+// to back, then the tag table, which the caller already read from the profile's
+// tail.
+//
+// Frames are opened on the shared pool, up to one per worker plus two ahead of
+// the frame the sink is consuming, so authenticating frame N+1 overlaps
+// inflating frame N. Plaintext still reaches the sink strictly in order, and
+// only after its own frame authenticated.
+//
+// Must be driven from a thread outside the pool: it waits on opening tasks.
+class AeadFrameReader {
+public:
+	// `stream_len` is everything feed() will be given: the frames, the tag table
+	// and anything after it.
+	AeadFrameReader(const FrameCipher& cipher, const AeadFrameGeometry& geometry, std::size_t stream_len,
+		std::span<const Byte> tags, PlaintextSink& sink)
+		: cipher_(cipher), frame_size_(geometry.frame_size), frame_count_(geometry.frame_count),
+		  plain_len_(geometry.plain_len), stream_len_(stream_len), tags_(tags), sink_(sink),
+		  slots_(std::min<std::size_t>(sharedThreadPool().size() + 2, geometry.frame_count)) {
+		for (auto& slot : slots_) {
+			slot.buffer = std::make_unique_for_overwrite<Byte[]>(frame_size_);
+		}
+	}
+
+	AeadFrameReader(const AeadFrameReader&) = delete;
+	AeadFrameReader& operator=(const AeadFrameReader&) = delete;
+
+	~AeadFrameReader() {
+		// Workers still reference the buffers, the cipher and the reader.
+		for (auto& slot : slots_) {
+			if (slot.opened.valid()) slot.opened.wait();
+			sodium_memzero(slot.buffer.get(), frame_size_);
+		}
+	}
+
+	void feed(std::span<const Byte> ciphertext) {
+		if (ciphertext.size() > stream_len_ - received_) {
+			throw PayloadAuthenticationFailure{};
+		}
+		received_ += ciphertext.size();
+		while (!ciphertext.empty() && next_frame_ < frame_count_) {
+			Slot& slot = fillSlot();
+			if (!collect(ciphertext, slot.buffer.get(), have_, frameSize(next_frame_))) return;
+			have_ = 0;
+			submit(slot, nullptr, 0);
+		}
+		// Whatever is left is the tag table and any metadata record, already in hand.
+	}
+
+	// For a profile that sits in the file as is: each worker preads its frame
+	// straight into the buffer it opens it in, and the sink inflates from there,
+	// with no copy of the ciphertext on the way.
+	void readFrom(const ProfileReader& read_at, std::size_t ciphertext_offset) {
+		while (next_frame_ < frame_count_) {
+			submit(fillSlot(), &read_at, ciphertext_offset);
+		}
+		received_ = stream_len_;
+	}
+
+	// Hands every frame still in flight to the sink, then checks the totals.
+	void finish() {
+		while (consumed_frames_ < next_frame_) {
+			consumeOldest();
+		}
+		if (next_frame_ != frame_count_ || received_ != stream_len_) {
+			throw PayloadAuthenticationFailure{};
+		}
+	}
+
+private:
+	struct Slot {
+		std::unique_ptr<Byte[]> buffer;
+		std::future<bool> opened;
+	};
+
+	[[nodiscard]] std::size_t frameSize(std::size_t index) const noexcept {
+		return index + 1 == frame_count_
+			? plain_len_ - index * frame_size_
+			: frame_size_;
+	}
+
+	[[nodiscard]] Slot& slotFor(std::size_t frame) {
+		return slots_[frame % slots_.size()];
+	}
+
+	// The buffer for frame next_frame_, its previous frame consumed first.
+	[[nodiscard]] Slot& fillSlot() {
+		Slot& slot = slotFor(next_frame_);
+		if (slot.opened.valid()) {
+			consumeOldest();
+		}
+		return slot;
+	}
+
+	void submit(Slot& slot, const ProfileReader* read_at, std::size_t ciphertext_offset) {
+		const std::size_t index = next_frame_;
+		const std::span<Byte> frame(slot.buffer.get(), frameSize(index));
+		const Byte* const tag = tags_.data() + index * AEAD_TAG_BYTES;
+		const bool is_final = index + 1 == frame_count_;
+		slot.opened = sharedThreadPool().submit([this, read_at, ciphertext_offset, frame, tag, index, is_final] {
+			if (read_at != nullptr) {
+				(*read_at)(frame, ciphertext_offset + index * frame_size_);
+			}
+			return cipher_.open(frame, tag, index, is_final);
+		});
+		++next_frame_;
+	}
+
+	void consumeOldest() {
+		const std::size_t index = consumed_frames_;
+		Slot& slot = slotFor(index);
+		std::future<bool> opened = std::move(slot.opened);
+		if (!opened.get()) {
+			throw PayloadAuthenticationFailure{};
+		}
+		++consumed_frames_;
+		sink_.feed(std::span<const Byte>(slot.buffer.get(), frameSize(index)));
+	}
+
+	const FrameCipher& cipher_;
+	std::size_t frame_size_;
+	std::size_t frame_count_;
+	std::size_t plain_len_;
+	std::size_t stream_len_;
+	std::span<const Byte> tags_;
+	PlaintextSink& sink_;
+	std::vector<Slot> slots_;
+	std::size_t received_{};
+	std::size_t have_{};
+	std::size_t next_frame_{};
+	std::size_t consumed_frames_{};
+};
+
+// Opens just the frames holding plaintext [start, start + out.size()) and
+// copies that range into `out`: the few bytes recover needs ahead of the
+// in-order pass, or a slice of the payload it extracts without that pass.
+// Frames are read and opened on the shared pool, those wholly inside the range
+// in place in `out`; only a frame sticking out past either end goes through a
+// buffer of its own.
+//
+// Must be called from a thread outside the pool: it waits on opening tasks.
+void readPlaintextRange(
+	const FrameCipher& cipher,
+	const AeadFrameGeometry& geometry,
+	std::span<const Byte> tags,
+	const ProfileReader& read_at,
+	std::size_t ciphertext_offset,
+	std::size_t start,
+	std::span<Byte> out) {
+
+	if (out.empty()) {
+		return;
+	}
+	if (start > geometry.plain_len || out.size() > geometry.plain_len - start) {
 		throw std::runtime_error(CORRUPT_FILE_ERROR);
 	}
 
-	const std::size_t filename_len = payload[0];
-	if (filename_len == 0) {
+	const std::size_t end = start + out.size();
+	const std::size_t first = start / geometry.frame_size;
+	const std::size_t last = (end - 1) / geometry.frame_size;
+	std::array<vBytes, 2> edges{};
+	ScopedWipe first_edge_wipe{edges[0]};
+	ScopedWipe last_edge_wipe{edges[1]};
+
+	std::vector<std::future<bool>> opened;
+	opened.reserve(last - first + 1);
+	for (std::size_t index = first; index <= last; ++index) {
+		const std::size_t frame_start = index * geometry.frame_size;
+		const bool is_final = index + 1 == geometry.frame_count;
+		const std::size_t frame_size = is_final ? geometry.plain_len - frame_start : geometry.frame_size;
+		std::span<Byte> frame;
+		if (frame_start >= start && frame_size <= end - frame_start) {
+			frame = out.subspan(frame_start - start, frame_size);
+		} else {
+			vBytes& edge = edges[index == first ? 0 : 1];
+			edge.resize(frame_size);
+			frame = edge;
+		}
+		const Byte* const tag = tags.data() + index * AEAD_TAG_BYTES;
+		const std::size_t offset = ciphertext_offset + frame_start;
+		opened.push_back(sharedThreadPool().submit([&cipher, &read_at, frame, tag, offset, index, is_final] {
+			read_at(frame, offset);
+			return cipher.open(frame, tag, index, is_final);
+		}));
+	}
+
+	// Every task is waited for before anything is thrown: they write into `out`
+	// and the edge buffers.
+	bool authentic = true;
+	std::exception_ptr error{};
+	for (auto& frame : opened) {
+		try {
+			authentic = frame.get() && authentic;
+		} catch (...) {
+			if (!error) error = std::current_exception();
+		}
+	}
+	if (error) {
+		std::rethrow_exception(error);
+	}
+	if (!authentic) {
+		throw PayloadAuthenticationFailure{};
+	}
+
+	if (!edges[0].empty()) {
+		const std::size_t within = start - first * geometry.frame_size;
+		const std::size_t take = std::min(out.size(), edges[0].size() - within);
+		std::memcpy(out.data(), edges[0].data() + within, take);
+	}
+	if (!edges[1].empty()) {
+		const std::size_t frame_start = last * geometry.frame_size;
+		std::memcpy(out.data() + (frame_start - start), edges[1].data(), end - frame_start);
+	}
+}
+
+// What decryption knows about a profile before the PIN prompt.
+struct PayloadLayout {
+	const ProfileOffsets& offsets;
+	PayloadFormat format;
+	KdfSecrets secrets;
+	std::size_t ciphertext_length;
+};
+
+// Checks everything about the profile that can be checked without the key, so
+// a file this build cannot decrypt is refused before anyone types a PIN.
+[[nodiscard]] PayloadLayout inspectPayloadLayout(const EmbeddedProfileStream& profile, bool is_mastodon_file) {
+	const auto& offsets = is_mastodon_file ? MASTODON_OFFSETS : DEFAULT_OFFSETS;
+
+	requireSpanRange(profile.head, offsets.kdf_metadata, KDF_METADATA_REGION_BYTES, CORRUPT_FILE_ERROR);
+	if (profile.head.size() < offsets.encrypted_file || profile.size < offsets.encrypted_file) {
 		throw std::runtime_error(CORRUPT_FILE_ERROR);
 	}
-	const std::size_t prefix_len = 1 + filename_len;
-	requireSpanRange(payload, 0, prefix_len, CORRUPT_FILE_ERROR);
 
-	std::string decrypted_filename(
-		reinterpret_cast<const char*>(payload.data() + 1),
-		filename_len
-	);
+	const std::optional<PayloadFormat> format = payloadFormatAt(profile.head, offsets.kdf_metadata);
+	if (!format) {
+		throw std::runtime_error(
+			"File Decryption Error: Unsupported legacy encrypted file format. "
+			"Use an older pdvrdt release to recover this file.");
+	}
 
-	const std::size_t old_payload_size = payload.size();
-	const std::size_t compressed_payload_size = old_payload_size - prefix_len;
-	if (compressed_payload_size > 0) {
-		std::memmove(
-			payload.data(),
-			payload.data() + static_cast<std::ptrdiff_t>(prefix_len),
-			compressed_payload_size
-		);
-		sodium_memzero(
-			payload.data() + static_cast<std::ptrdiff_t>(compressed_payload_size),
-			prefix_len
-		);
-	} else {
-		sodium_memzero(payload.data(), old_payload_size);
-	}
-	payload.resize(compressed_payload_size);
-	return decrypted_filename;
+	const KdfSecrets secrets = readKdfSecrets(profile.head, offsets, CORRUPT_FILE_ERROR);
+	if (*format != PayloadFormat::SecretStream) {
+		requirePayloadCipherSupport(secrets.cipher);
+	}
+
+	const std::size_t ciphertext_length = profile.size - offsets.encrypted_file;
+	const std::size_t minimum_length =
+		(*format == PayloadFormat::SecretStream) ? minimumStreamCipherSize() : minimumAeadCipherSize();
+	if (ciphertext_length < minimum_length) {
+		throw std::runtime_error(CORRUPT_FILE_ERROR);
+	}
+
+	return PayloadLayout{
+		.offsets = offsets,
+		.format = *format,
+		.secrets = secrets,
+		.ciphertext_length = ciphertext_length
+	};
+}
+
+// Everything at a KDF3 profile's tail, read before any frame is opened.
+struct AeadPayloadTrailer {
+	AeadFrameGeometry geometry{};
+	vBytes tags{};
+	PayloadMetadata metadata{};
+};
+
+// Opens a KDF3 payload's metadata record first: it names the frame size the
+// rest of the layout depends on, and a wrong PIN fails here, before any frame
+// work starts. nullopt for a record or layout that does not authenticate.
+[[nodiscard]] std::optional<AeadPayloadTrailer> readAeadTrailer(
+	const FrameCipher& cipher, const EmbeddedProfileStream& profile, const PayloadLayout& layout) {
+
+	AeadPayloadTrailer trailer;
+	{
+		std::array<Byte, SEALED_PAYLOAD_METADATA_BYTES> sealed_record{};
+		ScopedWipe record_wipe{sealed_record};
+		profile.read_tail(sealed_record);
+		if (!cipher.open(std::span<Byte>(sealed_record.data(), PAYLOAD_METADATA_BYTES),
+				sealed_record.data() + PAYLOAD_METADATA_BYTES, PAYLOAD_METADATA_RECORD_INDEX, true)) {
+			return std::nullopt;
+		}
+		PayloadMetadataRecord record{};
+		std::memcpy(record.data(), sealed_record.data(), record.size());
+		trailer.metadata = decodePayloadMetadata(record);
+	}
+
+	const std::optional<AeadFrameGeometry> geometry = aeadFrameGeometry(
+		layout.ciphertext_length - SEALED_PAYLOAD_METADATA_BYTES, trailer.metadata.frame_size);
+	if (!geometry) {
+		return std::nullopt;
+	}
+	trailer.geometry = *geometry;
+	const PayloadMetadata& metadata = trailer.metadata;
+	if (metadata.compressed_size > geometry->plain_len ||
+		metadata.block_index_size > geometry->plain_len - metadata.compressed_size) {
+		throw std::runtime_error(CORRUPT_FILE_ERROR);
+	}
+
+	trailer.tags.resize(geometry->frame_count * AEAD_TAG_BYTES + SEALED_PAYLOAD_METADATA_BYTES);
+	profile.read_tail(trailer.tags);
+	trailer.tags.resize(geometry->frame_count * AEAD_TAG_BYTES);
+	return trailer;
 }
 
 void getPin(SensitiveU64& out_pin) {
@@ -671,9 +1305,10 @@ void getPin(SensitiveU64& out_pin) {
 	wipe_input();
 }
 
-} // namespace
-
-void encryptCompressedFileToProfile(
+// Shared body of the two public entry points. With `inline_output` set, the
+// frames are written straight into that vector and only the template and tag
+// table pass through `on_output`.
+void encryptCompressedFile(
 	SensitiveU64& out_pin,
 	vBytes& profile_vec,
 	int data_fd,
@@ -681,7 +1316,9 @@ void encryptCompressedFileToProfile(
 	const std::string& data_filename,
 	bool is_compressed_file,
 	bool has_mastodon_option,
-	std::size_t max_profile_size) {
+	std::size_t max_profile_size,
+	const EncryptedOutputHandler& on_output,
+	vBytes* inline_output) {
 
 	const auto& offsets = has_mastodon_option ? MASTODON_OFFSETS : DEFAULT_OFFSETS;
 	constexpr const char* CORRUPT_PROFILE_ERROR = "Internal Error: Corrupt profile template.";
@@ -697,58 +1334,161 @@ void encryptCompressedFileToProfile(
 
 	const FilenamePrefix filename_prefix = makeFilenamePrefix(data_filename);
 
+	// A stored payload's profile size is known to the byte, so one that cannot
+	// fit is refused here, before the Argon2 derivation and before any input is
+	// read. For a deflated one the plan is an upper bound.
+	const bool wants_segment_index = !has_mastodon_option;
+	const PlannedProfileSize planned = planEncryptedProfileSize(
+		profile_vec.size(), data_file_size, data_filename, is_compressed_file, has_mastodon_option);
+	const std::size_t planned_size = planned.size;
+	if (planned.is_exact && planned_size > max_profile_size) {
+		throw std::runtime_error(
+			"File Size Error: Compressed and encrypted payload exceeds the selected output size limit.");
+	}
+	if (inline_output != nullptr) {
+		// The one allocation of a collected profile: frames are sealed in place,
+		// so the vector must never move under the workers.
+		inline_output->reserve(std::min(planned_size, max_profile_size));
+	}
+
+	const Byte cipher_id = preferredPayloadCipher();
 	Key key{};
 	ScopedWipe key_wipe{key};
 	Salt salt{};
-	StreamHeader stream_header{};
+	FrameNonce base_nonce{};
 	// Generated straight into the caller's storage: there is never a second copy
 	// to scrub, and the caller's SensitiveU64 wipes it on every path out of here,
 	// exception or not.
 	generateRecoveryPin(out_pin);
 
 	randombytes_buf(salt.data(), salt.size());
+	randombytes_buf(base_nonce.data(), base_nonce.size());
 	deriveKeyFromPin(key, out_pin.value, salt);
 
-	crypto_secretstream_xchacha20poly1305_state stream_state{};
-	ScopedWipe stream_state_wipe{stream_state};
-	initializeSecretStreamPush(stream_state, stream_header, key);
+	// Everything the template needs is known before the first frame, so it leaves
+	// complete and is never revisited.
+	writeKdfMetadata(profile_vec, offsets, salt, cipher_id, base_nonce, CORRUPT_PROFILE_ERROR);
 
-	if (stream_header.size() > max_profile_size - profile_vec.size()) {
-		throw std::runtime_error(
-			"File Size Error: Compressed and encrypted payload exceeds the selected output size limit.");
-	}
-	appendBytes(profile_vec, std::span<const Byte>(stream_header), "File Size Error: Encrypted output overflow.");
+	BudgetedOutput output(on_output, max_profile_size);
+	output.emit(profile_vec);
 
-	vBytes cipher_chunk(STREAM_CHUNK_SIZE + crypto_secretstream_xchacha20poly1305_ABYTES);
+	const FrameCipher cipher(cipher_id, key, base_nonce);
+	ParallelFrameSealer sealer(output, cipher, inline_output);
+	sealer.append(filename_prefix.view());
 
-	appendEncryptedFrames(
-		profile_vec, filename_prefix.view(), stream_state, cipher_chunk, max_profile_size);
-
-	bool saw_compressed_output = false;
+	std::size_t compressed_size = 0;
+	DeflateSegmentIndex segments;
 	zlibDeflateFd(data_fd, data_file_size, is_compressed_file, [&](std::span<const Byte> chunk) {
 		if (chunk.empty()) {
 			return;
 		}
-		saw_compressed_output = true;
-		appendEncryptedFrames(
-			profile_vec, chunk, stream_state, cipher_chunk, max_profile_size);
-	});
+		compressed_size += chunk.size();
+		sealer.append(chunk);
+	}, wants_segment_index ? &segments : nullptr);
 
-	if (!saw_compressed_output) {
+	if (compressed_size == 0) {
 		throw std::runtime_error("File Size Error: File is zero bytes. Probable compression failure.");
 	}
 
-	// Close the secretstream with an empty TAG_FINAL frame (~21 bytes overhead).
-	appendEncryptedFrames(
+	vBytes segment_index;
+	if (segments.compressed_sizes.size() > 1) {
+		segment_index = encodeDeflateSegmentIndex(segments);
+		sealer.append(segment_index);
+	}
+
+	sealer.finish();
+
+	PayloadMetadataRecord record = encodePayloadMetadata(PayloadMetadata{
+		.original_size = data_file_size,
+		.compressed_size = compressed_size,
+		.block_index_size = segment_index.size(),
+		.frame_size = static_cast<std::uint32_t>(AEAD_FRAME_SIZE),
+		.codec = PAYLOAD_CODEC_ZLIB,
+		.flags = segment_index.empty() ? Byte{0} : PAYLOAD_FLAG_SEGMENT_INDEX
+	});
+	FrameTag record_tag{};
+	cipher.seal(record, record_tag, PAYLOAD_METADATA_RECORD_INDEX, true);
+	output.emit(record);
+	output.emit(record_tag);
+}
+
+} // namespace
+
+PlannedProfileSize planEncryptedProfileSize(
+	std::size_t template_size,
+	std::size_t data_file_size,
+	const std::string& data_filename,
+	bool is_compressed_file,
+	bool has_mastodon_option) {
+
+	// Only a default-mode payload gets a segment index: recover reaches it ahead
+	// of the payload by reading frames at random, which a Mastodon profile, only
+	// ever replayed from its iCCP stream, does not allow. Its payloads are small
+	// enough not to need one.
+	const std::size_t segment_index_size = has_mastodon_option ? 0 : deflateSegmentIndexSize(data_file_size);
+	return PlannedProfileSize{
+		.size = plannedProfileSize(
+			template_size,
+			makeFilenamePrefix(data_filename).size,
+			checkedAddSize(
+				zlibDeflatedSizeBound(data_file_size, is_compressed_file),
+				segment_index_size,
+				"File Size Error: Encrypted output overflow.")),
+		.is_exact = is_compressed_file
+	};
+}
+
+void encryptCompressedFileToStream(
+	SensitiveU64& out_pin,
+	vBytes& profile_vec,
+	int data_fd,
+	std::size_t data_file_size,
+	const std::string& data_filename,
+	bool is_compressed_file,
+	bool has_mastodon_option,
+	std::size_t max_profile_size,
+	const EncryptedOutputHandler& on_output) {
+
+	encryptCompressedFile(
+		out_pin,
 		profile_vec,
-		std::span<const Byte>{},
-		stream_state,
-		cipher_chunk,
+		data_fd,
+		data_file_size,
+		data_filename,
+		is_compressed_file,
+		has_mastodon_option,
 		max_profile_size,
-		crypto_secretstream_xchacha20poly1305_TAG_FINAL
-	);
+		on_output,
+		nullptr);
+}
+
+void encryptCompressedFileToProfile(
+	SensitiveU64& out_pin,
+	vBytes& profile_vec,
+	int data_fd,
+	std::size_t data_file_size,
+	const std::string& data_filename,
+	bool is_compressed_file,
+	bool has_mastodon_option,
+	std::size_t max_profile_size) {
 
-	writeKdfMetadata(profile_vec, offsets, salt, stream_header, CORRUPT_PROFILE_ERROR);
+	// Holds plaintext until each frame is sealed, hence the wipe on the way out.
+	vBytes profile;
+	ScopedWipe profile_wipe{profile};
+	encryptCompressedFile(
+		out_pin,
+		profile_vec,
+		data_fd,
+		data_file_size,
+		data_filename,
+		is_compressed_file,
+		has_mastodon_option,
+		max_profile_size,
+		[&](std::span<const Byte> bytes, std::uint32_t) {
+			appendBytes(profile, bytes, "File Size Error: Encrypted output overflow.");
+		},
+		&profile);
+	profile_vec = std::move(profile);
 }
 
 std::optional<std::span<const Byte>> findPdvrdtIccpPayload(std::span<const Byte> iccp_data) {
@@ -775,37 +1515,140 @@ std::optional<std::span<const Byte>> findPdvrdtIccpPayload(std::span<const Byte>
 	return compressed;
 }
 
-std::optional<std::string> decryptDataFile(vBytes& png_vec, bool is_mastodon_file) {
+bool isSeekablePayload(const EmbeddedProfileStream& profile, bool is_mastodon_file) {
 	const auto& offsets = is_mastodon_file ? MASTODON_OFFSETS : DEFAULT_OFFSETS;
+	return profile.read_at &&
+		payloadFormatAt(profile.head, offsets.kdf_metadata) == PayloadFormat::AeadFrames;
+}
 
-	constexpr const char* CORRUPT_FILE_ERROR = "File Recovery Error: Embedded profile is corrupt.";
-	requireSpanRange(png_vec, offsets.kdf_metadata, KDF_METADATA_REGION_BYTES, CORRUPT_FILE_ERROR);
-	if (offsets.encrypted_file > png_vec.size()) {
-		throw std::runtime_error(CORRUPT_FILE_ERROR);
-	}
+bool decryptDataStream(
+	const EmbeddedProfileStream& profile,
+	bool is_mastodon_file,
+	const RecoveredHeaderHandler& on_header,
+	const DecryptedOutputHandler& on_payload) {
 
-	if (!hasSupportedKdfMetadataAt(png_vec, offsets.kdf_metadata)) {
-		throw std::runtime_error(
-			"File Decryption Error: Unsupported legacy encrypted file format. "
-			"Use an older pdvrdt release to recover this file.");
-	}
+	const PayloadLayout layout = inspectPayloadLayout(profile, is_mastodon_file);
+	const ProfileOffsets& offsets = layout.offsets;
 
 	SensitiveU64 recovery_pin;
 	getPin(recovery_pin);
 
 	Key key{};
 	ScopedWipe key_wipe{key};
-	const KdfSecrets secrets = readKdfSecrets(png_vec, offsets, CORRUPT_FILE_ERROR);
-	deriveKeyFromPin(key, recovery_pin.value, secrets.salt);
+	deriveKeyFromPin(key, recovery_pin.value, layout.secrets.salt);
+
+	std::optional<PayloadMetadata> metadata{};
+	vBytes segment_index{};
+	PlaintextSink sink(on_header, on_payload, metadata, segment_index);
+
+	// The head was read already; the readers take the profile from the first
+	// ciphertext byte on.
+	auto replayCiphertext = [&](auto& reader) {
+		std::size_t skip = offsets.encrypted_file;
+		profile.replay([&](std::span<const Byte> bytes) {
+			const std::size_t skipped = std::min(skip, bytes.size());
+			skip -= skipped;
+			if (bytes.size() > skipped) {
+				reader.feed(bytes.subspan(skipped));
+			}
+		});
+		reader.finish();
+	};
 
-	const std::size_t ciphertext_length = png_vec.size() - offsets.encrypted_file;
-	if (ciphertext_length < minimumStreamCipherSize()) {
-		throw std::runtime_error(CORRUPT_FILE_ERROR);
+	try {
+		if (layout.format == PayloadFormat::SecretStream) {
+			SecretStreamReader reader(key, layout.secrets.nonce, sink);
+			replayCiphertext(reader);
+		} else {
+			const FrameCipher cipher(layout.secrets.cipher, key, layout.secrets.nonce);
+			const std::optional<AeadPayloadTrailer> trailer = readAeadTrailer(cipher, profile, layout);
+			if (!trailer) {
+				return false;
+			}
+			metadata = trailer->metadata;
+
+			// The segment index ends the plaintext; the frames holding it are opened
+			// out of turn so the payload's consumer has it before the first byte.
+			if (metadata->block_index_size != 0 && profile.read_at) {
+				segment_index.resize(static_cast<std::size_t>(metadata->block_index_size));
+				readPlaintextRange(cipher, trailer->geometry, trailer->tags, profile.read_at, offsets.encrypted_file,
+					trailer->geometry.plain_len - segment_index.size(), segment_index);
+			}
+
+			AeadFrameReader reader(cipher, trailer->geometry, layout.ciphertext_length, trailer->tags, sink);
+			if (profile.read_at) {
+				reader.readFrom(profile.read_at, offsets.encrypted_file);
+				reader.finish();
+			} else {
+				replayCiphertext(reader);
+			}
+		}
+	} catch (const PayloadAuthenticationFailure&) {
+		return false;
 	}
 
-	if (!decryptWithSecretStreamInPlace(png_vec, offsets.encrypted_file, ciphertext_length, key, secrets.stream_header)) {
-		return std::nullopt;
+	sink.finish();
+	return true;
+}
+
+bool decryptDataSeekable(
+	const EmbeddedProfileStream& profile,
+	bool is_mastodon_file,
+	const SeekablePayloadHandler& on_payload) {
+
+	if (!isSeekablePayload(profile, is_mastodon_file)) {
+		throw std::invalid_argument("decryptDataSeekable: payload does not allow random access.");
 	}
+	const PayloadLayout layout = inspectPayloadLayout(profile, is_mastodon_file);
+	const ProfileOffsets& offsets = layout.offsets;
+
+	SensitiveU64 recovery_pin;
+	getPin(recovery_pin);
+
+	Key key{};
+	ScopedWipe key_wipe{key};
+	deriveKeyFromPin(key, recovery_pin.value, layout.secrets.salt);
+
+	try {
+		const FrameCipher cipher(layout.secrets.cipher, key, layout.secrets.nonce);
+		const std::optional<AeadPayloadTrailer> trailer = readAeadTrailer(cipher, profile, layout);
+		if (!trailer) {
+			return false;
+		}
+		const AeadFrameGeometry& geometry = trailer->geometry;
+		const PayloadMetadata& metadata = trailer->metadata;
+
+		auto readPlaintext = [&](std::size_t start, std::span<Byte> out) {
+			readPlaintextRange(cipher, geometry, trailer->tags, profile.read_at, offsets.encrypted_file, start, out);
+		};
+
+		// The filename prefix leads frame 0; what follows it is laid out exactly
+		// as the record says, or the payload is malformed.
+		FilenamePrefix prefix;
+		ScopedWipe prefix_wipe{prefix.bytes};
+		readPlaintext(0, std::span<Byte>(prefix.bytes.data(), std::min(prefix.bytes.size(), geometry.plain_len)));
+		prefix.size = 1 + prefix.bytes[0];
+		if (prefix.bytes[0] == 0 || prefix.size > geometry.plain_len ||
+			geometry.plain_len - prefix.size != metadata.compressed_size + metadata.block_index_size) {
+			throw std::runtime_error(CORRUPT_FILE_ERROR);
+		}
+		const auto compressed_size = static_cast<std::size_t>(metadata.compressed_size);
 
-	return extractFilenamePrefix(png_vec);
+		vBytes segment_index(static_cast<std::size_t>(metadata.block_index_size));
+		readPlaintext(prefix.size + compressed_size, segment_index);
+
+		const PayloadRangeReader read_payload = [&](std::span<Byte> out, std::size_t offset) {
+			if (offset > compressed_size || out.size() > compressed_size - offset) {
+				throw std::runtime_error(CORRUPT_FILE_ERROR);
+			}
+			readPlaintext(prefix.size + offset, out);
+		};
+
+		std::string filename(reinterpret_cast<const char*>(prefix.bytes.data() + 1), prefix.size - 1);
+		ScopedWipe filename_wipe{filename};
+		on_payload(filename, metadata, segment_index, read_payload);
+	} catch (const PayloadAuthenticationFailure&) {
+		return false;
+	}
+	return true;
 }
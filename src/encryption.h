@@ -3,10 +3,13 @@
 #include "common.h"
 #include "io_utils.h"
 
+#include <algorithm>
 #include <cstddef>
 #include <cstring>
+#include <functional>
 #include <optional>
 #include <span>
+#include <string>
 
 struct ProfileOffsets {
 	std::size_t
@@ -24,18 +27,38 @@ inline constexpr std::size_t
 	KDF_MAGIC_OFFSET          = 0,
 	KDF_ALG_OFFSET            = 4,
 	KDF_SENTINEL_OFFSET       = 5,
+	KDF_CIPHER_OFFSET         = 6,   // KDF3; random padding in KDF2
 	KDF_SALT_OFFSET           = 8,
-	KDF_NONCE_OFFSET          = 24;
+	KDF_NONCE_OFFSET          = 24;  // KDF2: secretstream header. KDF3: base frame nonce.
 
 inline constexpr Byte
 	KDF_ALG_ARGON2ID13 = 1,
 	KDF_SENTINEL       = 0xA5;
 
+// Payload ciphers a KDF3 region can name at KDF_CIPHER_OFFSET. Conceal picks
+// AES-256-GCM when the CPU has AES-NI and PCLMUL, XChaCha20-Poly1305 otherwise,
+// unless PDVRDT_PAYLOAD_CIPHER names one.
+inline constexpr Byte
+	PAYLOAD_CIPHER_XCHACHA20POLY1305 = 1,
+	PAYLOAD_CIPHER_AES256GCM         = 2;
+
 // Wire format: each crypto_secretstream frame is preceded by its big-endian
 // length in this many bytes. Part of the on-disk layout, so it lives here beside
 // the offset tables rather than inside encryption.cpp.
 inline constexpr std::size_t STREAM_FRAME_LEN_BYTES = 4;
 
+// KDF3 wire format: the plaintext is cut into frames of exactly this size (the
+// last may be shorter), each sealed on its own. Frame ciphertexts are stored
+// back to back, followed by one authentication tag per frame, so a frame's
+// position follows from its index alone, and then by the sealed payload
+// metadata record described below.
+inline constexpr std::size_t
+	AEAD_FRAME_SIZE = 1 * 1024 * 1024,
+	AEAD_TAG_BYTES  = crypto_aead_xchacha20poly1305_ietf_ABYTES;
+
+static_assert(crypto_aead_aes256gcm_ABYTES == AEAD_TAG_BYTES,
+	"Both payload ciphers share one frame layout, tag table included.");
+
 // Smallest ciphertext a well-formed payload can have: the stream header plus one
 // framed TAG_FINAL frame. Used by conceal/recover to reject truncated payloads.
 [[nodiscard]] inline constexpr std::size_t minimumStreamCipherSize() {
@@ -44,8 +67,70 @@ inline constexpr std::size_t STREAM_FRAME_LEN_BYTES = 4;
 		crypto_secretstream_xchacha20poly1305_ABYTES;
 }
 
+// The payload metadata record ends a KDF3 profile, after the tag table. It sits
+// at the end rather than the front because conceal streams: frame 0 is sealed
+// long before a deflated payload's compressed size is known. Recover reads it
+// first all the same, from the profile's tail, before opening any frame.
+//
+// Record plaintext, little-endian:
+//   [0]      PAYLOAD_METADATA_VERSION
+//   [1]      codec (PAYLOAD_CODEC_*)
+//   [2]      flags (PAYLOAD_FLAG_*); unknown bits are refused
+//   [3]      zero
+//   [4..8)   frame size the payload was cut into
+//   [8..16)  original file size
+//   [16..24) compressed payload size, the bytes after the filename prefix
+//   [24..32) block index size, zero when there is none
+//
+// With PAYLOAD_FLAG_SEGMENT_INDEX the compressed payload is followed, inside
+// the plaintext, by an encoded DeflateSegmentIndex of the block index size, so
+// recover can inflate its windows in parallel. Conceal writes one for
+// multi-window default-mode payloads.
+//
+// Sealed like a frame whose index is PAYLOAD_METADATA_RECORD_INDEX, a value no
+// frame can reach, and marked final.
+inline constexpr std::size_t
+	PAYLOAD_METADATA_BYTES        = 32,
+	SEALED_PAYLOAD_METADATA_BYTES = PAYLOAD_METADATA_BYTES + AEAD_TAG_BYTES;
+
+inline constexpr std::uint64_t PAYLOAD_METADATA_RECORD_INDEX = ~std::uint64_t{0};
+
+inline constexpr Byte
+	PAYLOAD_METADATA_VERSION    = 1,
+	PAYLOAD_CODEC_ZLIB          = 1,
+	PAYLOAD_FLAG_SEGMENT_INDEX  = 0x01;
+
+// Frame sizes a metadata record may declare. Recover holds a few frames per pool
+// worker, so the upper bound is what keeps its memory in check.
+inline constexpr std::size_t
+	MIN_AEAD_FRAME_SIZE = 4 * 1024,
+	MAX_AEAD_FRAME_SIZE = 4 * 1024 * 1024;
+
+static_assert(AEAD_FRAME_SIZE >= MIN_AEAD_FRAME_SIZE && AEAD_FRAME_SIZE <= MAX_AEAD_FRAME_SIZE);
+
+struct PayloadMetadata {
+	std::uint64_t original_size{};
+	std::uint64_t compressed_size{};
+	std::uint64_t block_index_size{};
+	std::uint32_t frame_size{};
+	Byte codec{};
+	Byte flags{};
+};
+
+// KDF3 counterpart: one single-byte frame, its tag and the metadata record.
+[[nodiscard]] inline constexpr std::size_t minimumAeadCipherSize() {
+	return 1 + AEAD_TAG_BYTES + SEALED_PAYLOAD_METADATA_BYTES;
+}
+
+// Either layout; what a payload must at least carry before its version is known.
+[[nodiscard]] inline constexpr std::size_t minimumPayloadCipherSize() {
+	return std::min(minimumStreamCipherSize(), minimumAeadCipherSize());
+}
+
 inline constexpr auto KDF_METADATA_MAGIC_V2 =
 	std::to_array<Byte>({'K', 'D', 'F', '2'});
+inline constexpr auto KDF_METADATA_MAGIC_V3 =
+	std::to_array<Byte>({'K', 'D', 'F', '3'});
 
 inline constexpr auto PDVRDT_SIG =
 	std::to_array<Byte>({0xC6, 0x50, 0x3C, 0xEA, 0x5E, 0x9D, 0xF9});
@@ -55,20 +140,38 @@ inline constexpr auto PDVRDT_SIG =
 // never emit an image that its own recovery path refuses to process.
 inline constexpr std::size_t MAX_MASTODON_PROFILE_BYTES = 64ULL * 1024 * 1024;
 
-[[nodiscard]] inline bool hasSupportedKdfMetadataAt(std::span<const Byte> data, std::size_t base_index) {
+enum class PayloadFormat : Byte {
+	SecretStream,  // KDF2: one chained crypto_secretstream
+	AeadFrames     // KDF3: independent AEAD frames and a sealed metadata record
+};
+
+// The payload layout the KDF metadata region at `base_index` announces, or
+// nullopt for anything this build cannot decrypt.
+[[nodiscard]] inline std::optional<PayloadFormat> payloadFormatAt(std::span<const Byte> data, std::size_t base_index) {
 	if (base_index > data.size() || KDF_METADATA_REGION_BYTES > data.size() - base_index) {
-		return false;
+		return std::nullopt;
+	}
+	if (data[base_index + KDF_ALG_OFFSET] != KDF_ALG_ARGON2ID13 ||
+		data[base_index + KDF_SENTINEL_OFFSET] != KDF_SENTINEL) {
+		return std::nullopt;
+	}
+
+	const Byte* const magic = data.data() + base_index + KDF_MAGIC_OFFSET;
+	if (std::memcmp(magic, KDF_METADATA_MAGIC_V2.data(), KDF_METADATA_MAGIC_V2.size()) == 0) {
+		return PayloadFormat::SecretStream;
 	}
+	const Byte cipher = data[base_index + KDF_CIPHER_OFFSET];
+	if (cipher != PAYLOAD_CIPHER_XCHACHA20POLY1305 && cipher != PAYLOAD_CIPHER_AES256GCM) {
+		return std::nullopt;
+	}
+	if (std::memcmp(magic, KDF_METADATA_MAGIC_V3.data(), KDF_METADATA_MAGIC_V3.size()) == 0) {
+		return PayloadFormat::AeadFrames;
+	}
+	return std::nullopt;
+}
 
-	const std::size_t magic_offset = base_index + KDF_MAGIC_OFFSET;
-	return
-		std::memcmp(
-			data.data() + magic_offset,
-			KDF_METADATA_MAGIC_V2.data(),
-			KDF_METADATA_MAGIC_V2.size()
-		) == 0 &&
-		data[base_index + KDF_ALG_OFFSET] == KDF_ALG_ARGON2ID13 &&
-		data[base_index + KDF_SENTINEL_OFFSET] == KDF_SENTINEL;
+[[nodiscard]] inline bool hasSupportedKdfMetadataAt(std::span<const Byte> data, std::size_t base_index) {
+	return payloadFormatAt(data, base_index).has_value();
 }
 
 // The two fixed byte strings that introduce an embedded payload: a fake zlib
@@ -98,9 +201,52 @@ inline constexpr auto PDVRDT_ICCP_PREFIX = std::to_array<Byte>({ 0x69, 0x63, 0x6
 // which chunks count.
 [[nodiscard]] std::optional<std::span<const Byte>> findPdvrdtIccpPayload(std::span<const Byte> iccp_data);
 
+// Receives the encrypted profile in pieces, each with its CRC-32 (see
+// pdvrdtCrc32Combine()). A frame's CRC is taken by the worker that sealed it,
+// while the frame is still in cache, so a caller wrapping the profile in a PNG
+// chunk never sweeps the bytes a second time.
+using EncryptedOutputHandler = std::function<void(std::span<const Byte> bytes, std::uint32_t crc)>;
+
+// Size of the profile encryptCompressedFileToStream() or ...ToProfile() builds
+// from a template of `template_size` bytes: exact when the payload is stored,
+// an upper bound when it is deflated (see zlibDeflatedSizeBound()). Known
+// before any input is read or the key derived.
+struct PlannedProfileSize {
+	std::size_t size{};
+	bool is_exact{};
+};
+
+[[nodiscard]] PlannedProfileSize planEncryptedProfileSize(
+	std::size_t template_size,
+	std::size_t data_file_size,
+	const std::string& data_filename,
+	bool is_compressed_file,
+	bool has_mastodon_option);
+
 // Writes the freshly generated recovery PIN into `out_pin` rather than
 // returning it: a by-value return would leave one unwiped copy of the secret in
 // the return slot until the caller re-wrapped it.
+//
+// Streams the encrypted profile through `on_output` as it is produced: first the
+// template in `profile_vec` with its KDF3 metadata filled in, then each sealed
+// frame in order, then the tag table and the sealed payload metadata record.
+// Holds one frame per pool worker plus two, and throws once the total would
+// exceed `max_profile_size`.
+void encryptCompressedFileToStream(
+	SensitiveU64& out_pin,
+	vBytes& profile_vec,
+	int data_fd,
+	std::size_t data_file_size,
+	const std::string& data_filename,
+	bool is_compressed_file,
+	bool has_mastodon_option,
+	std::size_t max_profile_size,
+	const EncryptedOutputHandler& on_output);
+
+// As above, but collects the whole profile back into `profile_vec`, sealing each
+// frame where it lands rather than copying it in. For the Mastodon layout, whose
+// iCCP chunk needs the complete profile before it can be wrapped in a zlib
+// stream.
 void encryptCompressedFileToProfile(
 	SensitiveU64& out_pin,
 	vBytes& profile_vec,
@@ -111,4 +257,76 @@ void encryptCompressedFileToProfile(
 	bool has_mastodon_option,
 	std::size_t max_profile_size);
 
-[[nodiscard]] std::optional<std::string> decryptDataFile(vBytes& png_vec, bool is_mastodon_file);
+using DecryptedOutputHandler = std::function<void(std::span<const Byte>)>;
+// Called once, before any payload byte, with the embedded filename and, for a
+// KDF3 payload, its authenticated metadata and the encoded segment index. The
+// index is empty when there is none, or when the profile offers no `read_at`
+// to reach it ahead of the payload; the payload still carries it at its end.
+using RecoveredHeaderHandler = std::function<void(
+	std::string& filename,
+	const std::optional<PayloadMetadata>& metadata,
+	std::span<const Byte> segment_index)>;
+// Fills its first argument with the profile's bytes from the given offset.
+using ProfileReader = std::function<void(std::span<Byte>, std::size_t)>;
+
+// An embedded profile as recover presents it without holding it in memory: its
+// size, its first bytes through at least the start of the ciphertext, its last
+// bytes on request, and a replay of the whole profile in order. A Mastodon
+// profile exists only as the output of inflating its iCCP chunk, so `replay`
+// is the one way to reach its middle; a default profile lies in the file as is
+// and also offers `read_at`, which lets each frame be read into the buffer it
+// is decrypted and inflated from.
+struct EmbeddedProfileStream {
+	std::size_t size{};
+	vBytes head{};
+	// Fills its argument with the profile's last bytes.
+	std::function<void(std::span<Byte>)> read_tail{};
+	// Hands the profile, from its first byte, to the handler in pieces.
+	std::function<void(const DecryptedOutputHandler&)> replay{};
+	// Random access to the profile; empty when only `replay` can reach it.
+	ProfileReader read_at{};
+};
+
+// Prompts for the PIN, then decrypts the profile frame by frame: the embedded
+// filename and any metadata go to `on_header` before any payload byte, and the
+// compressed payload to `on_payload` one authenticated frame at a time, in
+// order. Memory stays at a few frames per pool worker whatever the payload
+// size.
+//
+// False for a wrong PIN or a payload that fails authentication. That can happen
+// after `on_payload` has already received the frames ahead of the failing one,
+// so the caller must discard everything it was given.
+[[nodiscard]] bool decryptDataStream(
+	const EmbeddedProfileStream& profile,
+	bool is_mastodon_file,
+	const RecoveredHeaderHandler& on_header,
+	const DecryptedOutputHandler& on_payload);
+
+// Decrypted bytes of a KDF3 payload's compressed stream, from the given offset
+// into it: only the frames holding them are read and opened.
+using PayloadRangeReader = std::function<void(std::span<Byte>, std::size_t)>;
+// Called once with the embedded filename, the payload's authenticated metadata,
+// its encoded segment index (empty when there is none) and a reader for any
+// part of its compressed stream. The reader is valid only during the call.
+using SeekablePayloadHandler = std::function<void(
+	std::string& filename,
+	const PayloadMetadata& metadata,
+	std::span<const Byte> segment_index,
+	const PayloadRangeReader& read_payload)>;
+
+// True if decryptDataSeekable() can open this profile: a KDF3 payload whose
+// profile offers `read_at`. Decided from the head alone, before the PIN prompt.
+[[nodiscard]] bool isSeekablePayload(const EmbeddedProfileStream& profile, bool is_mastodon_file);
+
+// Random-access counterpart of decryptDataStream(): prompts for the PIN, opens
+// the metadata record, the filename and the segment index, and leaves the rest
+// of the payload to `on_payload`, which decrypts only what it reads. Frames it
+// never reads are never authenticated, so the whole payload is not vouched for;
+// every byte handed out is.
+//
+// False for a wrong PIN or a frame that fails authentication, possibly after
+// `on_payload` has already written output the caller must discard.
+[[nodiscard]] bool decryptDataSeekable(
+	const EmbeddedProfileStream& profile,
+	bool is_mastodon_file,
+	const SeekablePayloadHandler& on_payload);
@@ -6,14 +6,31 @@
 #include "lodepng/lodepng.h"
 #include "lodepng/lodepng_zlib_adapter.h"
 #include "png_utils.h"
+#include "thread_pool.h"
 
+#include <zlib.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define PDVRDT_HAS_X86_SIMD 1
+#else
+#define PDVRDT_HAS_X86_SIMD 0
+#endif
+
+#include <algorithm>
 #include <array>
+#include <bit>
+#include <cstdlib>
 #include <cstring>
+#include <exception>
 #include <format>
+#include <future>
+#include <memory>
 #include <ranges>
 #include <span>
 #include <stdexcept>
 #include <string_view>
+#include <type_traits>
 #include <vector>
 
 namespace {
@@ -43,7 +60,8 @@ constexpr std::size_t
 	// Same ceiling the zlib adapter enforces while inflating, so an oversized
 	// cover is rejected here with a clear message instead of failing opaquely
 	// inside lodepng. Defined once, in the adapter.
-	MAX_LODEPNG_DECODE_BYTES = lodepng_zlib_adapter::MAX_DECOMPRESS_SIZE;
+	MAX_LODEPNG_DECODE_BYTES = lodepng_zlib_adapter::MAX_DECOMPRESS_SIZE,
+	MAX_PALETTE_COLORS       = 256;
 
 [[nodiscard]] constexpr std::uint32_t packRgbaKey(Byte red, Byte green, Byte blue, Byte alpha) {
 	return
@@ -53,11 +71,19 @@ constexpr std::size_t
 		 static_cast<std::uint32_t>(alpha);
 }
 
+// Distinct RGBA8 colours of a decoded cover in order of first appearance, which
+// is the order the palette is written in. Counting stops one colour past
+// MAX_PALETTE_COLORS, so numcolors tops out at MAX_PALETTE_COLORS + 1.
+struct PaletteStats {
+	std::array<Byte, MAX_PALETTE_COLORS * 4> palette{};
+	std::size_t numcolors{};
+};
+
 struct DecodedImageForOptimization {
 	vBytes image{};
 	unsigned width{};
 	unsigned height{};
-	LodePNGColorStats stats{};
+	PaletteStats stats{};
 	Byte png_color_type{};
 	Byte png_bit_depth{};
 	LodePNGColorType raw_color_type{};
@@ -205,36 +231,31 @@ void compactChunksAfterIhdr(vBytes& image_file_vec, std::size_t first_chunk_pos,
 	image_file_vec.resize(write_pos);
 }
 
-// Bytes lodepng inflates the IDAT stream into for a single (sub-)image: one
-// filter byte plus a byte-padded row of samples, per row.
-[[nodiscard]] std::size_t filteredImageBytes(
-	std::size_t width, std::size_t height, std::size_t bits_per_pixel) {
+// One run of equally sized rows in the inflated IDAT stream: the whole image, or
+// one Adam7 pass. Each row is one filter byte plus a byte-padded row of samples.
+struct ScanlineRun {
+	std::size_t row_size{};
+	std::size_t rows{};
+};
 
+[[nodiscard]] ScanlineRun scanlineRun(std::size_t width, std::size_t height, std::size_t bits_per_pixel) {
 	constexpr const char* OVERFLOW_ERROR = "PNG Error: Inflated image size overflow.";
-	if (width == 0 || height == 0) {
-		return 0;
-	}
 	const std::size_t row_bits  = checkedMulSize(width, bits_per_pixel, OVERFLOW_ERROR);
 	const std::size_t row_bytes = checkedAddSize(row_bits / 8, (row_bits % 8) ? 1 : 0, OVERFLOW_ERROR);
-	return checkedMulSize(
-		checkedAddSize(row_bytes, 1, OVERFLOW_ERROR),
-		height,
-		OVERFLOW_ERROR
-	);
+	return {checkedAddSize(row_bytes, 1, OVERFLOW_ERROR), height};
 }
 
-// Total inflated size, honouring the interlace method. Adam7 splits the image
-// into seven sub-images, each with its own byte-padded rows and its own filter
-// byte per row, which comes to *more* than the non-interlaced layout (~1.875x
-// the filter bytes, plus per-pass row padding). Using the non-interlaced formula
-// for an interlaced cover would therefore under-count and let the safety limit
-// be exceeded, so each pass is measured.
-[[nodiscard]] std::size_t inflatedImageBytes(
+// The rows lodepng inflates, in stream order, honouring the interlace method.
+// Adam7 splits the image into seven sub-images, each with its own byte-padded
+// rows and its own filter byte per row, which comes to *more* than the
+// non-interlaced layout (~1.875x the filter bytes, plus per-pass row padding).
+// Using the non-interlaced layout for an interlaced cover would therefore
+// under-count and let the safety limit be exceeded, so each pass is measured.
+[[nodiscard]] std::vector<ScanlineRun> scanlineRuns(
 	std::size_t width, std::size_t height, std::size_t bits_per_pixel, Byte interlace_method) {
 
-	constexpr const char* OVERFLOW_ERROR = "PNG Error: Inflated image size overflow.";
 	if (interlace_method == 0) {
-		return filteredImageBytes(width, height, bits_per_pixel);
+		return {scanlineRun(width, height, bits_per_pixel)};
 	}
 
 	// Adam7 pass origins and strides (PNG spec, 4.7 "Interlaced data order").
@@ -244,23 +265,41 @@ void compactChunksAfterIhdr(vBytes& image_file_vec, std::size_t first_chunk_pos,
 		X_STEP  { 8, 8, 4, 4, 2, 2, 1 },
 		Y_STEP  { 8, 8, 8, 4, 4, 2, 2 };
 
-	std::size_t total = 0;
+	std::vector<ScanlineRun> runs;
 	for (std::size_t pass = 0; pass < X_START.size(); ++pass) {
 		if (width <= X_START[pass] || height <= Y_START[pass]) {
 			continue;  // Empty pass: no rows, so no filter bytes either.
 		}
 		const std::size_t pass_width  = (width  - X_START[pass] + X_STEP[pass] - 1) / X_STEP[pass];
 		const std::size_t pass_height = (height - Y_START[pass] + Y_STEP[pass] - 1) / Y_STEP[pass];
-		total = checkedAddSize(
-			total,
-			filteredImageBytes(pass_width, pass_height, bits_per_pixel),
-			OVERFLOW_ERROR
-		);
+		runs.push_back(scanlineRun(pass_width, pass_height, bits_per_pixel));
+	}
+	return runs;
+}
+
+[[nodiscard]] std::size_t inflatedImageBytes(std::span<const ScanlineRun> runs) {
+	constexpr const char* OVERFLOW_ERROR = "PNG Error: Inflated image size overflow.";
+	std::size_t total = 0;
+	for (const ScanlineRun& run : runs) {
+		total = checkedAddSize(total, checkedMulSize(run.row_size, run.rows, OVERFLOW_ERROR), OVERFLOW_ERROR);
 	}
 	return total;
 }
 
-void preflightPngDecode(std::span<const Byte> png) {
+// IHDR fields the optimizer works from once preflight has validated them.
+struct CoverImageHeader {
+	std::uint32_t width{};
+	std::uint32_t height{};
+	Byte bit_depth{};
+	Byte color_type{};
+	bool interlaced{};
+	std::vector<ScanlineRun> scanlines{};
+	std::size_t inflated_size{};
+};
+
+// The returned inflated size is exact, so the decode can size its one-shot
+// inflate from it.
+[[nodiscard]] CoverImageHeader preflightPngDecode(std::span<const Byte> png) {
 	requireSpanRange(png, 0, PNG_HEADER_SIZE + CHUNK_OVERHEAD + IHDR_DATA_SIZE, "PNG Error: File too small to contain valid PNG structure.");
 	const PngChunkView ihdr = readRequiredIhdr(png);
 	validateStaticPngChunks(png, ihdr.offset + ihdr.total_size);
@@ -292,15 +331,18 @@ void preflightPngDecode(std::span<const Byte> png) {
 		static_cast<std::size_t>(bit_depth),
 		"PNG Error: Scanline size overflow."
 	);
-	const std::size_t inflated_size = inflatedImageBytes(
+	CoverImageHeader header{width, height, bit_depth, color_type, interlace_method != 0};
+	header.scanlines = scanlineRuns(
 		static_cast<std::size_t>(width),
 		static_cast<std::size_t>(height),
 		bits_per_pixel,
 		interlace_method
 	);
-	if (inflated_size > MAX_LODEPNG_DECODE_BYTES) {
+	header.inflated_size = inflatedImageBytes(header.scanlines);
+	if (header.inflated_size > MAX_LODEPNG_DECODE_BYTES) {
 		throw std::runtime_error("PNG Error: Inflated image exceeds safety limit.");
 	}
+	return header;
 }
 
 void appendPaletteSbitFromRgba(
@@ -388,7 +430,7 @@ void removeExistingPdvrdtIdatChunks(vBytes& image_file_vec) {
 }
 
 // Compact open-addressing hash from a 32-bit RGBA colour to its palette index.
-// palette_size is capped at MAX_PALETTE_SIZE (256, validated in convertToPalette),
+// palette_size is capped at MAX_PALETTE_COLORS (256, validated in convertToPalette),
 // so a 512-slot table stays at <= 50% load: ~1-2 probes per lookup, the whole
 // table fits in L1, and there is no large allocation or zero-fill (unlike a
 // 2^24-entry / 33 MiB direct LUT). Ported from pdvzip's PaletteIndexTable.
@@ -443,20 +485,284 @@ public:
 	}
 };
 
+// Feeds PaletteStats one pixel at a time. add() returns false once a colour past
+// MAX_PALETTE_COLORS turns up: the cover cannot be palettized, so the scan stops.
+class PaletteCollector {
+	PaletteIndexTable seen_;
+	PaletteStats& stats_;
+
+public:
+	explicit PaletteCollector(PaletteStats& stats) : stats_(stats) {}
+
+	[[nodiscard]] bool add(const Byte* pixel) {
+		const std::uint32_t key = packRgbaKey(pixel[0], pixel[1], pixel[2], pixel[3]);
+		Byte index = 0;
+		if (seen_.find(key, index)) {
+			return true;
+		}
+		if (stats_.numcolors == MAX_PALETTE_COLORS) {
+			++stats_.numcolors;
+			return false;
+		}
+		seen_.insertIfAbsent(key, static_cast<Byte>(stats_.numcolors));
+		std::memcpy(&stats_.palette[stats_.numcolors * 4], pixel, 4);
+		++stats_.numcolors;
+		return true;
+	}
+};
+
+// Each scan hands the collector only the pixels that differ from the one
+// before, so a run of one colour costs a compare rather than a hash probe. The
+// vector variants compare a register of pixels against the same pixels shifted
+// back by one and visit just the lanes that changed. All resume from `start`,
+// whose predecessor has already been seen.
+[[nodiscard]] bool collectColorsScalar(
+	const Byte* rgba, std::size_t start, std::size_t pixel_count, PaletteCollector& collector) {
+
+	for (std::size_t i = start; i < pixel_count; ++i) {
+		if (std::memcmp(rgba + i * 4, rgba + (i - 1) * 4, 4) != 0 && !collector.add(rgba + i * 4)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+#if PDVRDT_HAS_X86_SIMD
+
+[[nodiscard]] bool cpuHasAvx2() {
+	static const bool has_avx2 = __builtin_cpu_supports("avx2");
+	return has_avx2;
+}
+
+[[nodiscard]] __attribute__((target("sse2"))) bool collectColorsSse2(
+	const Byte* rgba, std::size_t pixel_count, PaletteCollector& collector) {
+
+	constexpr std::size_t LANES = 4;
+	std::size_t i = 1;
+	for (; i + LANES <= pixel_count; i += LANES) {
+		const __m128i current  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgba + i * 4));
+		const __m128i previous = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgba + (i - 1) * 4));
+		const int same = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(current, previous)));
+		for (unsigned changed = ~static_cast<unsigned>(same) & 0xFu; changed != 0; changed &= changed - 1) {
+			if (!collector.add(rgba + (i + static_cast<std::size_t>(std::countr_zero(changed))) * 4)) {
+				return false;
+			}
+		}
+	}
+	return collectColorsScalar(rgba, i, pixel_count, collector);
+}
+
+[[nodiscard]] __attribute__((target("avx2"))) bool collectColorsAvx2(
+	const Byte* rgba, std::size_t pixel_count, PaletteCollector& collector) {
+
+	constexpr std::size_t LANES = 8;
+	std::size_t i = 1;
+	for (; i + LANES <= pixel_count; i += LANES) {
+		const __m256i current  = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rgba + i * 4));
+		const __m256i previous = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rgba + (i - 1) * 4));
+		const int same = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(current, previous)));
+		for (unsigned changed = ~static_cast<unsigned>(same) & 0xFFu; changed != 0; changed &= changed - 1) {
+			if (!collector.add(rgba + (i + static_cast<std::size_t>(std::countr_zero(changed))) * 4)) {
+				return false;
+			}
+		}
+	}
+	return collectColorsScalar(rgba, i, pixel_count, collector);
+}
+
+#endif
+
+// Replaces lodepng_compute_color_stats, which walks every pixel (twice when a
+// colour key is in play) to fill in fields this tool never reads. A cover with
+// too many colours for a palette, a photograph for one, is settled within the
+// first few rows.
+[[nodiscard]] PaletteStats computePaletteStats(std::span<const Byte> rgba) {
+	PaletteStats stats;
+	const std::size_t pixel_count = rgba.size() / 4;
+	if (pixel_count == 0) {
+		return stats;
+	}
+
+	PaletteCollector collector(stats);
+	if (!collector.add(rgba.data())) {
+		return stats;
+	}
+#if PDVRDT_HAS_X86_SIMD
+	if (cpuHasAvx2()) {
+		(void)collectColorsAvx2(rgba.data(), pixel_count, collector);
+	} else {
+		(void)collectColorsSse2(rgba.data(), pixel_count, collector);
+	}
+#else
+	(void)collectColorsScalar(rgba.data(), 1, pixel_count, collector);
+#endif
+	return stats;
+}
+
+// Palette lookup with a one-entry cache in front of the hash: flat artwork is
+// mostly long runs of one colour, and a run costs a compare instead of a probe.
+class RunCachedPaletteLookup {
+	const PaletteIndexTable& table_;
+	std::uint32_t last_key_{};
+	Byte last_index_{};
+	bool primed_{false};
+
+public:
+	explicit RunCachedPaletteLookup(const PaletteIndexTable& table) : table_(table) {}
+
+	[[nodiscard]] bool primed() const { return primed_; }
+	[[nodiscard]] std::uint32_t lastKey() const { return last_key_; }
+	[[nodiscard]] Byte lastIndex() const { return last_index_; }
+
+	// Never false: a colour missing from the palette is an internal error.
+	[[nodiscard]] bool indexOf(std::uint32_t key, std::size_t pixel, Byte& index) {
+		if (primed_ && key == last_key_) {
+			index = last_index_;
+			return true;
+		}
+		if (!table_.find(key, last_index_)) {
+			throw std::runtime_error(std::format(
+				"convertToPalette: Pixel {} has color 0x{:08X} not found in palette.",
+				pixel, key));
+		}
+		last_key_ = key;
+		primed_ = true;
+		index = last_index_;
+		return true;
+	}
+};
+
+// The same run-cached lookup for pixels streamed past before the palette is
+// known: a colour not seen yet is added under the next free index. Indices go
+// out in order of first appearance, the order the palette is written in, so
+// each is final when it is handed out. indexOf() returns false once a colour
+// past MAX_PALETTE_COLORS turns up.
+class FirstSeenPaletteLookup {
+	PaletteIndexTable table_;
+	PaletteStats& stats_;
+	std::uint32_t last_key_{};
+	Byte last_index_{};
+	bool primed_{false};
+
+public:
+	explicit FirstSeenPaletteLookup(PaletteStats& stats) : stats_(stats) {}
+
+	[[nodiscard]] bool primed() const { return primed_; }
+	[[nodiscard]] std::uint32_t lastKey() const { return last_key_; }
+	[[nodiscard]] Byte lastIndex() const { return last_index_; }
+
+	[[nodiscard]] bool indexOf(std::uint32_t key, std::size_t /*pixel*/, Byte& index) {
+		if (primed_ && key == last_key_) {
+			index = last_index_;
+			return true;
+		}
+		if (!table_.find(key, last_index_)) {
+			if (stats_.numcolors == MAX_PALETTE_COLORS) {
+				++stats_.numcolors;
+				return false;
+			}
+			last_index_ = static_cast<Byte>(stats_.numcolors);
+			table_.insertIfAbsent(key, last_index_);
+			Byte* entry = &stats_.palette[stats_.numcolors * 4];
+			entry[0] = static_cast<Byte>(key >> 24);
+			entry[1] = static_cast<Byte>(key >> 16);
+			entry[2] = static_cast<Byte>(key >> 8);
+			entry[3] = static_cast<Byte>(key);
+			++stats_.numcolors;
+		}
+		last_key_ = key;
+		primed_ = true;
+		index = last_index_;
+		return true;
+	}
+};
+
+// Both range mappers stop, returning false, where the lookup gives up.
+template <typename Lookup>
+[[nodiscard]] bool mapPixelRangeScalar(
+	std::span<Byte> indexed_image,
+	const Byte* image,
+	std::size_t first,
+	std::size_t last,
+	std::size_t channels,
+	bool has_alpha,
+	Lookup& lookup) {
+
+	constexpr Byte ALPHA_OPAQUE = 255;
+	for (std::size_t i = first; i < last; ++i) {
+		const Byte* pixel = image + i * channels;
+		const std::uint32_t key = packRgbaKey(pixel[0], pixel[1], pixel[2], has_alpha ? pixel[3] : ALPHA_OPAQUE);
+		if (!lookup.indexOf(key, i, indexed_image[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+#if PDVRDT_HAS_X86_SIMD
+
+// RGBA8 only. One byte shuffle turns eight pixels into eight packRgbaKey keys;
+// a register that repeats the cached colour is written out whole, and any
+// other register falls back to per-lane cached lookups.
+template <typename Lookup>
+[[nodiscard]] __attribute__((target("avx2"))) bool mapRgbaRangeAvx2(
+	std::span<Byte> indexed_image,
+	const Byte* rgba,
+	std::size_t first,
+	std::size_t last,
+	Lookup& lookup) {
+
+	constexpr std::size_t LANES = 8;
+	const __m256i to_key_order = _mm256_setr_epi8(
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+
+	std::size_t i = first;
+	if (i < last && !lookup.primed()) {
+		if (!mapPixelRangeScalar(indexed_image, rgba, i, i + 1, 4, true, lookup)) {
+			return false;
+		}
+		++i;
+	}
+	alignas(32) std::array<std::uint32_t, LANES> keys{};
+	for (; i + LANES <= last; i += LANES) {
+		const __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rgba + i * 4));
+		const __m256i packed = _mm256_shuffle_epi8(pixels, to_key_order);
+		const __m256i cached = _mm256_set1_epi32(static_cast<int>(lookup.lastKey()));
+		if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(packed, cached)) == -1) {
+			std::memset(indexed_image.data() + i, lookup.lastIndex(), LANES);
+			continue;
+		}
+		_mm256_store_si256(reinterpret_cast<__m256i*>(keys.data()), packed);
+		for (std::size_t lane = 0; lane < LANES; ++lane) {
+			if (!lookup.indexOf(keys[lane], i + lane, indexed_image[i + lane])) {
+				return false;
+			}
+		}
+	}
+	return mapPixelRangeScalar(indexed_image, rgba, i, last, 4, true, lookup);
+}
+
+#endif
+
+// Pieces below this many pixels are not worth a hand-off to the pool.
+constexpr std::size_t PARALLEL_MAP_MIN_PIXELS = 1 * 1024 * 1024;
+
 // Map every pixel to its palette index via the compact RGBA hash. Replaces the
 // former direct-LUT (33 MiB) / sorted-binary-search split with a single path;
 // keying on full RGBA also removes the opaque-only restriction the direct path
-// required.
+// required. The table is read-only once built, so large images are split into
+// contiguous pixel ranges (whole rows and then some) mapped on the shared pool,
+// each with its own run cache.
 void mapPixelsToPalette(
 	vBytes& indexed_image,
 	const vBytes& image,
-	const LodePNGColorStats& stats,
+	const PaletteStats& stats,
 	std::size_t palette_size,
 	std::size_t channels,
 	bool has_alpha) {
 
 	constexpr std::size_t RGBA_COMPONENTS = 4;
-	constexpr Byte ALPHA_OPAQUE = 255;
 
 	PaletteIndexTable color_to_index;
 	for (std::size_t i = 0; i < palette_size; ++i) {
@@ -464,22 +770,52 @@ void mapPixelsToPalette(
 		color_to_index.insertIfAbsent(packRgbaKey(src[0], src[1], src[2], src[3]), static_cast<Byte>(i));
 	}
 
-	for (std::size_t i = 0; i < indexed_image.size(); ++i) {
-		const std::size_t offset = i * channels;
-		const std::uint32_t key = packRgbaKey(
-			image[offset],
-			image[offset + 1],
-			image[offset + 2],
-			has_alpha ? image[offset + 3] : ALPHA_OPAQUE
-		);
+	const std::span<Byte> indexed(indexed_image);
+	const auto map_range = [&](std::size_t first, std::size_t last) {
+		RunCachedPaletteLookup lookup(color_to_index);
+#if PDVRDT_HAS_X86_SIMD
+		if (channels == RGBA_COMPONENTS && has_alpha && cpuHasAvx2()) {
+			(void)mapRgbaRangeAvx2(indexed, image.data(), first, last, lookup);
+			return;
+		}
+#endif
+		(void)mapPixelRangeScalar(indexed, image.data(), first, last, channels, has_alpha, lookup);
+	};
+
+	const std::size_t pixel_count = indexed_image.size();
+	ThreadPool& pool = sharedThreadPool();
+	const std::size_t pieces = std::min(pool.size(), pixel_count / PARALLEL_MAP_MIN_PIXELS);
+	if (pieces < 2) {
+		map_range(0, pixel_count);
+		return;
+	}
 
-		Byte palette_index = 0;
-		if (!color_to_index.find(key, palette_index)) {
-			throw std::runtime_error(std::format(
-				"convertToPalette: Pixel {} has color 0x{:08X} not found in palette.",
-				i, key));
+	const std::size_t piece_size = pixel_count / pieces;
+	std::vector<std::future<void>> mapped;
+	mapped.reserve(pieces - 1);
+	for (std::size_t piece = 1; piece < pieces; ++piece) {
+		const std::size_t first = piece * piece_size;
+		const std::size_t last = piece + 1 == pieces ? pixel_count : first + piece_size;
+		mapped.push_back(pool.submit([&map_range, first, last] { map_range(first, last); }));
+	}
+
+	// Every piece is waited for before anything is thrown: they all read the
+	// table and write into indexed_image.
+	std::exception_ptr error{};
+	try {
+		map_range(0, piece_size);
+	} catch (...) {
+		error = std::current_exception();
+	}
+	for (auto& piece : mapped) {
+		try {
+			piece.get();
+		} catch (...) {
+			if (!error) error = std::current_exception();
 		}
-		indexed_image[i] = palette_index;
+	}
+	if (error) {
+		std::rethrow_exception(error);
 	}
 }
 
@@ -488,7 +824,7 @@ void convertToPalette(
 	const vBytes& image,
 	unsigned width,
 	unsigned height,
-	const LodePNGColorStats& stats,
+	const PaletteStats& stats,
 	LodePNGColorType raw_color_type,
 	std::span<const Byte> color_metadata) {
 
@@ -496,8 +832,7 @@ void convertToPalette(
 
 	constexpr std::size_t
 		RGBA_COMPONENTS  = 4,
-		RGB_COMPONENTS   = 3,
-		MAX_PALETTE_SIZE = 256;
+		RGB_COMPONENTS   = 3;
 
 	// Validate color type — this function only handles RGB and RGBA input.
 	if (raw_color_type != LCT_RGB && raw_color_type != LCT_RGBA) {
@@ -511,10 +846,10 @@ void convertToPalette(
 	if (palette_size == 0) {
 		throw std::runtime_error("convertToPalette: Palette is empty.");
 	}
-	if (palette_size > MAX_PALETTE_SIZE) {
+	if (palette_size > MAX_PALETTE_COLORS) {
 		throw std::runtime_error(std::format(
 			"convertToPalette: Palette has {} colors, exceeds maximum of {}.",
-			palette_size, MAX_PALETTE_SIZE));
+			palette_size, MAX_PALETTE_COLORS));
 	}
 
 	const std::size_t channels =
@@ -590,12 +925,7 @@ void stripAndCopyChunks(vBytes& image_file_vec, Byte color_type) {
 	});
 }
 
-[[nodiscard]] DecodedImageForOptimization decodeImageForOptimization(const vBytes& image_file_vec) {
-	lodepng::State state;
-	lodepng_zlib_adapter::configureDecoder(state);
-
-	DecodedImageForOptimization decoded;
-	unsigned error = lodepng::decode(decoded.image, decoded.width, decoded.height, state, image_file_vec);
+[[noreturn]] void throwCoverDecodeError(unsigned error) {
 	if (error == lodepng_zlib_adapter::ERROR_TRAILING_DATA) {
 		// removeExistingPdvrdtIdatChunks() has already dropped any IDAT this tool
 		// wrote, so leftover bytes mean some *other* tool appended one. lodepng
@@ -605,32 +935,421 @@ void stripAndCopyChunks(vBytes& image_file_vec, Byte color_type) {
 			"so its compressed image data does not end where the PNG says it should. "
 			"Re-save the image with a PNG editor and try again.");
 	}
+	throw std::runtime_error(std::format("LodePNG decode error {}: {}", error, lodepng_error_text(error)));
+}
+
+// lodepng error codes the lazy validation below reproduces, as the vendored
+// lodepng (LODEPNG_VERSION_STRING "20260119") returns them from decodeGeneric()
+// and its readChunk_PLTE() and readChunk_tRNS(). Recheck them when lodepng is
+// updated.
+constexpr unsigned
+	LODEPNG_ERROR_ZLIB             = 52,
+	LODEPNG_ERROR_BAD_FILTER       = 36,
+	LODEPNG_ERROR_PALETTE_SIZE     = 38,
+	LODEPNG_ERROR_TRNS_PALETTE     = 39,
+	LODEPNG_ERROR_TRNS_GREY        = 30,
+	LODEPNG_ERROR_TRNS_RGB         = 41,
+	LODEPNG_ERROR_TRNS_COLOR_TYPE  = 42,
+	LODEPNG_ERROR_CRITICAL_CHUNK   = 69,
+	LODEPNG_ERROR_IDAT_SIZE        = 91,
+	LODEPNG_ERROR_MISSING_PLTE     = 106,
+	LODEPNG_ERROR_CHUNK_NAME       = 121,
+	LODEPNG_ERROR_RESERVED_CHUNK   = 122;
+
+[[nodiscard]] constexpr bool isAsciiLetter(std::uint32_t c) {
+	return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+}
+
+// The per-chunk rules lodepng's decode applies beyond the structural walk, with
+// ancillary chunk parsing compiled out. Mirrors lodepng 20260119: PLTE and tRNS
+// are checked as readChunk_PLTE() and readChunk_tRNS() check them, and anything
+// else must have a well-formed name and be ancillary, as decodeGeneric()'s
+// chunk loop requires. `palette_size` carries the PLTE entry count forward for
+// tRNS, as lodepng does.
+[[nodiscard]] unsigned checkChunkForDecode(const PngChunkView& chunk, Byte color_type, std::size_t& palette_size) {
+	constexpr std::size_t MAX_PALETTE_ENTRIES = 256;
+	switch (chunk.type) {
+		case TYPE_IDAT:
+		case TYPE_IEND:
+			return 0;
+		case TYPE_PLTE:
+			palette_size = chunk.length / 3;
+			return (palette_size == 0 || palette_size > MAX_PALETTE_ENTRIES) ? LODEPNG_ERROR_PALETTE_SIZE : 0;
+		case TYPE_TRNS:
+			switch (color_type) {
+				case INDEXED_PLTE:  return chunk.length > palette_size ? LODEPNG_ERROR_TRNS_PALETTE : 0;
+				case 0:             return chunk.length != 2 ? LODEPNG_ERROR_TRNS_GREY : 0;
+				case TRUECOLOR_RGB: return chunk.length != 6 ? LODEPNG_ERROR_TRNS_RGB : 0;
+				default:            return LODEPNG_ERROR_TRNS_COLOR_TYPE;
+			}
+		default:
+			break;
+	}
+
+	constexpr std::uint32_t
+		ANCILLARY_BIT = 0x20000000u,
+		RESERVED_BIT  = 0x00002000u;
+	for (int shift = 24; shift >= 0; shift -= 8) {
+		if (!isAsciiLetter((chunk.type >> shift) & 0xFFu)) {
+			return LODEPNG_ERROR_CHUNK_NAME;
+		}
+	}
+	if ((chunk.type & RESERVED_BIT) != 0) {
+		return LODEPNG_ERROR_RESERVED_CHUNK;
+	}
+	return (chunk.type & ANCILLARY_BIT) == 0 ? LODEPNG_ERROR_CRITICAL_CHUNK : 0;
+}
+
+// Inflates the IDAT stream, chunk by chunk where it lies, through a small window,
+// checking what the full decode would: a well-formed zlib stream (Adler-32
+// included) with nothing after it, exactly the inflated size IHDR declares, and
+// a valid filter type at the start of every row. Each whole row, filter byte
+// first, goes to `on_row` for as long as it returns true; after that, or when
+// it is nullptr, the rows are only checked and the window is thrown away.
+template <typename OnRow>
+[[nodiscard]] unsigned inflateScanlines(
+	std::span<const std::span<const Byte>> idat_data,
+	std::span<const ScanlineRun> runs,
+	std::size_t inflated_size,
+	OnRow&& on_row) {
+
+	constexpr std::size_t WINDOW_SIZE = 256 * 1024;
+	constexpr Byte MAX_FILTER_TYPE = 4;
+	constexpr bool WANTS_ROWS = !std::is_null_pointer_v<std::remove_cvref_t<OnRow>>;
+
+	struct InflateStream {
+		z_stream strm{};
+		InflateStream() {
+			if (inflateInit(&strm) != Z_OK) throw std::runtime_error("zlib inflateInit failed.");
+		}
+		~InflateStream() { inflateEnd(&strm); }
+		InflateStream(const InflateStream&) = delete;
+		InflateStream& operator=(const InflateStream&) = delete;
+	} stream;
+	z_stream& strm = stream.strm;
+	vBytes window(WINDOW_SIZE);
+
+	// A row can straddle two windows, so rows being handed on are gathered here.
+	vBytes row;
+	bool delivering = WANTS_ROWS;
+	if (delivering) {
+		std::size_t max_row_size = 0;
+		for (const ScanlineRun& run : runs) {
+			max_row_size = std::max(max_row_size, run.row_size);
+		}
+		row.resize(max_row_size);
+	}
+
+	// Position within the current row, stepped row by row through the runs as
+	// the window passes over it.
+	std::size_t run_index = 0;
+	std::size_t rows_left = runs.empty() ? 0 : runs.front().rows;
+	std::size_t row_filled = 0;
+	std::size_t total = 0;
+	bool stream_end = false;
+
+	for (const std::span<const Byte> data : idat_data) {
+		// A chunk length is at most 2^31 - 1, so one chunk always fits uInt.
+		strm.next_in = const_cast<Bytef*>(data.data());
+		strm.avail_in = static_cast<uInt>(data.size());
+		do {
+			if (stream_end) {
+				if (strm.avail_in != 0) {
+					return lodepng_zlib_adapter::ERROR_TRAILING_DATA;
+				}
+				break;
+			}
+			strm.next_out = window.data();
+			strm.avail_out = static_cast<uInt>(window.size());
+			const int ret = inflate(&strm, Z_NO_FLUSH);
+			if (ret == Z_STREAM_END) {
+				stream_end = true;
+			} else if ((ret != Z_OK && ret != Z_BUF_ERROR) || (ret == Z_BUF_ERROR && strm.avail_in != 0)) {
+				return LODEPNG_ERROR_ZLIB;
+			}
+
+			const std::size_t produced = window.size() - strm.avail_out;
+			if (produced > inflated_size - total) {
+				return LODEPNG_ERROR_ZLIB;  // As the one-shot decode: more than IHDR allows.
+			}
+			// Within the inflated size, so every byte belongs to some row.
+			std::span<const Byte> pending(window.data(), produced);
+			while (!pending.empty()) {
+				const std::size_t row_size = runs[run_index].row_size;
+				if (row_filled == 0 && pending.front() > MAX_FILTER_TYPE) {
+					return LODEPNG_ERROR_BAD_FILTER;
+				}
+				const std::size_t take = std::min(pending.size(), row_size - row_filled);
+				if (delivering) {
+					std::memcpy(row.data() + row_filled, pending.data(), take);
+				}
+				pending = pending.subspan(take);
+				row_filled += take;
+				if (row_filled < row_size) {
+					break;
+				}
+				if constexpr (WANTS_ROWS) {
+					if (delivering) {
+						delivering = on_row(std::span<const Byte>(row.data(), row_size));
+					}
+				}
+				row_filled = 0;
+				if (--rows_left == 0 && ++run_index < runs.size()) {
+					rows_left = runs[run_index].rows;
+				}
+			}
+			total += produced;
+		} while (strm.avail_in != 0 || strm.avail_out == 0);
+	}
+
+	if (!stream_end) {
+		return LODEPNG_ERROR_ZLIB;
+	}
+	return total == inflated_size ? 0 : LODEPNG_ERROR_IDAT_SIZE;
+}
+
+// The image data of a cover, left where it lies in the file.
+struct CoverImageData {
+	std::vector<std::span<const Byte>> idat{};
+	std::span<const Byte> trns{};
+};
+
+// Walks the chunks the way lodepng's decode does, rejecting what it would with
+// the same codes, and gathers the IDAT data without concatenating it.
+[[nodiscard]] CoverImageData collectCoverImageData(std::span<const Byte> png, const CoverImageHeader& header) {
+	const PngChunkView ihdr = readRequiredIhdr(png);
+	CoverImageData image_data;
+	std::size_t palette_size = 0;
+	unsigned error = 0;
+
+	forEachChunkToIend(png, ihdr.offset + ihdr.total_size, [&](const PngChunkView& chunk) {
+		if (error == 0) {
+			error = checkChunkForDecode(chunk, header.color_type, palette_size);
+		}
+		if (chunk.type == TYPE_IDAT) {
+			image_data.idat.push_back(chunk.data);
+		} else if (chunk.type == TYPE_TRNS) {
+			image_data.trns = chunk.data;
+		}
+	});
+	if (error == 0 && header.color_type == INDEXED_PLTE && palette_size == 0) {
+		error = LODEPNG_ERROR_MISSING_PLTE;
+	}
+	if (error) {
+		throwCoverDecodeError(error);
+	}
+	return image_data;
+}
+
+// Stands in for the full decode when the optimizer will not rewrite the cover:
+// rejects exactly the image data lodepng would, with the same codes, but never
+// unfilters it or materialises pixels.
+void validateCoverWithoutDecode(std::span<const Byte> png, const CoverImageHeader& header) {
+	const CoverImageData image_data = collectCoverImageData(png, header);
+	const unsigned error = inflateScanlines(image_data.idat, header.scanlines, header.inflated_size, nullptr);
+	if (error) {
+		throwCoverDecodeError(error);
+	}
+}
+
+void appendChunk(vBytes& png, std::uint32_t type, std::span<const Byte> data) {
+	constexpr std::size_t MAX_CHUNK_DATA_SIZE = 0x7FFFFFFFu;
+	if (data.size() > MAX_CHUNK_DATA_SIZE) {
+		throw std::runtime_error("PNG Error: Chunk data exceeds the PNG chunk size limit.");
+	}
+	std::array<Byte, 8> length_and_type{};
+	std::array<Byte, 4> crc{};
+	updateValue(length_and_type, 0, static_cast<std::uint32_t>(data.size()));
+	updateValue(length_and_type, 4, type);
+	updateValue(crc, 0, pdvrdtCrc32Update(pdvrdtCrc32Update(0, std::span<const Byte>(length_and_type).subspan(4)), data));
+	appendBytes(png, length_and_type, "PNG Error: Encoded image size overflow.");
+	appendBytes(png, data, "PNG Error: Encoded image size overflow.");
+	appendBytes(png, crc, "PNG Error: Encoded image size overflow.");
+}
+
+// The palettized rows, each with its filter byte, deflated in one whole-buffer
+// call by the compressor the lodepng encoder is configured with
+// (lodepng_zlib_adapter::compress, libdeflate level 6), so the IDAT is what
+// lodepng's encode of the same rows would write. Only the indexed rows are
+// held, a byte per pixel.
+class RowDeflater {
+	vBytes rows_;
+
+public:
+	void write(std::span<const Byte> row) {
+		appendBytes(rows_, row, "PNG Error: Encoded image size overflow.");
+	}
+
+	[[nodiscard]] vBytes finish() {
+		unsigned char* out = nullptr;
+		std::size_t out_size = 0;
+		const unsigned error = lodepng_zlib_adapter::compress(&out, &out_size, rows_.data(), rows_.size(), nullptr);
+		const std::unique_ptr<unsigned char, decltype(&std::free)> owned(out, &std::free);
+		if (error) {
+			throw std::runtime_error(std::format("LodePNG encode error: {}", error));
+		}
+		return vBytes(out, out + out_size);
+	}
+};
+
+// Rebuilds a non-interlaced 8-bit RGB/RGBA cover of at most MAX_PALETTE_COLORS
+// colours as an 8-bit indexed PNG in a single pass over its IDAT data. Each row
+// is inflated out of the chunks where they lie, unfiltered against the row
+// above and numbered through FirstSeenPaletteLookup into a filter-0 palette
+// row, so at most two rows of pixels are ever held; the palette rows, a byte
+// per pixel, are deflated once at the end. lodepng's decode would fill the
+// RGBA image first, and its encode would copy it twice more.
+//
+// The first colour past the limit settles it: the rest of the stream is only
+// checked, as validateCoverWithoutDecode() would, and false is returned with
+// the cover untouched. Errors are lodepng's, as for the full decode.
+[[nodiscard]] bool palettizeCoverByRows(vBytes& image_file_vec, const CoverImageHeader& header) {
+	constexpr Byte
+		PALETTE_BIT_DEPTH   = 8,
+		FILTER_NONE         = 0,
+		ALPHA_OPAQUE        = 255,
+		ALPHA_TRANSPARENT   = 0;
+
+	constexpr std::size_t
+		RGBA_COMPONENTS     = 4,
+		RGB_COMPONENTS      = 3,
+		RGB_TRNS_SIZE       = 6;
+
+	if (header.interlaced || header.bit_depth != 8 ||
+		(header.color_type != TRUECOLOR_RGB && header.color_type != TRUECOLOR_RGBA)) {
+		throw std::runtime_error("Image Error: Row palettizer needs a non-interlaced 8-bit truecolor image.");
+	}
+
+	const CoverImageData image_data = collectCoverImageData(image_file_vec, header);
+
+	// An RGB tRNS colour key holds 16-bit samples; as in lodepng, one with a
+	// high byte set can never match an 8-bit pixel.
+	const std::span<const Byte> trns = image_data.trns;
+	const bool has_color_key =
+		header.color_type == TRUECOLOR_RGB && trns.size() == RGB_TRNS_SIZE &&
+		trns[0] == 0 && trns[2] == 0 && trns[4] == 0;
+	const std::array<Byte, 3> color_key = has_color_key
+		? std::array<Byte, 3>{trns[1], trns[3], trns[5]}
+		: std::array<Byte, 3>{};
+
+	const std::size_t width = header.width;
+	const std::size_t channels = header.color_type == TRUECOLOR_RGBA ? RGBA_COMPONENTS : RGB_COMPONENTS;
+	const std::size_t row_bytes = width * channels;  // Checked against the decode limit by preflight.
+
+	vBytes previous(row_bytes);
+	vBytes current(row_bytes);
+	vBytes rgba(channels == RGB_COMPONENTS ? width * RGBA_COMPONENTS : 0);
+	vBytes indexed_row(width + 1, FILTER_NONE);
+	const std::span<Byte> indices = std::span<Byte>(indexed_row).subspan(1);
+
+	PaletteStats stats;
+	FirstSeenPaletteLookup lookup(stats);
+	RowDeflater deflater;
+	bool palettizable = true;
+
+	const auto palettize_row = [&](std::span<const Byte> filtered) {
+		// The filter type was checked by inflateScanlines(). Above the first row
+		// `previous` is still all zeros, as PNG defines it.
+		(void)pdvrdtUnfilterScanline(current.data(), filtered.data() + 1, previous.data(), channels, filtered[0], row_bytes);
+		const Byte* pixels = current.data();
+		if (channels == RGB_COMPONENTS) {
+			for (std::size_t i = 0; i < width; ++i) {
+				const Byte* rgb = &current[i * RGB_COMPONENTS];
+				Byte* out = &rgba[i * RGBA_COMPONENTS];
+				std::memcpy(out, rgb, RGB_COMPONENTS);
+				out[3] = (has_color_key && std::memcmp(rgb, color_key.data(), RGB_COMPONENTS) == 0)
+					? ALPHA_TRANSPARENT
+					: ALPHA_OPAQUE;
+			}
+			pixels = rgba.data();
+		}
+#if PDVRDT_HAS_X86_SIMD
+		palettizable = cpuHasAvx2()
+			? mapRgbaRangeAvx2(indices, pixels, 0, width, lookup)
+			: mapPixelRangeScalar(indices, pixels, 0, width, RGBA_COMPONENTS, true, lookup);
+#else
+		palettizable = mapPixelRangeScalar(indices, pixels, 0, width, RGBA_COMPONENTS, true, lookup);
+#endif
+		if (!palettizable) {
+			return false;
+		}
+		deflater.write(indexed_row);
+		std::swap(previous, current);
+		return true;
+	};
+
+	const unsigned error = inflateScanlines(image_data.idat, header.scanlines, header.inflated_size, palettize_row);
+	if (error) {
+		throwCoverDecodeError(error);
+	}
+	if (!palettizable) {
+		return false;
+	}
+	const vBytes compressed = deflater.finish();
+
+	// Laid out as lodepng's encode of the same image: IHDR, the preserved colour
+	// metadata, PLTE, tRNS without its run of opaque entries at the end, IDAT.
+	std::array<Byte, IHDR_DATA_SIZE> ihdr{};
+	updateValue(ihdr, 0, header.width);
+	updateValue(ihdr, 4, header.height);
+	ihdr[8] = PALETTE_BIT_DEPTH;
+	ihdr[9] = INDEXED_PLTE;
+
+	vBytes palette;
+	vBytes alpha;
+	palette.reserve(stats.numcolors * RGB_COMPONENTS);
+	alpha.reserve(stats.numcolors);
+	for (std::size_t i = 0; i < stats.numcolors; ++i) {
+		const Byte* entry = &stats.palette[i * RGBA_COMPONENTS];
+		palette.insert(palette.end(), entry, entry + RGB_COMPONENTS);
+		alpha.push_back(entry[3]);
+	}
+	while (!alpha.empty() && alpha.back() == ALPHA_OPAQUE) {
+		alpha.pop_back();
+	}
+
+	const PreservedColorMetadata color_metadata = collectColorMetadata(
+		image_file_vec,
+		header.color_type == TRUECOLOR_RGBA
+	);
+
+	vBytes output;
+	appendBytes(output, std::span<const Byte>(image_file_vec).first(PNG_HEADER_SIZE), "PNG Error: Encoded image size overflow.");
+	appendChunk(output, TYPE_IHDR, ihdr);
+	appendBytes(output, color_metadata.chunks, "PNG Error: Encoded image size overflow.");
+	appendChunk(output, TYPE_PLTE, palette);
+	if (!alpha.empty()) {
+		appendChunk(output, TYPE_TRNS, alpha);
+	}
+	appendChunk(output, TYPE_IDAT, compressed);
+	appendChunk(output, TYPE_IEND, {});
+	image_file_vec = std::move(output);
+	return true;
+}
+
+[[nodiscard]] DecodedImageForOptimization decodeImageForOptimization(
+	const vBytes& image_file_vec,
+	std::size_t inflated_size) {
+
+	const lodepng_zlib_adapter::DecodeSizeHint size_hint{inflated_size};
+	lodepng::State state;
+	lodepng_zlib_adapter::configureDecoder(state, &size_hint);
+
+	DecodedImageForOptimization decoded;
+	unsigned error = lodepng::decode(decoded.image, decoded.width, decoded.height, state, image_file_vec);
 	if (error) {
-		throw std::runtime_error(std::format("LodePNG decode error {}: {}", error, lodepng_error_text(error)));
+		throwCoverDecodeError(error);
 	}
 
-	lodepng_color_stats_init(&decoded.stats);
 	decoded.png_color_type = static_cast<Byte>(state.info_png.color.colortype);
 	decoded.png_bit_depth  = static_cast<Byte>(state.info_png.color.bitdepth);
 	decoded.raw_color_type = state.info_raw.colortype;
 
-	const bool can_use_rgba8_stats =
-		decoded.png_bit_depth == 8 &&
-		(decoded.png_color_type == TRUECOLOR_RGB || decoded.png_color_type == TRUECOLOR_RGBA);
-	if (can_use_rgba8_stats) {
-		decoded.stats.allow_palette   = 1;
-		decoded.stats.allow_greyscale = 0;
-		error = lodepng_compute_color_stats(
-			&decoded.stats,
-			decoded.image.data(),
-			decoded.width,
-			decoded.height,
-			&state.info_raw
-		);
-		if (error) {
-			throw std::runtime_error(std::format("LodePNG stats error: {}", error));
-		}
+	// lodepng's default raw mode is RGBA8, the layout computePaletteStats reads.
+	if (decoded.raw_color_type != LCT_RGBA || state.info_raw.bitdepth != 8) {
+		throw std::runtime_error("Image Error: Unexpected decoded pixel format.");
 	}
+	decoded.stats = computePaletteStats(decoded.image);
 	return decoded;
 }
 
@@ -647,40 +1366,49 @@ bool optimizeImage(vBytes& image_file_vec) {
 		MAX_RGB_DIMS   = 900,
 		MIN_RGB_COLORS = 257;
 
-	preflightPngDecode(image_file_vec);
+	const CoverImageHeader header = preflightPngDecode(image_file_vec);
 	removeExistingPdvrdtIdatChunks(image_file_vec);
 
-	const DecodedImageForOptimization decoded = decodeImageForOptimization(image_file_vec);
-	const Byte color_type = decoded.png_color_type;
+	const Byte color_type = header.color_type;
 	const bool is_truecolor = (color_type == TRUECOLOR_RGB || color_type == TRUECOLOR_RGBA);
 	// Palette entries are 8-bit samples. Statistics from LodePNG's default RGBA8
 	// decode cannot distinguish 16-bit values that share the same high byte, so
 	// never use them to rewrite a 16-bit source.
-	const bool can_palettize =
-		is_truecolor &&
-		decoded.png_bit_depth == 8 &&
-		(decoded.stats.numcolors < MIN_RGB_COLORS);
-
-	if (can_palettize) {
-		const PreservedColorMetadata color_metadata = collectColorMetadata(
-			image_file_vec,
-			color_type == TRUECOLOR_RGBA
-		);
-		convertToPalette(
-			image_file_vec,
-			decoded.image,
-			decoded.width,
-			decoded.height,
-			decoded.stats,
-			decoded.raw_color_type,
-			color_metadata.chunks
-		);
-		return hasUnsupportedShareDimensions(decoded.width, decoded.height, MAX_PLTE_DIMS);
+	const bool may_palettize = is_truecolor && header.bit_depth == 8;
+
+	if (may_palettize && !header.interlaced) {
+		if (palettizeCoverByRows(image_file_vec, header)) {
+			return hasUnsupportedShareDimensions(header.width, header.height, MAX_PLTE_DIMS);
+		}
+	} else if (may_palettize) {
+		// Adam7 passes are not rows of the image, so an interlaced cover is
+		// decoded whole.
+		const DecodedImageForOptimization decoded = decodeImageForOptimization(image_file_vec, header.inflated_size);
+		if (decoded.stats.numcolors < MIN_RGB_COLORS) {
+			const PreservedColorMetadata color_metadata = collectColorMetadata(
+				image_file_vec,
+				color_type == TRUECOLOR_RGBA
+			);
+			convertToPalette(
+				image_file_vec,
+				decoded.image,
+				decoded.width,
+				decoded.height,
+				decoded.stats,
+				decoded.raw_color_type,
+				color_metadata.chunks
+			);
+			return hasUnsupportedShareDimensions(decoded.width, decoded.height, MAX_PLTE_DIMS);
+		}
+	} else {
+		// Indexed, greyscale and 16-bit covers are kept as they are, so the
+		// pixels are never needed: only confirm that they would decode.
+		validateCoverWithoutDecode(image_file_vec, header);
 	}
 
 	const uint16_t max_dim = (color_type == INDEXED_PLTE) ? MAX_PLTE_DIMS : MAX_RGB_DIMS;
 	stripAndCopyChunks(image_file_vec, color_type);
-	return hasUnsupportedShareDimensions(decoded.width, decoded.height, max_dim);
+	return hasUnsupportedShareDimensions(header.width, header.height, max_dim);
 }
 
 void prepareImageForMastodonEmbedding(vBytes& image_file_vec) {
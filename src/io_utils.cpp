@@ -74,6 +74,27 @@ void requireFileTypeConstraints(const fs::path& path, std::size_t file_size, Fil
 	return std::runtime_error(std::format(
 		"Error: Unable to open file \"{}\": {}.", path.string(), ec.message()));
 }
+[[nodiscard]] ssize_t preadRetry(int fd, Byte* buffer, std::size_t size, std::size_t offset) {
+	if (offset > static_cast<std::size_t>(std::numeric_limits<off_t>::max())) {
+		throw std::runtime_error("Failed to read input file: offset exceeds platform limit.");
+	}
+	while (true) {
+		const ssize_t rc = ::pread(
+			fd,
+			buffer,
+			size,
+			static_cast<off_t>(offset)
+		);
+		if (rc < 0 && errno == EINTR) continue;
+		return rc;
+	}
+}
+
+[[noreturn]] void throwReadError() {
+	const std::error_code ec(errno, std::generic_category());
+	throw std::runtime_error(std::format("Failed to read input file: {}", ec.message()));
+}
+
 } // namespace
 
 namespace {
@@ -259,6 +280,25 @@ void fsyncFdOrThrow(int fd) {
 	}
 }
 
+void preallocateFd(int fd, std::size_t size) {
+	if (fd < 0) {
+		throw std::invalid_argument("preallocateFd: valid descriptor is required.");
+	}
+	if (size == 0) return;
+	if (size > static_cast<std::size_t>(std::numeric_limits<off_t>::max())) {
+		throw std::runtime_error("Write File Error: Output file is too large.");
+	}
+	// posix_fallocate reports failure through its return value, not errno.
+	int rc = 0;
+	while ((rc = ::posix_fallocate(fd, 0, static_cast<off_t>(size))) == EINTR) {}
+	if (rc == 0 || rc == EOPNOTSUPP || rc == EINVAL) {
+		return;
+	}
+	const std::error_code ec(rc, std::generic_category());
+	throw std::runtime_error(std::format(
+		"Write File Error: Unable to reserve space for output file: {}", ec.message()));
+}
+
 void fsyncParentDirectoryNoThrow(const fs::path& path) noexcept {
 	const fs::path parent = path.has_parent_path() ? path.parent_path() : fs::path(".");
 	const int dir_fd = ::open(parent.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
@@ -268,6 +308,34 @@ void fsyncParentDirectoryNoThrow(const fs::path& path) noexcept {
 	::close(dir_fd);
 }
 
+void readExactAt(int fd, Byte* buffer, std::size_t size, std::size_t offset) {
+	std::size_t done = 0;
+	while (done < size) {
+		const std::size_t chunk_size = std::min<std::size_t>(
+			size - done,
+			static_cast<std::size_t>(std::numeric_limits<ssize_t>::max())
+		);
+		const ssize_t rc = preadRetry(
+			fd,
+			buffer + static_cast<std::ptrdiff_t>(done),
+			chunk_size,
+			checkedAddSize(offset, done, "Failed to read input file: offset overflow.")
+		);
+		if (rc < 0) throwReadError();
+		if (rc == 0) throw std::runtime_error("Failed to read full file: partial read");
+		done += static_cast<std::size_t>(rc);
+	}
+}
+
+void verifyExpectedEof(int fd, std::size_t expected_size) {
+	Byte extra{};
+	const ssize_t rc = preadRetry(fd, &extra, 1, expected_size);
+	if (rc < 0) throwReadError();
+	if (rc != 0) {
+		throw std::runtime_error("Failed to read file reliably: file grew while being read.");
+	}
+}
+
 void writeAllToFd(int fd, std::span<const Byte> data) {
 	std::size_t written = 0;
 	while (written < data.size()) {
@@ -286,6 +354,28 @@ void writeAllToFd(int fd, std::span<const Byte> data) {
 	}
 }
 
+void pwriteAllToFd(int fd, std::span<const Byte> data, std::size_t offset) {
+	std::size_t written = 0;
+	while (written < data.size()) {
+		const std::size_t remaining = data.size() - written;
+		const std::size_t chunk_size = std::min<std::size_t>(remaining, static_cast<std::size_t>(std::numeric_limits<ssize_t>::max()));
+		const std::size_t position = checkedAddSize(offset, written, "Write Error: Output offset overflow.");
+		if (position > static_cast<std::size_t>(std::numeric_limits<off_t>::max())) {
+			throw std::runtime_error("Write Error: Output offset exceeds platform limit.");
+		}
+		const ssize_t rc = ::pwrite(fd, data.data() + static_cast<std::ptrdiff_t>(written), chunk_size, static_cast<off_t>(position));
+		if (rc < 0) {
+			if (errno == EINTR) continue;
+			const std::error_code ec(errno, std::generic_category());
+			throw std::runtime_error(std::format("Write Error: Failed to write complete output file: {}", ec.message()));
+		}
+		if (rc == 0) {
+			throw std::runtime_error("Write Error: Failed to write complete output file.");
+		}
+		written += static_cast<std::size_t>(rc);
+	}
+}
+
 void cleanupPathNoThrow(const fs::path& path) noexcept {
 	if (path.empty()) return;
 	std::error_code ec;
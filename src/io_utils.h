@@ -37,7 +37,7 @@ private:
 
 // Largest cover image conceal mode will accept, in bytes. Reported by --info and
 // named in the rejection message so the rule is discoverable before it bites.
-inline constexpr std::size_t MAX_COVER_IMAGE_SIZE = 8ULL * 1024 * 1024;
+inline constexpr std::size_t MAX_COVER_IMAGE_SIZE = 64ULL * 1024 * 1024;
 
 [[nodiscard]] bool hasValidFilename(const fs::path& p);
 // hasValidFilename plus the reserved-name rules used for embedded/recovered
@@ -103,5 +103,18 @@ void fsyncFdOrThrow(int fd);
 // quirk, not a sign that the data is at risk, and must not fail an operation
 // that has otherwise fully succeeded.
 void fsyncParentDirectoryNoThrow(const fs::path& path) noexcept;
+// Fill `buffer` with exactly `size` bytes of `fd` starting at `offset`, leaving
+// the file offset untouched.
+void readExactAt(int fd, Byte* buffer, std::size_t size, std::size_t offset);
+// Throws if `fd` has grown past the size it was validated at.
+void verifyExpectedEof(int fd, std::size_t expected_size);
+// Reserve `size` bytes of disk for `fd` up front, so a destination that cannot
+// hold the output fails before the work starts rather than part way through,
+// and the file is laid out in one piece. A filesystem that cannot preallocate
+// is not an error: the writes then allocate as they go.
+void preallocateFd(int fd, std::size_t size);
 void writeAllToFd(int fd, std::span<const Byte> data);
+// Positional counterpart of writeAllToFd for patching bytes already written;
+// leaves the file offset where it was.
+void pwriteAllToFd(int fd, std::span<const Byte> data, std::size_t offset);
 void cleanupPathNoThrow(const fs::path& path) noexcept;
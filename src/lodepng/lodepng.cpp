@@ -4656,7 +4656,12 @@ static unsigned unfilter(unsigned char* out, const unsigned char* in, unsigned w
     size_t inindex = (1 + linebytes) * y; /*the extra filterbyte added to each row*/
     unsigned char filterType = in[inindex];
 
+#ifdef LODEPNG_UNFILTER_SCANLINE
+    /*the embedding build supplies its own unfilterScanline, with the same contract*/
+    CERROR_TRY_RETURN(LODEPNG_UNFILTER_SCANLINE(&out[outindex], &in[inindex + 1], prevline, bytewidth, filterType, linebytes));
+#else
     CERROR_TRY_RETURN(unfilterScanline(&out[outindex], &in[inindex + 1], prevline, bytewidth, filterType, linebytes));
+#endif
 
     prevline = &out[outindex];
   }
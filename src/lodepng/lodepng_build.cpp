@@ -3,9 +3,18 @@
 // Compile this file instead of lodepng/lodepng.cpp directly.
 
 #include "lodepng_config.h"
+#include "../png_utils.h"
+
+// Route lodepng's per-row unfilter to the runtime-dispatched SIMD kernels in
+// lodepng_unfilter.cpp. The vendored scalar unfilterScanline() is still compiled
+// here but is dead code, left unreferenced and hidden by the -Wunused-function
+// pragma below. unfilter_kernel_test.cpp does not use this copy: it includes its
+// own lodepng.cpp, built without this define, as the reference.
+#define LODEPNG_UNFILTER_SCANLINE pdvrdtUnfilterScanline
 
 // Suppress warnings from vendored third-party code.
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wconversion"
+#pragma GCC diagnostic ignored "-Wunused-function"
 #include "lodepng.cpp"
 #pragma GCC diagnostic pop
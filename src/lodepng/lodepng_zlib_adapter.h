@@ -160,14 +160,74 @@ inline unsigned decompressZlibStreaming(
 	return 0;
 }
 
+// Exact inflated size of the image data being decoded, which the caller derives
+// from IHDR (filter bytes and Adam7 passes included) and hands over through
+// LodePNGDecompressSettings::custom_context. With it the decode is a single
+// libdeflate call into a buffer of exactly that size.
+struct DecodeSizeHint {
+	size_t inflated_size;
+};
+
+// One libdeflate decompressor per thread, reused by every call on that thread.
+// It holds only scratch tables that each call rebuilds, so reuse needs no reset.
+// A failed allocation is retried on the next call; until then callers fall back
+// to the streaming inflate.
+inline libdeflate_decompressor* cachedDecompressor() {
+	struct Holder {
+		libdeflate_decompressor* decompressor{nullptr};
+		~Holder() {
+			if (decompressor) libdeflate_free_decompressor(decompressor);
+		}
+	};
+	thread_local Holder holder;
+	if (!holder.decompressor) {
+		holder.decompressor = libdeflate_alloc_decompressor();
+	}
+	return holder.decompressor;
+}
+
+// One-shot decode into a buffer of the hinted size. A stream that inflates to
+// more than IHDR declares cannot be a valid image, so running out of space is a
+// plain error. A shorter one is handed back as is, and lodepng reports the size
+// mismatch itself.
+inline unsigned decompressExact(
+	libdeflate_decompressor* decompressor,
+	unsigned char** out, size_t* outsize,
+	const unsigned char* in, size_t insize,
+	size_t inflated_size) {
+
+	if (inflated_size > MAX_DECOMPRESS_SIZE) {
+		return 52;
+	}
+	auto* buf = static_cast<unsigned char*>(malloc(inflated_size ? inflated_size : 1));
+	if (!buf) return 83;
+
+	size_t actual_in = 0;
+	size_t actual_out = 0;
+	const libdeflate_result result = libdeflate_zlib_decompress_ex(
+		decompressor, in, insize, buf, inflated_size, &actual_in, &actual_out);
+	if (result != LIBDEFLATE_SUCCESS) {
+		free(buf);
+		return 52;
+	}
+	if (actual_in != insize) {
+		free(buf);
+		return ERROR_TRAILING_DATA;
+	}
+	*out = buf;
+	*outsize = actual_out;
+	return 0;
+}
+
 // Decompress callback for lodepng (zlib format: header + deflate + adler32).
 // Fast path: libdeflate whole-buffer decompress, substantially faster than zlib
 // inflate. libdeflate is non-streaming and needs the output buffer sized up
-// front, but the zlib format carries no uncompressed-size field, so we estimate.
-// If the estimate is too small we fall back to the streaming inflate above
-// (never re-decompressing). Over-estimation is virtual memory (lazily committed),
-// so only the bytes libdeflate actually writes are paged in. This mirrors the
-// "libdeflate fast path + zlib fallback" split used in compression.cpp.
+// front. Given a DecodeSizeHint that size is exact; otherwise, since the zlib
+// format carries no uncompressed-size field, we estimate. If the estimate is too
+// small we fall back to the streaming inflate above (never re-decompressing).
+// Over-estimation is virtual memory (lazily committed), so only the bytes
+// libdeflate actually writes are paged in. This mirrors the "libdeflate fast
+// path + zlib fallback" split used in compression.cpp.
 inline unsigned decompress(
 	unsigned char** out, size_t* outsize,
 	const unsigned char* in, size_t insize,
@@ -179,17 +239,22 @@ inline unsigned decompress(
 	*out = nullptr;
 	*outsize = 0;
 
+	libdeflate_decompressor* decompressor = cachedDecompressor();
+	const auto* hint = settings ? static_cast<const DecodeSizeHint*>(settings->custom_context) : nullptr;
+	if (decompressor && hint) {
+		return decompressExact(decompressor, out, outsize, in, insize, hint->inflated_size);
+	}
+
 	const size_t cap = (insize <= (MAX_DECOMPRESS_SIZE - 1024) / 4)
 		? insize * 4 + 1024
 		: MAX_DECOMPRESS_SIZE;
 
-	if (libdeflate_decompressor* decompressor = libdeflate_alloc_decompressor()) {
+	if (decompressor) {
 		if (auto* buf = static_cast<unsigned char*>(malloc(cap))) {
 			size_t actual_in = 0;
 			size_t actual_out = 0;
 			const libdeflate_result result = libdeflate_zlib_decompress_ex(
 				decompressor, in, insize, buf, cap, &actual_in, &actual_out);
-			libdeflate_free_decompressor(decompressor);
 
 			if (result == LIBDEFLATE_SUCCESS) {
 				// Require the whole input to be a single zlib stream with no
@@ -213,8 +278,6 @@ inline unsigned decompress(
 				return 52;  // corrupt/short stream — a real error, not an estimate miss
 			}
 			// Estimate too small: fall through to the streaming inflate.
-		} else {
-			libdeflate_free_decompressor(decompressor);
 		}
 	}
 
@@ -263,9 +326,11 @@ inline unsigned compress(
 	return 0;
 }
 
-// Configure a lodepng decoder State to use system zlib.
-inline void configureDecoder(lodepng::State& state) {
+// Configure a lodepng decoder State to use system zlib. The hint, when given,
+// must outlive every decode made with this state.
+inline void configureDecoder(lodepng::State& state, const DecodeSizeHint* hint = nullptr) {
 	state.decoder.zlibsettings.custom_zlib = decompress;
+	state.decoder.zlibsettings.custom_context = hint;
 }
 
 // Configure a lodepng encoder State to use system zlib.
@@ -46,6 +46,47 @@ constexpr std::size_t CRC32_PCLMUL_MIN_BYTES = 64;
 
 alignas(64) constexpr auto CRC_TABLES = makeCrcTables();
 
+// Polynomials over GF(2) modulo the CRC polynomial, in the same reflected
+// representation as a CRC register: bit 31 is x^0, bit 0 is x^31.
+[[nodiscard]] constexpr std::uint32_t multiplyModCrcPoly(std::uint32_t a, std::uint32_t b) noexcept {
+	std::uint32_t product = 0;
+	for (std::uint32_t bit = 1U << 31U; bit != 0U; bit >>= 1U) {
+		if ((a & bit) != 0U) {
+			product ^= b;
+		}
+		b = (b & 1U) != 0U ? (b >> 1U) ^ CRC32_POLY : b >> 1U;
+	}
+	return product;
+}
+
+// X_POW_2K[k] is x^(2^k) mod the CRC polynomial.
+[[nodiscard]] constexpr auto makeXPow2kTable() {
+	std::array<std::uint32_t, 64> table{};
+	table[0] = 1U << 30U;  // x^1
+	for (std::size_t k = 1; k < table.size(); ++k) {
+		table[k] = multiplyModCrcPoly(table[k - 1], table[k - 1]);
+	}
+	return table;
+}
+
+constexpr auto X_POW_2K = makeXPow2kTable();
+
+// x^(n * 2^shift) mod the CRC polynomial.
+[[nodiscard]] constexpr std::uint32_t xPowModCrcPoly(std::size_t n, std::size_t shift = 0) noexcept {
+	std::uint32_t power = 1U << 31U;  // x^0
+	for (std::size_t k = shift; n != 0; n >>= 1U, ++k) {
+		if ((n & 1U) != 0U) {
+			power = multiplyModCrcPoly(X_POW_2K[k], power);
+		}
+	}
+	return power;
+}
+
+// x^(8n) mod the CRC polynomial: the shift appending n bytes applies.
+[[nodiscard]] constexpr std::uint32_t xPow8nModCrcPoly(std::size_t n) noexcept {
+	return xPowModCrcPoly(n, 3);
+}
+
 [[nodiscard]] std::uint32_t crc32UpdateScalar(std::uint32_t crc,
                                               const unsigned char* data,
                                               std::size_t length) noexcept {
@@ -76,24 +117,87 @@ alignas(64) constexpr auto CRC_TABLES = makeCrcTables();
 
 #if PDVRDT_HAS_X86_PCLMUL
 
-[[nodiscard]] bool cpuHasPclmul() noexcept {
+struct X86CrcFeatures {
+	bool pclmul{false};
+	bool avx2_vpclmul{false};
+	bool avx512_vpclmul{false};
+};
+
+[[nodiscard]] X86CrcFeatures detectX86CrcFeatures() noexcept {
+	X86CrcFeatures features;
 	unsigned int eax = 0;
 	unsigned int ebx = 0;
 	unsigned int ecx = 0;
 	unsigned int edx = 0;
 	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0) {
-		return false;
+		return features;
 	}
 	constexpr unsigned int SSE2_BIT = 1U << 26U;
 	constexpr unsigned int PCLMULQDQ_BIT = 1U << 1U;
-	return (edx & SSE2_BIT) != 0U && (ecx & PCLMULQDQ_BIT) != 0U;
+	constexpr unsigned int OSXSAVE_BIT = 1U << 27U;
+	features.pclmul = (edx & SSE2_BIT) != 0U && (ecx & PCLMULQDQ_BIT) != 0U;
+	if (!features.pclmul || (ecx & OSXSAVE_BIT) == 0U) {
+		return features;
+	}
+
+	// The wide registers are only usable if the OS saves them on a context
+	// switch: XCR0 must enable SSE and AVX state, plus the opmask and upper
+	// ZMM state for AVX-512.
+	unsigned int xcr0 = 0;
+	unsigned int xcr0_high = 0;
+	__asm__("xgetbv" : "=a"(xcr0), "=d"(xcr0_high) : "c"(0U));
+	constexpr unsigned int XCR0_AVX_STATE = 0x06U;
+	constexpr unsigned int XCR0_AVX512_STATE = 0xE6U;
+
+	if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) == 0) {
+		return features;
+	}
+	constexpr unsigned int AVX2_BIT = 1U << 5U;
+	constexpr unsigned int AVX512F_BIT = 1U << 16U;
+	constexpr unsigned int VPCLMULQDQ_BIT = 1U << 10U;
+	const bool vpclmul = (ecx & VPCLMULQDQ_BIT) != 0U;
+	features.avx2_vpclmul =
+		vpclmul && (ebx & AVX2_BIT) != 0U && (xcr0 & XCR0_AVX_STATE) == XCR0_AVX_STATE;
+	features.avx512_vpclmul =
+		vpclmul && (ebx & AVX512F_BIT) != 0U && (xcr0 & XCR0_AVX512_STATE) == XCR0_AVX512_STATE;
+	return features;
 }
 
+// Constants that carry a 128-bit lane `bits` positions forward in the reflected
+// domain: imm8 0x00 multiplies the low qword by x^(bits + 31) and imm8 0x11 the
+// high qword by x^(bits - 33). The wider kernels broadcast the same pair to
+// every lane.
+struct FoldConstants {
+	std::uint64_t low;
+	std::uint64_t high;
+};
+
+[[nodiscard]] constexpr FoldConstants foldConstants(std::size_t bits) noexcept {
+	return {xPowModCrcPoly(bits + 31), xPowModCrcPoly(bits - 33)};
+}
+
+constexpr FoldConstants FOLD_128 = foldConstants(128);
+constexpr FoldConstants FOLD_256 = foldConstants(256);
+constexpr FoldConstants FOLD_384 = foldConstants(384);
+constexpr FoldConstants FOLD_512 = foldConstants(512);
+constexpr FoldConstants FOLD_768 = foldConstants(768);
+constexpr FoldConstants FOLD_1024 = foldConstants(1024);
+constexpr FoldConstants FOLD_1536 = foldConstants(1536);
+constexpr FoldConstants FOLD_2048 = foldConstants(2048);
+
+static_assert(FOLD_128.low == 0xAE689191U && FOLD_128.high == 0xCCAA009EU,
+              "fold constants must match the published 128-bit pair");
+
 [[nodiscard]] __attribute__((target("sse2,pclmul"))) inline __m128i
 loadBlock128(const unsigned char* data) noexcept {
 	return _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
 }
 
+[[nodiscard]] __attribute__((target("sse2,pclmul"))) inline __m128i
+foldConstants128(FoldConstants constants) noexcept {
+	return _mm_set_epi64x(static_cast<long long>(constants.high), static_cast<long long>(constants.low));
+}
+
 [[nodiscard]] __attribute__((target("sse2,pclmul"))) inline __m128i
 foldAcross128Bits(__m128i state, __m128i constants) noexcept {
 	const __m128i folded_low = _mm_clmulepi64_si128(state, constants, 0x00);
@@ -101,23 +205,14 @@ foldAcross128Bits(__m128i state, __m128i constants) noexcept {
 	return _mm_xor_si128(folded_low, folded_high);
 }
 
+// Folds the whole 16-byte blocks from data + offset into state, then reduces
+// the state and the sub-block tail to the final CRC.
 [[nodiscard]] __attribute__((target("sse2,pclmul"))) std::uint32_t
-crc32UpdatePclmul(std::uint32_t crc, const unsigned char* data, std::size_t length) noexcept {
-	if (length < CRC32_PCLMUL_MIN_BYTES) {
-		return crc32UpdateScalarPublic(crc, data, length);
-	}
-
+finishPclmul(__m128i state, const unsigned char* data, std::size_t offset, std::size_t length) noexcept {
 	const std::size_t folded_length = length & ~std::size_t{15};
-	__m128i state =
-		_mm_xor_si128(loadBlock128(data), _mm_set_epi64x(0, crc ^ CRC32_INITIAL));
-
-	// Constants generated for reflected IEEE CRC-32. The vector order is chosen
-	// so imm8 0x00 multiplies low64 by HI64_TERMS and imm8 0x11 multiplies
-	// high64 by LO64_TERMS.
-	const __m128i fold128_constants =
-		_mm_set_epi64x(0x00000000CCAA009EULL, 0x00000000AE689191ULL);
+	const __m128i fold128_constants = foldConstants128(FOLD_128);
 
-	for (std::size_t offset = 16; offset < folded_length; offset += 16) {
+	for (; offset < folded_length; offset += 16) {
 		state = _mm_xor_si128(
 			foldAcross128Bits(state, fold128_constants),
 			loadBlock128(data + offset)
@@ -130,8 +225,8 @@ crc32UpdatePclmul(std::uint32_t crc, const unsigned char* data, std::size_t leng
 	// CRC of those 16 bytes equals the CRC of that data. We therefore store the
 	// state and run the scalar table CRC over it (init 0, no final inversion).
 	// Correct because the initial inversion was already injected into the first
-	// dword above; the final inversion is applied once at the end. Slower than
-	// Barrett but only 16 bytes, so the cost is negligible.
+	// dword by the caller; the final inversion is applied once at the end.
+	// Slower than Barrett but only 16 bytes, so the cost is negligible.
 	alignas(16) std::array<unsigned char, 16> folded{};
 	_mm_store_si128(reinterpret_cast<__m128i*>(folded.data()), state);
 
@@ -140,21 +235,219 @@ crc32UpdatePclmul(std::uint32_t crc, const unsigned char* data, std::size_t leng
 	return internal_crc ^ CRC32_INITIAL;
 }
 
+[[nodiscard]] __attribute__((target("sse2,pclmul"))) std::uint32_t
+crc32UpdatePclmul(std::uint32_t crc, const unsigned char* data, std::size_t length) noexcept {
+	if (length < CRC32_PCLMUL_MIN_BYTES) {
+		return crc32UpdateScalarPublic(crc, data, length);
+	}
+
+	const __m128i state =
+		_mm_xor_si128(loadBlock128(data), _mm_set_epi64x(0, crc ^ CRC32_INITIAL));
+	return finishPclmul(state, data, 16, length);
+}
+
+// The VPCLMULQDQ kernels run the same fold on every 128-bit lane of a wider
+// register, over four independent accumulators so consecutive multiplies do
+// not wait on each other. Each accumulator steps over the other three, so the
+// main loop folds across four registers' worth of bits; the accumulators are
+// then folded into one register and its lanes into one 128-bit state, which
+// finishPclmul completes.
+
+[[nodiscard]] __attribute__((target("avx2,pclmul,vpclmulqdq"))) inline __m256i
+loadBlock256(const unsigned char* data) noexcept {
+	return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+}
+
+[[nodiscard]] __attribute__((target("avx2,pclmul,vpclmulqdq"))) inline __m256i
+foldConstants256(FoldConstants constants) noexcept {
+	const auto low = static_cast<long long>(constants.low);
+	const auto high = static_cast<long long>(constants.high);
+	return _mm256_set_epi64x(high, low, high, low);
+}
+
+[[nodiscard]] __attribute__((target("avx2,pclmul,vpclmulqdq"))) inline __m256i
+foldInto256(__m256i state, __m256i constants, __m256i next) noexcept {
+	const __m256i folded_low = _mm256_clmulepi64_epi128(state, constants, 0x00);
+	const __m256i folded_high = _mm256_clmulepi64_epi128(state, constants, 0x11);
+	return _mm256_xor_si256(_mm256_xor_si256(folded_low, folded_high), next);
+}
+
+[[nodiscard]] __attribute__((target("avx2,pclmul,vpclmulqdq"))) std::uint32_t
+crc32UpdateVpclmul256(std::uint32_t crc, const unsigned char* data, std::size_t length) noexcept {
+	constexpr std::size_t STRIDE = 4 * 32;
+	if (length < STRIDE) {
+		return crc32UpdatePclmul(crc, data, length);
+	}
+
+	__m256i x0 = _mm256_xor_si256(loadBlock256(data), _mm256_set_epi64x(0, 0, 0, crc ^ CRC32_INITIAL));
+	__m256i x1 = loadBlock256(data + 32);
+	__m256i x2 = loadBlock256(data + 64);
+	__m256i x3 = loadBlock256(data + 96);
+
+	std::size_t offset = STRIDE;
+	const __m256i fold_stride = foldConstants256(FOLD_1024);
+	for (; length - offset >= STRIDE; offset += STRIDE) {
+		x0 = foldInto256(x0, fold_stride, loadBlock256(data + offset));
+		x1 = foldInto256(x1, fold_stride, loadBlock256(data + offset + 32));
+		x2 = foldInto256(x2, fold_stride, loadBlock256(data + offset + 64));
+		x3 = foldInto256(x3, fold_stride, loadBlock256(data + offset + 96));
+	}
+
+	__m256i state = foldInto256(x2, foldConstants256(FOLD_256), x3);
+	state = foldInto256(x1, foldConstants256(FOLD_512), state);
+	state = foldInto256(x0, foldConstants256(FOLD_768), state);
+
+	const __m256i fold_register = foldConstants256(FOLD_256);
+	for (; length - offset >= 32; offset += 32) {
+		state = foldInto256(state, fold_register, loadBlock256(data + offset));
+	}
+
+	const __m128i lanes = _mm_xor_si128(
+		foldAcross128Bits(_mm256_castsi256_si128(state), foldConstants128(FOLD_128)),
+		_mm256_extracti128_si256(state, 1)
+	);
+	return finishPclmul(lanes, data, offset, length);
+}
+
+[[nodiscard]] __attribute__((target("avx512f,pclmul,vpclmulqdq"))) inline __m512i
+loadBlock512(const unsigned char* data) noexcept {
+	return _mm512_loadu_si512(data);
+}
+
+[[nodiscard]] __attribute__((target("avx512f,pclmul,vpclmulqdq"))) inline __m512i
+foldConstants512(FoldConstants constants) noexcept {
+	const auto low = static_cast<long long>(constants.low);
+	const auto high = static_cast<long long>(constants.high);
+	return _mm512_set_epi64(high, low, high, low, high, low, high, low);
+}
+
+[[nodiscard]] __attribute__((target("avx512f,pclmul,vpclmulqdq"))) inline __m512i
+foldInto512(__m512i state, __m512i constants, __m512i next) noexcept {
+	const __m512i folded_low = _mm512_clmulepi64_epi128(state, constants, 0x00);
+	const __m512i folded_high = _mm512_clmulepi64_epi128(state, constants, 0x11);
+	return _mm512_ternarylogic_epi64(folded_low, folded_high, next, 0x96);  // a ^ b ^ c
+}
+
+[[nodiscard]] __attribute__((target("avx512f,pclmul,vpclmulqdq"))) std::uint32_t
+crc32UpdateVpclmul512(std::uint32_t crc, const unsigned char* data, std::size_t length) noexcept {
+	constexpr std::size_t STRIDE = 4 * 64;
+	if (length < STRIDE) {
+		return crc32UpdatePclmul(crc, data, length);
+	}
+
+	__m512i x0 = _mm512_xor_si512(loadBlock512(data), _mm512_set_epi64(0, 0, 0, 0, 0, 0, 0, crc ^ CRC32_INITIAL));
+	__m512i x1 = loadBlock512(data + 64);
+	__m512i x2 = loadBlock512(data + 128);
+	__m512i x3 = loadBlock512(data + 192);
+
+	std::size_t offset = STRIDE;
+	const __m512i fold_stride = foldConstants512(FOLD_2048);
+	for (; length - offset >= STRIDE; offset += STRIDE) {
+		x0 = foldInto512(x0, fold_stride, loadBlock512(data + offset));
+		x1 = foldInto512(x1, fold_stride, loadBlock512(data + offset + 64));
+		x2 = foldInto512(x2, fold_stride, loadBlock512(data + offset + 128));
+		x3 = foldInto512(x3, fold_stride, loadBlock512(data + offset + 192));
+	}
+
+	__m512i state = foldInto512(x2, foldConstants512(FOLD_512), x3);
+	state = foldInto512(x1, foldConstants512(FOLD_1024), state);
+	state = foldInto512(x0, foldConstants512(FOLD_1536), state);
+
+	const __m512i fold_register = foldConstants512(FOLD_512);
+	for (; length - offset >= 64; offset += 64) {
+		state = foldInto512(state, fold_register, loadBlock512(data + offset));
+	}
+
+	__m128i lanes = _mm512_extracti32x4_epi32(state, 3);
+	lanes = _mm_xor_si128(lanes, foldAcross128Bits(_mm512_extracti32x4_epi32(state, 2), foldConstants128(FOLD_128)));
+	lanes = _mm_xor_si128(lanes, foldAcross128Bits(_mm512_extracti32x4_epi32(state, 1), foldConstants128(FOLD_256)));
+	lanes = _mm_xor_si128(lanes, foldAcross128Bits(_mm512_castsi512_si128(state), foldConstants128(FOLD_384)));
+	return finishPclmul(lanes, data, offset, length);
+}
+
 #endif
 
 using Crc32UpdateImpl = std::uint32_t (*)(std::uint32_t,
                                           const unsigned char*,
                                           std::size_t) noexcept;
 
+#if PDVRDT_HAS_X86_PCLMUL
+
+// A vector kernel is only adopted once it reproduces the scalar tables over
+// lengths that reach each of its stages (short fallback, bulk loop, register
+// and lane reduction, 16-byte blocks, byte tail) from aligned and unaligned
+// starts. A mismatch drops to the next narrower kernel.
+[[nodiscard]] bool kernelMatchesScalar(Crc32UpdateImpl impl) noexcept {
+	alignas(64) std::array<unsigned char, 1024 + 64> probe{};
+	std::uint32_t state = 0x2545F491U;
+	for (auto& byte : probe) {
+		state = state * 1664525U + 1013904223U;
+		byte = static_cast<unsigned char>(state >> 24U);
+	}
+
+	constexpr std::array<std::size_t, 14> LENGTHS{
+		0, 1, 15, 16, 63, 64, 127, 128, 255, 256, 319, 527, 799, 1024
+	};
+	for (const std::size_t start : {std::size_t{0}, std::size_t{13}}) {
+		for (const std::size_t length : LENGTHS) {
+			const unsigned char* data = probe.data() + start;
+			for (const std::uint32_t seed : {0U, 0x9E3779B9U}) {
+				if (impl(seed, data, length) != crc32UpdateScalarPublic(seed, data, length)) {
+					return false;
+				}
+			}
+		}
+	}
+	return true;
+}
+
+#endif
+
 [[nodiscard]] Crc32UpdateImpl resolveCrc32Impl() noexcept {
 #if PDVRDT_HAS_X86_PCLMUL
-	if (cpuHasPclmul()) {
+	const X86CrcFeatures features = detectX86CrcFeatures();
+	if (features.avx512_vpclmul && kernelMatchesScalar(crc32UpdateVpclmul512)) {
+		return crc32UpdateVpclmul512;
+	}
+	if (features.avx2_vpclmul && kernelMatchesScalar(crc32UpdateVpclmul256)) {
+		return crc32UpdateVpclmul256;
+	}
+	if (features.pclmul && kernelMatchesScalar(crc32UpdatePclmul)) {
 		return crc32UpdatePclmul;
 	}
 #endif
 	return crc32UpdateScalarPublic;
 }
 
+[[nodiscard]] bool cpuSupports(Crc32Kernel kernel) noexcept {
+#if PDVRDT_HAS_X86_PCLMUL
+	static const X86CrcFeatures features = detectX86CrcFeatures();
+	switch (kernel) {
+		case Crc32Kernel::Scalar:     return true;
+		case Crc32Kernel::Pclmul:     return features.pclmul;
+		case Crc32Kernel::Vpclmul256: return features.avx2_vpclmul;
+		case Crc32Kernel::Vpclmul512: return features.avx512_vpclmul;
+	}
+	return false;
+#else
+	return kernel == Crc32Kernel::Scalar;
+#endif
+}
+
+[[nodiscard]] Crc32UpdateImpl crc32Impl(Crc32Kernel kernel) noexcept {
+#if PDVRDT_HAS_X86_PCLMUL
+	switch (kernel) {
+		case Crc32Kernel::Scalar:     break;
+		case Crc32Kernel::Pclmul:     return crc32UpdatePclmul;
+		case Crc32Kernel::Vpclmul256: return crc32UpdateVpclmul256;
+		case Crc32Kernel::Vpclmul512: return crc32UpdateVpclmul512;
+	}
+#else
+	(void)kernel;
+#endif
+	return crc32UpdateScalarPublic;
+}
+
 [[nodiscard]] std::uint32_t crc32Update(std::uint32_t crc,
                                         const unsigned char* data,
                                         std::size_t length) noexcept {
@@ -168,6 +461,21 @@ std::uint32_t pdvrdtCrc32Update(std::uint32_t crc, std::span<const Byte> data) n
 	return crc32Update(crc, reinterpret_cast<const unsigned char*>(data.data()), data.size());
 }
 
+bool crc32KernelSupported(Crc32Kernel kernel) noexcept {
+	return cpuSupports(kernel);
+}
+
+std::uint32_t pdvrdtCrc32UpdateWith(Crc32Kernel kernel, std::uint32_t crc, std::span<const Byte> data) noexcept {
+	return crc32Impl(kernel)(crc, reinterpret_cast<const unsigned char*>(data.data()), data.size());
+}
+
+std::uint32_t pdvrdtCrc32Combine(std::uint32_t crc_a, std::uint32_t crc_b, std::size_t length_b) noexcept {
+	// Appending length_b bytes multiplies A's CRC register by x^(8 * length_b);
+	// B's CRC already carries its own pre- and post-inversion, which cancel A's
+	// across the join.
+	return multiplyModCrcPoly(xPow8nModCrcPoly(length_b), crc_a) ^ crc_b;
+}
+
 unsigned lodepng_crc32(const unsigned char* data, std::size_t length) {
 	return crc32Update(0, data, length);
 }
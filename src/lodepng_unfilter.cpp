@@ -0,0 +1,335 @@
+#include "common.h"
+#include "png_utils.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#if !defined(PDVRDT_UNFILTER_DISABLE_SIMD) &&                             \
+	(defined(__x86_64__) || defined(__i386__)) &&                         \
+	(defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define PDVRDT_HAS_X86_UNFILTER 1
+#else
+#define PDVRDT_HAS_X86_UNFILTER 0
+#endif
+
+namespace {
+
+constexpr unsigned LODEPNG_ERROR_BAD_FILTER = 36;
+
+constexpr Byte
+	FILTER_NONE  = 0,
+	FILTER_SUB   = 1,
+	FILTER_UP    = 2,
+	FILTER_AVG   = 3,
+	FILTER_PAETH = 4;
+
+[[nodiscard]] constexpr Byte paethPredictor(Byte a, Byte b, Byte c) noexcept {
+	const int pa = std::abs(b - c);
+	const int pb = std::abs(a - c);
+	const int pc = std::abs(a + b - c - c);
+	if (pa <= pb && pa <= pc) {
+		return a;
+	}
+	return pb <= pc ? b : c;
+}
+
+// Any pixel size, and the first row of a pass, where there is no row above and
+// Up, Avg and Paeth predict from zeros. `recon` is written front to back and
+// never runs ahead of `scanline`, which is what lets lodepng unfilter in place.
+[[nodiscard]] unsigned unfilterScalar(
+	Byte* recon, const Byte* scanline, const Byte* precon,
+	std::size_t bytewidth, Byte filter_type, std::size_t length) noexcept {
+
+	const std::size_t lead = bytewidth < length ? bytewidth : length;
+	switch (filter_type) {
+		case FILTER_NONE:
+			std::memmove(recon, scanline, length);
+			return 0;
+		case FILTER_SUB:
+			std::memmove(recon, scanline, lead);
+			for (std::size_t i = lead; i < length; ++i) {
+				recon[i] = static_cast<Byte>(scanline[i] + recon[i - bytewidth]);
+			}
+			return 0;
+		case FILTER_UP:
+			if (!precon) {
+				std::memmove(recon, scanline, length);
+				return 0;
+			}
+			for (std::size_t i = 0; i < length; ++i) {
+				recon[i] = static_cast<Byte>(scanline[i] + precon[i]);
+			}
+			return 0;
+		case FILTER_AVG:
+			for (std::size_t i = 0; i < lead; ++i) {
+				recon[i] = static_cast<Byte>(scanline[i] + (precon ? precon[i] >> 1 : 0));
+			}
+			for (std::size_t i = lead; i < length; ++i) {
+				const unsigned above = precon ? precon[i] : 0U;
+				recon[i] = static_cast<Byte>(scanline[i] + ((recon[i - bytewidth] + above) >> 1));
+			}
+			return 0;
+		case FILTER_PAETH:
+			for (std::size_t i = 0; i < lead; ++i) {
+				recon[i] = static_cast<Byte>(scanline[i] + (precon ? precon[i] : 0));
+			}
+			for (std::size_t i = lead; i < length; ++i) {
+				const Byte predictor = precon
+					? paethPredictor(recon[i - bytewidth], precon[i], precon[i - bytewidth])
+					: recon[i - bytewidth];
+				recon[i] = static_cast<Byte>(scanline[i] + predictor);
+			}
+			return 0;
+		default:
+			return LODEPNG_ERROR_BAD_FILTER;
+	}
+}
+
+#if PDVRDT_HAS_X86_UNFILTER
+
+// Sub, Avg and Paeth each depend on the pixel to the left, so they go a pixel
+// at a time with every channel of it in one register. Pixels are moved with
+// exact-width copies: a 3-byte pixel never touches the byte after it, which for
+// lodepng's in-place unfilter is still unread input, and at the end of the
+// image is past the buffer.
+// A 3-byte pixel is assembled in a register from a 2-byte and a 1-byte
+// access; a 3-byte memcpy through a stack temporary stalls store forwarding.
+template <std::size_t BPP>
+[[nodiscard]] __attribute__((target("sse4.1"))) inline __m128i loadPixel(const Byte* pixel) noexcept {
+	std::uint32_t bits = 0;
+	if constexpr (BPP == 4) {
+		std::memcpy(&bits, pixel, 4);
+	} else {
+		std::uint16_t low = 0;
+		std::memcpy(&low, pixel, 2);
+		bits = low | (static_cast<std::uint32_t>(pixel[2]) << 16);
+	}
+	return _mm_cvtsi32_si128(static_cast<int>(bits));
+}
+
+template <std::size_t BPP>
+__attribute__((target("sse4.1"))) inline void storePixel(Byte* pixel, __m128i value) noexcept {
+	const auto bits = static_cast<std::uint32_t>(_mm_cvtsi128_si32(value));
+	if constexpr (BPP == 4) {
+		std::memcpy(pixel, &bits, 4);
+	} else {
+		const auto low = static_cast<std::uint16_t>(bits);
+		std::memcpy(pixel, &low, 2);
+		pixel[2] = static_cast<Byte>(bits >> 16);
+	}
+}
+
+template <std::size_t BPP>
+__attribute__((target("sse4.1"))) void unfilterSubSse41(
+	Byte* recon, const Byte* scanline, std::size_t length) noexcept {
+
+	__m128i left = _mm_setzero_si128();
+	std::size_t i = 0;
+	if constexpr (BPP == 4) {
+		// Four pixels at once: a running sum across the register in two
+		// shifted adds, then the last pixel of the block before on top.
+		for (; i + 16 <= length; i += 16) {
+			__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(scanline + i));
+			block = _mm_add_epi8(block, _mm_slli_si128(block, 4));
+			block = _mm_add_epi8(block, _mm_slli_si128(block, 8));
+			block = _mm_add_epi8(block, left);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(recon + i), block);
+			left = _mm_shuffle_epi32(block, _MM_SHUFFLE(3, 3, 3, 3));
+		}
+	}
+	for (; i + BPP <= length; i += BPP) {
+		left = _mm_add_epi8(loadPixel<BPP>(scanline + i), left);
+		storePixel<BPP>(recon + i, left);
+	}
+}
+
+template <std::size_t BPP>
+__attribute__((target("sse4.1"))) void unfilterAvgSse41(
+	Byte* recon, const Byte* scanline, const Byte* precon, std::size_t length) noexcept {
+
+	// _mm_avg_epu8 rounds up; the PNG average rounds down, which differs
+	// exactly when the two inputs differ in their low bit.
+	const __m128i low_bit = _mm_set1_epi8(1);
+	__m128i left = _mm_setzero_si128();
+	for (std::size_t i = 0; i + BPP <= length; i += BPP) {
+		const __m128i above = loadPixel<BPP>(precon + i);
+		__m128i average = _mm_avg_epu8(left, above);
+		average = _mm_sub_epi8(average, _mm_and_si128(_mm_xor_si128(left, above), low_bit));
+		left = _mm_add_epi8(loadPixel<BPP>(scanline + i), average);
+		storePixel<BPP>(recon + i, left);
+	}
+}
+
+// The predictor distances need nine bits, so pixels are worked on widened to
+// 16-bit lanes. Ties go to left, then above, then upper-left, as in the PNG spec.
+template <std::size_t BPP>
+__attribute__((target("sse4.1"))) void unfilterPaethSse41(
+	Byte* recon, const Byte* scanline, const Byte* precon, std::size_t length) noexcept {
+
+	const __m128i low_byte = _mm_set1_epi16(0xFF);
+	__m128i left = _mm_setzero_si128();
+	__m128i upper_left = _mm_setzero_si128();
+	for (std::size_t i = 0; i + BPP <= length; i += BPP) {
+		const __m128i current = _mm_cvtepu8_epi16(loadPixel<BPP>(scanline + i));
+		const __m128i above = _mm_cvtepu8_epi16(loadPixel<BPP>(precon + i));
+		const __m128i above_minus_corner = _mm_sub_epi16(above, upper_left);
+		const __m128i left_minus_corner = _mm_sub_epi16(left, upper_left);
+		const __m128i pa = _mm_abs_epi16(above_minus_corner);
+		const __m128i pb = _mm_abs_epi16(left_minus_corner);
+		const __m128i pc = _mm_abs_epi16(_mm_add_epi16(above_minus_corner, left_minus_corner));
+		const __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+
+		__m128i predictor = _mm_blendv_epi8(upper_left, above, _mm_cmpeq_epi16(pb, smallest));
+		predictor = _mm_blendv_epi8(predictor, left, _mm_cmpeq_epi16(pa, smallest));
+
+		// Kept widened: the next pixel reads it, the store packs it.
+		left = _mm_and_si128(_mm_add_epi16(current, predictor), low_byte);
+		storePixel<BPP>(recon + i, _mm_packus_epi16(left, left));
+		upper_left = above;
+	}
+}
+
+// Up has no dependency along the row and is a plain vector add at any pixel size.
+__attribute__((target("sse4.1"))) void unfilterUpSse41(
+	Byte* recon, const Byte* scanline, const Byte* precon, std::size_t length) noexcept {
+
+	std::size_t i = 0;
+	for (; i + 16 <= length; i += 16) {
+		const __m128i current = _mm_loadu_si128(reinterpret_cast<const __m128i*>(scanline + i));
+		const __m128i above = _mm_loadu_si128(reinterpret_cast<const __m128i*>(precon + i));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(recon + i), _mm_add_epi8(current, above));
+	}
+	for (; i < length; ++i) {
+		recon[i] = static_cast<Byte>(scanline[i] + precon[i]);
+	}
+}
+
+__attribute__((target("avx2"))) void unfilterUpAvx2(
+	Byte* recon, const Byte* scanline, const Byte* precon, std::size_t length) noexcept {
+
+	std::size_t i = 0;
+	for (; i + 32 <= length; i += 32) {
+		const __m256i current = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(scanline + i));
+		const __m256i above = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(precon + i));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(recon + i), _mm256_add_epi8(current, above));
+	}
+	unfilterUpSse41(recon + i, scanline + i, precon + i, length - i);
+}
+
+template <std::size_t BPP>
+[[nodiscard]] unsigned unfilterPixelsSse41(
+	Byte* recon, const Byte* scanline, const Byte* precon,
+	Byte filter_type, std::size_t length) noexcept {
+
+	switch (filter_type) {
+		case FILTER_SUB:   unfilterSubSse41<BPP>(recon, scanline, length); return 0;
+		case FILTER_AVG:   unfilterAvgSse41<BPP>(recon, scanline, precon, length); return 0;
+		case FILTER_PAETH: unfilterPaethSse41<BPP>(recon, scanline, precon, length); return 0;
+		default:           return unfilterScalar(recon, scanline, precon, BPP, filter_type, length);
+	}
+}
+
+#endif
+
+[[nodiscard]] bool cpuSupports(UnfilterKernel kernel) noexcept {
+#if PDVRDT_HAS_X86_UNFILTER
+	switch (kernel) {
+		case UnfilterKernel::Scalar: return true;
+		case UnfilterKernel::Sse41:  return __builtin_cpu_supports("sse4.1");
+		case UnfilterKernel::Avx2:   return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("sse4.1");
+	}
+	return false;
+#else
+	return kernel == UnfilterKernel::Scalar;
+#endif
+}
+
+[[nodiscard]] UnfilterKernel resolveUnfilterKernel() noexcept {
+	if (cpuSupports(UnfilterKernel::Avx2)) {
+		return UnfilterKernel::Avx2;
+	}
+	if (cpuSupports(UnfilterKernel::Sse41)) {
+		return UnfilterKernel::Sse41;
+	}
+	return UnfilterKernel::Scalar;
+}
+
+#if PDVRDT_HAS_X86_UNFILTER
+
+// Stands in for the missing row above the first row of a pass: Avg and Paeth
+// predict from zeros there, which the SIMD kernels get by reading a row of them.
+// Grown to the widest row seen on this thread. Null if it cannot be, which
+// leaves the row to the scalar path.
+[[nodiscard]] const Byte* zeroRow(std::size_t length) noexcept {
+	thread_local vBytes zeros;
+	if (zeros.size() < length) {
+		try {
+			zeros.resize(length);
+		} catch (...) {
+			return nullptr;
+		}
+	}
+	return zeros.data();
+}
+
+#endif
+
+[[nodiscard]] unsigned unfilterWith(
+	UnfilterKernel kernel,
+	Byte* recon, const Byte* scanline, const Byte* precon,
+	std::size_t bytewidth, Byte filter_type, std::size_t length) noexcept {
+
+#if PDVRDT_HAS_X86_UNFILTER
+	if (kernel != UnfilterKernel::Scalar) {
+		// Up on the first row of a pass is a plain copy, which the scalar path
+		// makes.
+		if (filter_type == FILTER_UP && precon) {
+			if (kernel == UnfilterKernel::Avx2) {
+				unfilterUpAvx2(recon, scanline, precon, length);
+			} else {
+				unfilterUpSse41(recon, scanline, precon, length);
+			}
+			return 0;
+		}
+		// 8-bit RGBA and RGB rows; these are always whole pixels, but a length
+		// that is not is still left to the scalar path. On the first row of a
+		// pass, Avg and Paeth read zeroRow() as the row above.
+		const bool predicts_from_above = filter_type == FILTER_AVG || filter_type == FILTER_PAETH;
+		const Byte* above = (precon || !predicts_from_above) ? precon : zeroRow(length);
+		if (above || !predicts_from_above) {
+			if (bytewidth == 4 && length % 4 == 0) {
+				return unfilterPixelsSse41<4>(recon, scanline, above, filter_type, length);
+			}
+			if (bytewidth == 3 && length % 3 == 0) {
+				return unfilterPixelsSse41<3>(recon, scanline, above, filter_type, length);
+			}
+		}
+	}
+#else
+	(void)kernel;
+#endif
+	return unfilterScalar(recon, scanline, precon, bytewidth, filter_type, length);
+}
+
+} // namespace
+
+bool unfilterKernelSupported(UnfilterKernel kernel) noexcept {
+	return cpuSupports(kernel);
+}
+
+unsigned pdvrdtUnfilterScanlineWith(
+	UnfilterKernel kernel,
+	Byte* recon, const Byte* scanline, const Byte* precon,
+	std::size_t bytewidth, Byte filter_type, std::size_t length) noexcept {
+	return unfilterWith(kernel, recon, scanline, precon, bytewidth, filter_type, length);
+}
+
+unsigned pdvrdtUnfilterScanline(
+	Byte* recon, const Byte* scanline, const Byte* precon,
+	std::size_t bytewidth, Byte filter_type, std::size_t length) noexcept {
+	static const UnfilterKernel kernel = resolveUnfilterKernel();
+	return unfilterWith(kernel, recon, scanline, precon, bytewidth, filter_type, length);
+}
@@ -20,15 +20,11 @@ int main(int argc, char** argv) {
 
 		auto& args = *args_opt;
 
-		vBytes png_vec = readFile(
-			args.image_file_path,
-			args.mode == Mode::conceal ? FileTypeCheck::cover_image : FileTypeCheck::embedded_image
-		);
-
 		if (args.mode == Mode::conceal) {
+			vBytes png_vec = readFile(args.image_file_path, FileTypeCheck::cover_image);
 			concealData(png_vec, args.option, args.data_file_path);
 		} else {
-			recoverData(png_vec);
+			recoverData(args.image_file_path, args.range);
 		}
 	}
 	catch (const std::exception& e) {
@@ -1,11 +1,13 @@
 #include "png_utils.h"
 #include "io_utils.h"
-#include "lodepng/lodepng_config.h"
-#include "lodepng/lodepng.h"
+#include "thread_pool.h"
 
+#include <algorithm>
 #include <bit>
 #include <cstring>
+#include <future>
 #include <stdexcept>
+#include <vector>
 
 namespace {
 constexpr auto PNG_SIG = std::to_array<Byte>({
@@ -14,8 +16,37 @@ constexpr auto PNG_SIG = std::to_array<Byte>({
 constexpr std::size_t
 	CHUNK_HEADER_SIZE = 8,
 	CHUNK_CRC_SIZE    = 4;
+
+// Below this a span is CRC'd inline: at several GB/s a piece must be about a
+// megabyte before a pool round trip pays for itself.
+constexpr std::size_t PARALLEL_CRC_MIN_PIECE = 1 * 1024 * 1024;
 } // namespace
 
+std::uint32_t pdvrdtCrc32UpdateParallel(std::uint32_t crc, std::span<const Byte> data) {
+	ThreadPool& pool = sharedThreadPool();
+	const std::size_t pieces = std::min(pool.size(), data.size() / PARALLEL_CRC_MIN_PIECE);
+	if (pieces < 2) {
+		return pdvrdtCrc32Update(crc, data);
+	}
+
+	const std::size_t piece_size = data.size() / pieces;
+	std::vector<std::future<std::uint32_t>> piece_crcs;
+	piece_crcs.reserve(pieces - 1);
+	for (std::size_t piece = 1; piece < pieces; ++piece) {
+		const std::span<const Byte> part = piece + 1 == pieces
+			? data.subspan(piece * piece_size)
+			: data.subspan(piece * piece_size, piece_size);
+		piece_crcs.push_back(pool.submit([part] { return pdvrdtCrc32Update(0, part); }));
+	}
+
+	crc = pdvrdtCrc32Update(crc, data.first(piece_size));
+	for (std::size_t piece = 1; piece < pieces; ++piece) {
+		const std::size_t part_size = piece + 1 == pieces ? data.size() - piece * piece_size : piece_size;
+		crc = pdvrdtCrc32Combine(crc, piece_crcs[piece - 1].get(), part_size);
+	}
+	return crc;
+}
+
 void updateValue(std::span<Byte> data, std::size_t index, std::uint32_t value) {
 	if (!spanHasRange(data, index, sizeof(value))) {
 		throw std::out_of_range("updateValue: Index out of bounds.");
@@ -38,6 +69,28 @@ std::uint32_t getValue(std::span<const Byte> data, std::size_t index) {
 	return value;
 }
 
+void storeLe(Byte* out, std::uint64_t value, std::size_t bytes) {
+	for (std::size_t i = 0; i < bytes; ++i) {
+		out[i] = static_cast<Byte>(value >> (8 * i));
+	}
+}
+
+std::uint64_t loadLe(const Byte* in, std::size_t bytes) {
+	std::uint64_t value = 0;
+	for (std::size_t i = 0; i < bytes; ++i) {
+		value |= static_cast<std::uint64_t>(in[i]) << (8 * i);
+	}
+	return value;
+}
+
+bool collect(std::span<const Byte>& input, Byte* target, std::size_t& have, std::size_t wanted) {
+	const std::size_t take = std::min(input.size(), wanted - have);
+	std::memcpy(target + have, input.data(), take);
+	have += take;
+	input = input.subspan(take);
+	return have == wanted;
+}
+
 bool hasPngSignature(std::span<const Byte> data) {
 	return spanHasRange(data, 0, PNG_SIG.size()) &&
 		std::memcmp(data.data(), PNG_SIG.data(), PNG_SIG.size()) == 0;
@@ -72,10 +125,7 @@ PngChunkView readPngChunk(
 	requireSpanRange(png, crc_index, CHUNK_CRC_SIZE, crc_error);
 
 	const std::uint32_t stored_crc = getValue(png, crc_index);
-	const std::uint32_t computed_crc = static_cast<std::uint32_t>(lodepng_crc32(
-		png.data() + static_cast<std::ptrdiff_t>(type_index),
-		length + 4
-	));
+	const std::uint32_t computed_crc = pdvrdtCrc32UpdateParallel(0, png.subspan(type_index, length + 4));
 	if (stored_crc != computed_crc) {
 		throw std::runtime_error(std::string(crc_error));
 	}
@@ -26,11 +26,20 @@ inline constexpr std::size_t
 	IHDR_DATA_SIZE  = 13;
 
 // Read/write a 32-bit big-endian field at a byte offset. Chunk lengths, chunk
-// types, CRCs and the secretstream frame length are all 32-bit big-endian, and
-// nothing in either format needs another width.
+// types, CRCs and the secretstream frame length are all 32-bit big-endian.
 void updateValue(std::span<Byte> data, std::size_t index, std::uint32_t value);
 [[nodiscard]] std::uint32_t getValue(std::span<const Byte> data, std::size_t index);
 
+// Little-endian fields of `bytes` width, at most 8: the payload metadata record
+// and the deflate segment index.
+void storeLe(Byte* out, std::uint64_t value, std::size_t bytes);
+[[nodiscard]] std::uint64_t loadLe(const Byte* in, std::size_t bytes);
+
+// Copies from `input` into `target` until it holds `wanted` bytes, consuming
+// what it takes. True once `target` is complete. For parsers fed a stream in
+// arbitrary pieces.
+[[nodiscard]] bool collect(std::span<const Byte>& input, Byte* target, std::size_t& have, std::size_t wanted);
+
 [[nodiscard]] bool hasPngSignature(std::span<const Byte> data);
 void requirePngSignature(std::span<const Byte> data, std::string_view message);
 
@@ -41,6 +50,68 @@ void requirePngSignature(std::span<const Byte> data, std::string_view message);
 	std::uint32_t crc,
 	std::span<const Byte> data) noexcept;
 
+// CRC-32 of A followed by B, from the CRCs of A and B and the length of B. Lets
+// the CRC of each piece of a chunk be computed wherever that piece is produced or
+// read, while it is still in cache, and the chunk CRC assembled afterwards.
+[[nodiscard]] std::uint32_t pdvrdtCrc32Combine(
+	std::uint32_t crc_a,
+	std::uint32_t crc_b,
+	std::size_t length_b) noexcept;
+
+// The kernels pdvrdtCrc32Update() chooses between, exposed so each can be checked
+// against a reference CRC on any CPU that runs it: the runtime self-test only
+// falls back to a narrower kernel, it never reports a mismatch.
+enum class Crc32Kernel { Scalar, Pclmul, Vpclmul256, Vpclmul512 };
+
+[[nodiscard]] bool crc32KernelSupported(Crc32Kernel kernel) noexcept;
+
+// pdvrdtCrc32Update() through `kernel`, which must be supported.
+[[nodiscard]] std::uint32_t pdvrdtCrc32UpdateWith(
+	Crc32Kernel kernel,
+	std::uint32_t crc,
+	std::span<const Byte> data) noexcept;
+
+// pdvrdtCrc32Update() for spans big enough to split: the pieces are CRC'd on the
+// shared pool, the calling thread taking one, and joined with
+// pdvrdtCrc32Combine(). Small spans, and a pool of one worker, run inline.
+//
+// Must be called from a thread outside the pool: it waits on CRC tasks.
+[[nodiscard]] std::uint32_t pdvrdtCrc32UpdateParallel(
+	std::uint32_t crc,
+	std::span<const Byte> data);
+
+// Undoes PNG filter method 0 for one scanline, under the contract of lodepng's
+// unfilterScanline(), whose place it takes: `scanline` excludes the filter-type
+// byte, `precon` is the unfiltered row above or nullptr for the first row, and
+// `recon` may alias `scanline` (lodepng unfilters in place) but not `precon`.
+// Returns 0, or lodepng's error 36 for an unknown filter type.
+// Defined in lodepng_unfilter.cpp, which runtime-dispatches 3- and 4-byte
+// pixels to SSE4.1 kernels, and Up at any pixel size to SSE4.1 or AVX2, on
+// capable x86 CPUs; everything else takes a scalar path.
+[[nodiscard]] unsigned pdvrdtUnfilterScanline(
+	Byte* recon,
+	const Byte* scanline,
+	const Byte* precon,
+	std::size_t bytewidth,
+	Byte filter_type,
+	std::size_t length) noexcept;
+
+// The kernel sets pdvrdtUnfilterScanline() chooses between, exposed so each can
+// be checked against the scalar path on any CPU that runs it.
+enum class UnfilterKernel { Scalar, Sse41, Avx2 };
+
+[[nodiscard]] bool unfilterKernelSupported(UnfilterKernel kernel) noexcept;
+
+// pdvrdtUnfilterScanline() through `kernel`, which must be supported.
+[[nodiscard]] unsigned pdvrdtUnfilterScanlineWith(
+	UnfilterKernel kernel,
+	Byte* recon,
+	const Byte* scanline,
+	const Byte* precon,
+	std::size_t bytewidth,
+	Byte filter_type,
+	std::size_t length) noexcept;
+
 [[nodiscard]] PngChunkView readPngChunk(
 	std::span<const Byte> png,
 	std::size_t offset,
@@ -3,21 +3,30 @@
 #include "png_utils.h"
 #include "compression.h"
 #include "io_utils.h"
+#include "spsc_ring.h"
+#include "thread_pool.h"
 
 #include <fcntl.h>
 #include <linux/fs.h>
 #include <sys/syscall.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <array>
 #include <cerrno>
 #include <cstring>
+#include <exception>
 #include <format>
+#include <future>
+#include <limits>
 #include <optional>
 #include <print>
 #include <span>
 #include <stdexcept>
 #include <system_error>
+#include <thread>
 #include <utility>
+#include <vector>
 
 namespace {
 
@@ -117,91 +126,297 @@ void commitRecoveredOutput(const fs::path& staged_path, const fs::path& output_p
 		"Write File Error: Failed to commit recovered file: {}", ec.message()));
 }
 
-struct EmbeddedProfile {
-	bool is_mastodon{false};
-	// Default mode: profile lives within png_vec at [offset, offset+length). No allocation.
-	std::size_t offset{0};
-	std::size_t length{0};
-	// Mastodon mode: profile is the inflate output (allocated).
-	vBytes decompressed{};
-};
+// Recover never holds the image: chunks are read from the file a block at a
+// time, once to verify CRCs and locate the payload and once more to stream it
+// through decryption, so memory is a few blocks whatever the image size.
+constexpr std::size_t READ_BLOCK_SIZE = 1 * 1024 * 1024;
+constexpr std::size_t CHUNK_HEADER_BYTES = 8;
+constexpr std::size_t CHUNK_CRC_BYTES = 4;
+
+// Enough of a Mastodon profile's end for the tag table and metadata record of
+// the largest profile the iCCP ceiling admits, cut into the smallest frames.
+constexpr std::size_t MASTODON_TAIL_BYTES =
+	AEAD_TAG_BYTES * (MAX_MASTODON_PROFILE_BYTES / MIN_AEAD_FRAME_SIZE + 1) + SEALED_PAYLOAD_METADATA_BYTES;
 
 // The payload fingerprint plus enough ciphertext to actually decrypt. Conceal's
 // stripping predicate deliberately omits the length half; see
 // hasPdvrdtProfileMarkers().
-[[nodiscard]] bool isRecoverableProfile(std::span<const Byte> profile, const ProfileOffsets& offsets) {
-	return hasPdvrdtProfileMarkers(profile, offsets) &&
-		spanHasRange(profile, offsets.encrypted_file, minimumStreamCipherSize());
+[[nodiscard]] bool isRecoverableProfile(
+	std::span<const Byte> head, std::size_t profile_size, const ProfileOffsets& offsets) {
+	return hasPdvrdtProfileMarkers(head, offsets) &&
+		offsets.encrypted_file <= profile_size &&
+		minimumPayloadCipherSize() <= profile_size - offsets.encrypted_file;
 }
 
-// Returns (offset_in_png_vec, length) of the embedded profile, or nullopt if this IDAT
-// is not a pdvrdt-encoded one. The 3-byte IDAT_PREFIX sits at chunk.data[0..3]; the
-// profile body starts at chunk.offset + 8 (chunk header) + 3 (prefix).
-[[nodiscard]] std::optional<std::pair<std::size_t, std::size_t>> tryLocateDefaultProfileInIdat(
-	std::size_t chunk_offset, std::span<const Byte> idat_data) {
-	constexpr std::size_t CHUNK_HEADER_BYTES = 8;
-	if (!bytesEqualAt(idat_data, 0, PDVRDT_IDAT_PREFIX)) {
-		return std::nullopt;
+struct ChunkInfo {
+	std::size_t offset{};
+	std::size_t length{};
+	std::size_t total_size{};
+	std::uint32_t type{};
+};
+
+// Reads `length` bytes of `fd` from `offset`, one block at a time.
+template <typename Handler>
+void forEachBlock(int fd, std::size_t offset, std::size_t length, vBytes& block, Handler&& on_block) {
+	while (length != 0) {
+		const std::size_t take = std::min(length, block.size());
+		readExactAt(fd, block.data(), take, offset);
+		on_block(std::span<const Byte>(block.data(), take));
+		offset += take;
+		length -= take;
 	}
+}
 
-	const std::span<const Byte> profile = idat_data.subspan(PDVRDT_IDAT_PREFIX.size());
-	if (!isRecoverableProfile(profile, DEFAULT_OFFSETS)) {
-		return std::nullopt;
+// Reads `length` bytes of `fd` from `offset` into alternating halves of
+// `block`, handing each half to `on_data` in order, and returns `crc` extended
+// over them. The pool CRCs one half, a read block per task, while the calling
+// thread reads the next, so checking a multi-GB IDAT costs about one read of it
+// rather than a read followed by a CRC.
+template <typename Handler>
+[[nodiscard]] std::uint32_t crcBlocksAt(
+	int fd, std::size_t offset, std::size_t length, vBytes& block, std::uint32_t crc, Handler&& on_data) {
+
+	// Every exit waits out the tasks still reading `block`.
+	struct PendingCrcs {
+		std::vector<std::pair<std::future<std::uint32_t>, std::size_t>> pieces;
+
+		~PendingCrcs() {
+			for (auto& [done, size] : pieces) {
+				if (done.valid()) done.wait();
+			}
+		}
+
+		[[nodiscard]] std::uint32_t fold(std::uint32_t crc) {
+			for (auto& [done, size] : pieces) {
+				crc = pdvrdtCrc32Combine(crc, done.get(), size);
+			}
+			pieces.clear();
+			return crc;
+		}
+	} pending;
+
+	ThreadPool& pool = sharedThreadPool();
+	const std::size_t half_size = block.size() / 2;
+	std::size_t half = 0;
+	while (length != 0) {
+		const std::span<Byte> data(block.data() + half * half_size, std::min(length, half_size));
+		readExactAt(fd, data.data(), data.size(), offset);
+		on_data(std::span<const Byte>(data));
+		crc = pending.fold(crc);
+		if (data.size() < READ_BLOCK_SIZE) {
+			// Most chunks are small; a pool round trip would cost more than the CRC.
+			crc = pdvrdtCrc32Update(crc, data);
+		} else {
+			for (std::size_t piece = 0; piece < data.size(); piece += READ_BLOCK_SIZE) {
+				const std::span<const Byte> part = data.subspan(piece, std::min(READ_BLOCK_SIZE, data.size() - piece));
+				pending.pieces.emplace_back(pool.submit([part] { return pdvrdtCrc32Update(0, part); }), part.size());
+			}
+		}
+		offset += data.size();
+		length -= data.size();
+		half ^= 1;
 	}
-	return std::make_pair(chunk_offset + CHUNK_HEADER_BYTES + PDVRDT_IDAT_PREFIX.size(), profile.size());
+	return pending.fold(crc);
 }
 
-[[nodiscard]] std::optional<vBytes> tryExtractMastodonProfileFromIccp(std::span<const Byte> iccp_data) {
-	// The cheap prefix-only identification is shared with conceal's stripping path.
-	// A matching candidate is then inflated fully under the 64 MiB recovery ceiling.
-	const auto compressed_profile = findPdvrdtIccpPayload(iccp_data);
-	if (!compressed_profile) {
-		return std::nullopt;
+// The file-backed counterpart of readPngChunk(): same checks, same messages, but
+// the data is handed to `on_data` block by block while the CRC is computed. See
+// crcBlocksAt() for how `block` is used.
+template <typename Handler>
+[[nodiscard]] ChunkInfo readPngChunkAt(
+	const OpenInputFile& file, std::size_t offset, vBytes& block, Handler&& on_data) {
+
+	const std::size_t file_size = file.size();
+	if (offset > file_size || CHUNK_HEADER_BYTES > file_size - offset) {
+		throw std::runtime_error("Image File Error: Corrupt PNG chunk header.");
 	}
 
-	vBytes profile;
-	try {
-		profile = zlibInflateSpanBounded(*compressed_profile, MAX_MASTODON_PROFILE_BYTES);
-	} catch (const std::runtime_error&) {
-		return std::nullopt;
+	std::array<Byte, CHUNK_HEADER_BYTES> header{};
+	readExactAt(file.fd(), header.data(), header.size(), offset);
+	const std::size_t length = getValue(header, 0);
+	const std::size_t data_index = offset + CHUNK_HEADER_BYTES;
+	if (length > file_size - data_index || CHUNK_CRC_BYTES > file_size - (data_index + length)) {
+		throw std::runtime_error("Image File Error: Corrupt PNG chunk length.");
 	}
-	if (!isRecoverableProfile(profile, MASTODON_OFFSETS)) {
-		return std::nullopt;
+
+	const std::uint32_t crc = crcBlocksAt(file.fd(), data_index, length, block,
+		pdvrdtCrc32Update(0, std::span<const Byte>(header).subspan(4)), on_data);
+
+	std::array<Byte, CHUNK_CRC_BYTES> stored_crc{};
+	readExactAt(file.fd(), stored_crc.data(), stored_crc.size(), data_index + length);
+	if (getValue(stored_crc, 0) != crc) {
+		throw std::runtime_error("Image File Error: Corrupt PNG chunk CRC.");
 	}
-	return profile;
+
+	return ChunkInfo{
+		.offset = offset,
+		.length = length,
+		.total_size = length + CHUNK_HEADER_BYTES + CHUNK_CRC_BYTES,
+		.type = getValue(header, 4)
+	};
 }
 
-EmbeddedProfile locateEmbeddedData(const vBytes& png_vec) {
-	requirePngSignature(png_vec, "Image File Error: This is not a pdvrdt image.");
+struct EmbeddedProfileLocation {
+	bool is_mastodon{false};
+	// Default mode: the profile itself, at [offset, offset + size) in the file.
+	// Mastodon mode: the zlib stream that inflates to it.
+	std::size_t offset{};
+	std::size_t stored_size{};
+	// Size of the profile as decryption sees it, and its first and last bytes.
+	std::size_t size{};
+	vBytes head{};
+	vBytes tail{};
+};
+
+// Keeps the first `head_size` and last `tail_size` bytes of a stream of unknown
+// length, plus its total size.
+class HeadTailCollector {
+public:
+	HeadTailCollector(std::size_t head_size, std::size_t tail_size)
+		: head_size_(head_size), tail_size_(tail_size) {}
+
+	void feed(std::span<const Byte> data) {
+		size_ += data.size();
+		const std::size_t head_take = std::min(data.size(), head_size_ - head_.size());
+		head_.insert(head_.end(), data.begin(), data.begin() + static_cast<std::ptrdiff_t>(head_take));
+
+		if (data.size() >= tail_size_) {
+			tail_.assign(data.end() - static_cast<std::ptrdiff_t>(tail_size_), data.end());
+			return;
+		}
+		const std::size_t keep = std::min(tail_.size(), tail_size_ - data.size());
+		tail_.erase(tail_.begin(), tail_.end() - static_cast<std::ptrdiff_t>(keep));
+		tail_.insert(tail_.end(), data.begin(), data.end());
+	}
+
+	[[nodiscard]] std::size_t size() const noexcept { return size_; }
+	[[nodiscard]] vBytes takeHead() noexcept { return std::move(head_); }
+	[[nodiscard]] vBytes takeTail() noexcept { return std::move(tail_); }
+
+private:
+	std::size_t head_size_;
+	std::size_t tail_size_;
+	std::size_t size_{};
+	vBytes head_{};
+	vBytes tail_{};
+};
+
+// Inflates a candidate iCCP chunk's profile as its blocks arrive, keeping only
+// what decryption needs before the PIN prompt. A stream that fails to inflate
+// under the 64 MiB recovery ceiling is not a pdvrdt profile.
+class MastodonProfileScan {
+public:
+	explicit MastodonProfileScan(std::size_t compressed_offset)
+		: compressed_offset_(compressed_offset),
+		  collector_(MASTODON_OFFSETS.encrypted_file, MASTODON_TAIL_BYTES),
+		  inflater_(MAX_MASTODON_PROFILE_BYTES, [this](std::span<const Byte> out) { collector_.feed(out); }) {}
+
+	void feed(std::span<const Byte> compressed) {
+		if (failed_) return;
+		try {
+			inflater_.feed(compressed);
+		} catch (const std::runtime_error&) {
+			failed_ = true;
+		}
+	}
+
+	[[nodiscard]] std::optional<EmbeddedProfileLocation> finish(std::size_t compressed_size) {
+		if (!failed_) {
+			try {
+				inflater_.finish();
+			} catch (const std::runtime_error&) {
+				failed_ = true;
+			}
+		}
+		if (failed_) {
+			return std::nullopt;
+		}
+
+		vBytes head = collector_.takeHead();
+		if (!isRecoverableProfile(head, collector_.size(), MASTODON_OFFSETS)) {
+			return std::nullopt;
+		}
+		return EmbeddedProfileLocation{
+			.is_mastodon = true,
+			.offset = compressed_offset_,
+			.stored_size = compressed_size,
+			.size = collector_.size(),
+			.head = std::move(head),
+			.tail = collector_.takeTail()
+		};
+	}
+
+private:
+	std::size_t compressed_offset_;
+	HeadTailCollector collector_;
+	ZlibInflateStream inflater_;
+	bool failed_{false};
+};
+
+EmbeddedProfileLocation locateEmbeddedData(const OpenInputFile& file) {
+	std::array<Byte, PNG_HEADER_SIZE> signature{};
+	if (file.size() < signature.size()) {
+		throw std::runtime_error("Image File Error: This is not a pdvrdt image.");
+	}
+	readExactAt(file.fd(), signature.data(), signature.size(), 0);
+	requirePngSignature(signature, "Image File Error: This is not a pdvrdt image.");
 
-	std::optional<EmbeddedProfile> embedded_profile{};
+	std::optional<EmbeddedProfileLocation> embedded_profile{};
 	bool has_iend = false;
 	bool has_ihdr = false;
 	bool has_iccp = false;
 	std::size_t end_offset = 0;
 
-	auto storeMastodonProfile = [&](vBytes decompressed) {
-		if (embedded_profile.has_value()) {
-			throw std::runtime_error("Image File Error: Multiple embedded payloads detected.");
-		}
-		embedded_profile = EmbeddedProfile{ .is_mastodon = true, .decompressed = std::move(decompressed) };
-	};
-	auto storeDefaultProfileLocation = [&](std::size_t offset, std::size_t length) {
+	auto storeProfile = [&](EmbeddedProfileLocation location) {
 		if (embedded_profile.has_value()) {
 			throw std::runtime_error("Image File Error: Multiple embedded payloads detected.");
 		}
-		embedded_profile = EmbeddedProfile{ .is_mastodon = false, .offset = offset, .length = length };
+		embedded_profile = std::move(location);
 	};
 
+	// Two halves of one read block per worker: the payload IDAT is the bulk of
+	// the file, and every byte of it is CRC'd here before the PIN prompt.
+	vBytes block(2 * READ_BLOCK_SIZE * sharedThreadPool().size());
 	std::size_t pos = PNG_HEADER_SIZE;
-	while (pos < png_vec.size()) {
-		const PngChunkView chunk = readPngChunk(
-			png_vec,
-			pos,
-			"Image File Error: Corrupt PNG chunk header.",
-			"Image File Error: Corrupt PNG chunk length.",
-			"Image File Error: Corrupt PNG chunk CRC."
-		);
+	while (pos < file.size()) {
+		// Candidates are recognised from the chunk's first block, which the CRC
+		// pass reads anyway; only a Mastodon candidate is followed further.
+		std::uint32_t chunk_type = 0;
+		std::size_t chunk_length = 0;
+		{
+			std::array<Byte, CHUNK_HEADER_BYTES> header{};
+			if (pos <= file.size() && header.size() <= file.size() - pos) {
+				readExactAt(file.fd(), header.data(), header.size(), pos);
+				chunk_length = getValue(header, 0);
+				chunk_type = getValue(header, 4);
+			}
+		}
+
+		if (chunk_type == TYPE_ICCP && has_iccp) {
+			throw std::runtime_error("Image File Error: Corrupt PNG structure. Duplicate iCCP chunk.");
+		}
+
+		vBytes idat_head{};
+		std::optional<MastodonProfileScan> mastodon_scan{};
+		bool is_first_block = true;
+		const std::size_t data_offset = pos + CHUNK_HEADER_BYTES;
+
+		const ChunkInfo chunk = readPngChunkAt(file, pos, block, [&](std::span<const Byte> data) {
+			if (is_first_block) {
+				is_first_block = false;
+				if (chunk_type == TYPE_IDAT && bytesEqualAt(data, 0, PDVRDT_IDAT_PREFIX)) {
+					const std::span<const Byte> profile = data.subspan(PDVRDT_IDAT_PREFIX.size());
+					idat_head.assign(profile.begin(), profile.begin() +
+						static_cast<std::ptrdiff_t>(std::min(profile.size(), DEFAULT_OFFSETS.encrypted_file)));
+				} else if (chunk_type == TYPE_ICCP && findPdvrdtIccpPayload(data)) {
+					mastodon_scan.emplace(data_offset + PDVRDT_ICCP_PREFIX.size());
+					data = data.subspan(PDVRDT_ICCP_PREFIX.size());
+				}
+			}
+			if (mastodon_scan) {
+				mastodon_scan->feed(data);
+			}
+		});
 
 		if (!has_ihdr) {
 			if (chunk.type != TYPE_IHDR || chunk.length != IHDR_DATA_SIZE) {
@@ -216,16 +431,22 @@ EmbeddedProfile locateEmbeddedData(const vBytes& png_vec) {
 		}
 
 		if (chunk.type == TYPE_ICCP) {
-			if (has_iccp) {
-				throw std::runtime_error("Image File Error: Corrupt PNG structure. Duplicate iCCP chunk.");
-			}
 			has_iccp = true;
-			if (auto profile = tryExtractMastodonProfileFromIccp(chunk.data)) {
-				storeMastodonProfile(std::move(*profile));
+			if (mastodon_scan) {
+				if (auto location = mastodon_scan->finish(chunk_length - PDVRDT_ICCP_PREFIX.size())) {
+					storeProfile(std::move(*location));
+				}
 			}
-		} else if (chunk.type == TYPE_IDAT) {
-			if (auto loc = tryLocateDefaultProfileInIdat(chunk.offset, chunk.data)) {
-				storeDefaultProfileLocation(loc->first, loc->second);
+		} else if (chunk.type == TYPE_IDAT && !idat_head.empty()) {
+			const std::size_t profile_size = chunk.length - PDVRDT_IDAT_PREFIX.size();
+			if (isRecoverableProfile(idat_head, profile_size, DEFAULT_OFFSETS)) {
+				storeProfile(EmbeddedProfileLocation{
+					.is_mastodon = false,
+					.offset = data_offset + PDVRDT_IDAT_PREFIX.size(),
+					.stored_size = profile_size,
+					.size = profile_size,
+					.head = std::move(idat_head)
+				});
 			}
 		}
 
@@ -241,31 +462,463 @@ EmbeddedProfile locateEmbeddedData(const vBytes& png_vec) {
 	if (!has_iend) {
 		throw std::runtime_error("Image File Error: Corrupt PNG structure. Missing IEND.");
 	}
-	if (end_offset != png_vec.size()) {
+	if (end_offset != file.size()) {
 		throw std::runtime_error("Image File Error: Corrupt PNG structure. Unexpected trailing data after IEND.");
 	}
+	verifyExpectedEof(file.fd(), file.size());
 	if (embedded_profile) {
 		return std::move(*embedded_profile);
 	}
 	throw std::runtime_error("Image File Error: This is not a pdvrdt image.");
 }
 
-void replaceWithEmbeddedProfile(vBytes& png_vec, EmbeddedProfile&& embedded) {
-	if (embedded.is_mastodon) {
-		png_vec = std::move(embedded.decompressed);
+// Presents the located profile to decryptDataStream(): a default profile is
+// read straight from the file at whatever offset a frame needs, a Mastodon one
+// is inflated again from its iCCP chunk on every replay.
+[[nodiscard]] EmbeddedProfileStream makeProfileStream(
+	const OpenInputFile& file, EmbeddedProfileLocation& location, vBytes& block) {
+
+	EmbeddedProfileStream stream{ .size = location.size, .head = std::move(location.head) };
+
+	stream.read_tail = [&file, &location](std::span<Byte> out) {
+		if (out.size() > location.size) {
+			throw std::runtime_error("File Recovery Error: Embedded profile is corrupt.");
+		}
+		if (!location.is_mastodon) {
+			readExactAt(file.fd(), out.data(), out.size(), location.offset + location.size - out.size());
+			return;
+		}
+		if (out.size() > location.tail.size()) {
+			throw std::runtime_error("File Recovery Error: Embedded profile is corrupt.");
+		}
+		std::memcpy(out.data(), location.tail.data() + (location.tail.size() - out.size()), out.size());
+	};
+
+	if (!location.is_mastodon) {
+		stream.read_at = [&file, &location](std::span<Byte> out, std::size_t offset) {
+			if (offset > location.size || out.size() > location.size - offset) {
+				throw std::runtime_error("File Recovery Error: Embedded profile is corrupt.");
+			}
+			readExactAt(file.fd(), out.data(), out.size(), location.offset + offset);
+		};
+	}
+
+	stream.replay = [&file, &location, &block](const DecryptedOutputHandler& on_bytes) {
+		if (!location.is_mastodon) {
+			forEachBlock(file.fd(), location.offset, location.stored_size, block, on_bytes);
+			return;
+		}
+		ZlibInflateStream inflater(MAX_MASTODON_PROFILE_BYTES, on_bytes);
+		forEachBlock(file.fd(), location.offset, location.stored_size, block,
+			[&](std::span<const Byte> compressed) { inflater.feed(compressed); });
+		inflater.finish();
+		if (inflater.totalOutput() != location.size) {
+			throw std::runtime_error("File Recovery Error: Embedded profile is corrupt.");
+		}
+	};
+
+	return stream;
+}
+
+// The write stage of recover's pipeline. Inflated output is copied into one of
+// a few fixed buffers and written out by a dedicated thread, so inflate never
+// stalls on the disk and the disk never waits for inflate. A full set of
+// buffers blocks the producer, which is what bounds memory whatever the
+// payload size.
+//
+// A write error stops the writer and is rethrown by the next write() or by
+// finish(). Every exit joins the writer before the buffers it reads go away.
+class PipelinedFdWriter {
+public:
+	explicit PipelinedFdWriter(int fd)
+		: fd_(fd), buffers_(WRITE_BUFFER_COUNT), filled_(WRITE_BUFFER_COUNT), free_(WRITE_BUFFER_COUNT) {
+		for (std::size_t slot = 0; slot < buffers_.size(); ++slot) {
+			buffers_[slot].resize(WRITE_BUFFER_SIZE);
+			(void)free_.push(slot);
+		}
+		writer_ = std::jthread([this] { writeLoop(); });
+	}
+
+	PipelinedFdWriter(const PipelinedFdWriter&) = delete;
+	PipelinedFdWriter& operator=(const PipelinedFdWriter&) = delete;
+
+	~PipelinedFdWriter() {
+		stop();
+		for (auto& buffer : buffers_) {
+			sodium_memzero(buffer.data(), buffer.size());
+		}
+	}
+
+	void write(std::span<const Byte> data) {
+		while (!data.empty()) {
+			if (!fill_slot_) {
+				fill_slot_ = free_.pop();
+				if (!fill_slot_) {
+					rethrowWriteError();
+					throw std::runtime_error("Write File Error: Output writer stopped.");
+				}
+			}
+			vBytes& buffer = buffers_[*fill_slot_];
+			const std::size_t take = std::min(data.size(), buffer.size() - fill_size_);
+			std::memcpy(buffer.data() + fill_size_, data.data(), take);
+			fill_size_ += take;
+			data = data.subspan(take);
+			if (fill_size_ == buffer.size()) {
+				pushFillSlot();
+			}
+		}
+	}
+
+	// Writes out what is buffered and waits for the writer to finish.
+	void finish() {
+		if (fill_slot_) {
+			pushFillSlot();
+		}
+		stop();
+		rethrowWriteError();
+	}
+
+private:
+	static constexpr std::size_t WRITE_BUFFER_SIZE = 1 * 1024 * 1024;
+	static constexpr std::size_t WRITE_BUFFER_COUNT = 4;
+
+	struct FilledBuffer {
+		std::size_t slot{};
+		std::size_t size{};
+	};
+
+	void writeLoop() {
+		while (std::optional<FilledBuffer> filled = filled_.pop()) {
+			if (!error_) {
+				try {
+					writeAllToFd(fd_, std::span<const Byte>(buffers_[filled->slot].data(), filled->size));
+				} catch (...) {
+					error_ = std::current_exception();
+					free_.close();
+				}
+			}
+			(void)free_.push(filled->slot);
+		}
+	}
+
+	void pushFillSlot() {
+		(void)filled_.push(FilledBuffer{ *fill_slot_, fill_size_ });
+		fill_slot_.reset();
+		fill_size_ = 0;
+	}
+
+	void stop() noexcept {
+		filled_.close();
+		if (writer_.joinable()) {
+			writer_.join();
+		}
+	}
+
+	void rethrowWriteError() const {
+		if (error_) {
+			std::rethrow_exception(error_);
+		}
+	}
+
+	int fd_;
+	std::vector<vBytes> buffers_;
+	SpscRing<FilledBuffer> filled_;
+	SpscRing<std::size_t> free_;
+	std::optional<std::size_t> fill_slot_{};
+	std::size_t fill_size_{};
+	// Set by the writer before it closes `free_`, read by the producer after;
+	// the ring's mutex orders the two.
+	std::exception_ptr error_{};
+	std::jthread writer_{};
+};
+
+// `range` cut short at the end of a file of `file_size` bytes. Throws if it
+// starts at or past that end.
+[[nodiscard]] ByteRange clipRange(const ByteRange& range, std::size_t file_size) {
+	if (range.offset >= file_size) {
+		throw std::runtime_error(std::format(
+			"File Recovery Error: Range starts past the end of the embedded file ({} bytes).", file_size));
+	}
+	return ByteRange{ .offset = range.offset, .length = std::min(range.length, file_size - range.offset) };
+}
+
+// The part of `data`, decoded bytes from `offset` on, that falls inside
+// `range`, and where that part starts within the range.
+struct RangeSlice {
+	std::size_t offset{};
+	std::span<const Byte> data{};
+};
+
+[[nodiscard]] RangeSlice sliceToRange(const ByteRange& range, std::size_t offset, std::span<const Byte> data) {
+	const std::size_t begin = std::max(offset, range.offset);
+	const std::size_t end = std::min(offset + data.size(), range.offset + range.length);
+	if (begin >= end) {
+		return {};
+	}
+	return RangeSlice{ .offset = begin - range.offset, .data = data.subspan(begin - offset, end - begin) };
+}
+
+// The inflate stage of recover. With a KDF3 payload's metadata in hand the
+// output size is known: the destination is preallocated, the inflater is held
+// to exactly that size, and a payload small enough is decoded with one
+// libdeflate call instead of streaming. A large payload with a segment index is
+// inflated a segment per pool worker, each written straight to its offset in
+// the output. Older payloads stream under the global ceiling.
+//
+// Given a range, the whole payload is still decoded, but only the bytes inside
+// the range are written.
+class PayloadDecoder {
+public:
+	PayloadDecoder(
+		PipelinedFdWriter& writer,
+		int fd,
+		const std::optional<PayloadMetadata>& metadata,
+		std::span<const Byte> segment_index,
+		const std::optional<ByteRange>& range)
+		: writer_(writer) {
+		if (range) {
+			range_ = ByteRange{
+				.offset = range->offset,
+				.length = std::min(range->length, std::numeric_limits<std::size_t>::max() - range->offset)
+			};
+		}
+		if (!metadata) {
+			inflater_.emplace(MAX_INFLATED_OUTPUT_SIZE, [this](std::span<const Byte> data) { writeInOrder(data); });
+			return;
+		}
+		const auto expected_size = static_cast<std::size_t>(metadata->original_size);
+		const auto compressed_size = static_cast<std::size_t>(metadata->compressed_size);
+		expected_size_ = expected_size;
+		compressed_size_ = compressed_size;
+		if (expected_size <= MAX_ONE_SHOT_INFLATE_SIZE) {
+			one_shot_input_.reserve(compressed_size);
+		} else if (!segment_index.empty()) {
+			segment_inflater_.emplace(
+				decodeDeflateSegmentIndex(segment_index, expected_size, compressed_size),
+				expected_size,
+				[this, fd](std::size_t offset, std::span<const Byte> data) {
+					const RangeSlice slice = sliceToRange(range_, offset, data);
+					if (!slice.data.empty()) {
+						pwriteAllToFd(fd, slice.data, slice.offset);
+					}
+				});
+		} else {
+			inflater_.emplace(expected_size, [this](std::span<const Byte> data) { writeInOrder(data); });
+		}
+	}
+
+	PayloadDecoder(const PayloadDecoder&) = delete;
+	PayloadDecoder& operator=(const PayloadDecoder&) = delete;
+
+	void feed(std::span<const Byte> payload) {
+		// Anything past the compressed stream is its segment index, already in
+		// hand or not needed.
+		if (compressed_size_) {
+			payload = payload.first(std::min(payload.size(), *compressed_size_ - fed_size_));
+		}
+		fed_size_ += payload.size();
+		if (payload.empty()) {
+			return;
+		}
+		if (segment_inflater_) {
+			segment_inflater_->feed(payload);
+		} else if (inflater_) {
+			inflater_->feed(payload);
+		} else {
+			appendBytes(one_shot_input_, payload, "File Recovery Error: Embedded profile is corrupt.");
+		}
+	}
+
+	// Returns the decoded size, range or not.
+	[[nodiscard]] std::size_t finish() {
+		std::size_t recovered_size = 0;
+		if (segment_inflater_) {
+			segment_inflater_->finish();
+			recovered_size = *expected_size_;
+		} else if (inflater_) {
+			inflater_->finish();
+			recovered_size = inflater_->totalOutput();
+		} else {
+			vBytes output(*expected_size_);
+			ScopedWipe output_wipe{output};
+			zlibInflateExact(one_shot_input_, output);
+			writeInOrder(output);
+			recovered_size = output.size();
+		}
+		if (expected_size_ && recovered_size != *expected_size_) {
+			throw std::runtime_error("File Recovery Error: Embedded profile is corrupt.");
+		}
+		if (recovered_size == 0) {
+			throw std::runtime_error("Zlib Compression Error: Output file is empty. Inflating file failed.");
+		}
+		return recovered_size;
+	}
+
+private:
+	void writeInOrder(std::span<const Byte> data) {
+		const RangeSlice slice = sliceToRange(range_, output_size_, data);
+		output_size_ += data.size();
+		if (!slice.data.empty()) {
+			writer_.write(slice.data);
+		}
+	}
+
+	PipelinedFdWriter& writer_;
+	ByteRange range_{ .offset = 0, .length = std::numeric_limits<std::size_t>::max() };
+	std::optional<std::size_t> expected_size_{};
+	std::optional<std::size_t> compressed_size_{};
+	std::size_t fed_size_{};
+	std::size_t output_size_{};
+	std::optional<ZlibInflateStream> inflater_{};
+	std::optional<ZlibSegmentInflater> segment_inflater_{};
+	vBytes one_shot_input_{};
+	ScopedWipe<vBytes> one_shot_input_wipe_{one_shot_input_};
+};
+
+// Decodes just the part of a KDF3 payload that holds `range`, which must lie
+// inside the file, reading only the compressed bytes that needs. With a segment
+// index that is the segments overlapping the range, each inflated on its own;
+// without one, the stream from its start up to the range's end.
+//
+// No Adler-32 trailer is checked, as the stream is never decoded whole. Every
+// byte read went through a frame that authenticated, and each segment must
+// decode to exactly its size.
+void extractPayloadRange(
+	PipelinedFdWriter& writer,
+	const PayloadMetadata& metadata,
+	std::span<const Byte> segment_index,
+	const PayloadRangeReader& read_payload,
+	const ByteRange& range) {
+
+	const auto original_size = static_cast<std::size_t>(metadata.original_size);
+	const auto compressed_size = static_cast<std::size_t>(metadata.compressed_size);
+	const std::size_t range_end = range.offset + range.length;
+
+	if (!segment_index.empty()) {
+		const DeflateSegmentIndex index = decodeDeflateSegmentIndex(segment_index, original_size, compressed_size);
+		const std::size_t first = range.offset / index.segment_size;
+		const std::size_t last = (range_end - 1) / index.segment_size;
+
+		vBytes input(*std::ranges::max_element(index.compressed_sizes) + DEFLATE_SEGMENT_SLACK_BYTES);
+		vBytes output(index.segment_size);
+		ScopedWipe input_wipe{input};
+		ScopedWipe output_wipe{output};
+		for (std::size_t segment = first; segment <= last; ++segment) {
+			const DeflateSegmentSpan where = deflateSegmentAt(index, original_size, segment);
+			read_payload(std::span<Byte>(input.data(), where.compressed_size), where.compressed_offset);
+			const std::span<Byte> decoded(output.data(), where.output_size);
+			(void)inflateDeflateSegment(
+				std::span<Byte>(input.data(), where.compressed_size + DEFLATE_SEGMENT_SLACK_BYTES),
+				segment + 1 == index.compressed_sizes.size(),
+				decoded);
+			writer.write(sliceToRange(range, where.output_offset, decoded).data);
+		}
 		return;
 	}
 
-	std::memmove(png_vec.data(), png_vec.data() + embedded.offset, embedded.length);
-	png_vec.resize(embedded.length);
+	std::size_t decoded_size = 0;
+	ZlibInflateStream inflater(original_size, [&](std::span<const Byte> data) {
+		writer.write(sliceToRange(range, decoded_size, data).data);
+		decoded_size += data.size();
+	});
+	vBytes block(READ_BLOCK_SIZE);
+	ScopedWipe block_wipe{block};
+	std::size_t offset = 0;
+	while (offset < compressed_size && decoded_size < range_end) {
+		const std::span<Byte> compressed(block.data(), std::min(block.size(), compressed_size - offset));
+		read_payload(compressed, offset);
+		inflater.feed(compressed);
+		offset += compressed.size();
+	}
+	if (offset == compressed_size) {
+		inflater.finish();
+	}
+	if (decoded_size < range_end) {
+		throw std::runtime_error("File Recovery Error: Embedded profile is corrupt.");
+	}
 }
 
-[[nodiscard]] std::size_t writeRecoveredPayload(const vBytes& compressed_payload, const fs::path& output_path) {
-	StagedOutputFile staged_file = createStagedOutputFile(output_path);
+} // namespace
+
+void recoverData(const fs::path& image_path, const std::optional<ByteRange>& range) {
+	const OpenInputFile file = openInputFile(image_path, FileTypeCheck::embedded_image);
+	EmbeddedProfileLocation location = locateEmbeddedData(file);
+
+	vBytes block(READ_BLOCK_SIZE);
+	const EmbeddedProfileStream profile = makeProfileStream(file, location, block);
+
+	fs::path output_path{};
+	StagedOutputFile staged_file{};
+	std::optional<PipelinedFdWriter> writer{};
+	std::optional<PayloadDecoder> decoder{};
 	std::size_t recovered_size = 0;
+	std::optional<ByteRange> written_range{};
 
 	try {
-		recovered_size = zlibInflateToFd(compressed_payload, staged_file.fd);
+		auto requireRecoverableSize = [](const PayloadMetadata& metadata) {
+			if (metadata.original_size > MAX_INFLATED_OUTPUT_SIZE) {
+				throw std::runtime_error("File Recovery Error: Embedded file is too large to recover.");
+			}
+		};
+		auto stageOutput = [&](std::string& filename, std::optional<std::size_t> output_size) {
+			output_path = safeRecoveryPath(filename);
+			staged_file = createStagedOutputFile(output_path);
+			if (output_size) {
+				preallocateFd(staged_file.fd, *output_size);
+			}
+			writer.emplace(staged_file.fd);
+		};
+
+		bool authentic = false;
+		if (range && isSeekablePayload(profile, location.is_mastodon)) {
+			// Only the frames and segments holding the range are ever touched.
+			auto on_payload = [&](
+				std::string& filename,
+				const PayloadMetadata& metadata,
+				std::span<const Byte> segment_index,
+				const PayloadRangeReader& read_payload) {
+				requireRecoverableSize(metadata);
+				written_range = clipRange(*range, static_cast<std::size_t>(metadata.original_size));
+				stageOutput(filename, written_range->length);
+				extractPayloadRange(*writer, metadata, segment_index, read_payload, *written_range);
+				recovered_size = static_cast<std::size_t>(metadata.original_size);
+			};
+			authentic = decryptDataSeekable(profile, location.is_mastodon, on_payload);
+		} else {
+			// The filename is the first thing decryption yields, so the staged file
+			// exists before the first payload byte needs somewhere to go.
+			auto on_header = [&](
+				std::string& filename,
+				const std::optional<PayloadMetadata>& metadata,
+				std::span<const Byte> segment_index) {
+				std::optional<std::size_t> output_size{};
+				if (metadata) {
+					requireRecoverableSize(*metadata);
+					output_size = static_cast<std::size_t>(metadata->original_size);
+					if (range) {
+						output_size = clipRange(*range, *output_size).length;
+					}
+				}
+				stageOutput(filename, output_size);
+				decoder.emplace(*writer, staged_file.fd, metadata, segment_index, range);
+			};
+			auto on_payload = [&](std::span<const Byte> compressed) {
+				decoder->feed(compressed);
+			};
+			authentic = decryptDataStream(profile, location.is_mastodon, on_header, on_payload);
+			if (authentic) {
+				recovered_size = decoder->finish();
+				if (range) {
+					written_range = clipRange(*range, recovered_size);
+				}
+			}
+		}
+
+		if (!authentic) {
+			throw std::runtime_error("File Recovery Error: Invalid PIN or file is corrupt.");
+		}
+		writer->finish();
+
 		// Flush the payload before publishing the name: renameat2() is atomic with
 		// respect to the directory entry, but without this a crash can leave the
 		// final filename pointing at a truncated or empty file.
@@ -274,37 +927,22 @@ void replaceWithEmbeddedProfile(vBytes& png_vec, EmbeddedProfile&& embedded) {
 		commitRecoveredOutput(staged_file.path, output_path);
 		fsyncParentDirectoryNoThrow(output_path);
 	} catch (...) {
-		closeFdNoThrow(staged_file.fd);
-		cleanupPathNoThrow(staged_file.path);
+		// The writer must stop before its descriptor closes.
+		decoder.reset();
+		writer.reset();
+		if (!staged_file.path.empty()) {
+			closeFdNoThrow(staged_file.fd);
+			cleanupPathNoThrow(staged_file.path);
+		}
 		throw;
 	}
 
-	return recovered_size;
-}
-
-} // namespace
-
-void recoverData(vBytes& png_vec) {
-	auto embedded = locateEmbeddedData(png_vec);
-	const bool is_mastodon = embedded.is_mastodon;
-	replaceWithEmbeddedProfile(png_vec, std::move(embedded));
-	// Decryption is in-place. Install the guard before authentication/parsing so
-	// every exception after plaintext first exists still scrubs the allocation.
-	ScopedWipe plaintext_wiper{png_vec};
-
-	auto result = decryptDataFile(png_vec, is_mastodon);
-	if (!result) {
-		throw std::runtime_error("File Recovery Error: Invalid PIN or file is corrupt.");
+	if (written_range) {
+		std::println("\nExtracted bytes {} to {} of hidden file: {} ({} of {} bytes).\n\nComplete! Please check your file.\n",
+			written_range->offset, written_range->offset + written_range->length,
+			output_path.string(), written_range->length, recovered_size);
+		return;
 	}
-
-	// The std::move into safeRecoveryPath transfers ownership to fs::path internal
-	// storage (which we can't portably wipe), but this still scrubs *result on
-	// any exception path between here and the move.
-	ScopedWipe filename_wiper{*result};
-
-	fs::path output_path = safeRecoveryPath(std::move(*result));
-	const std::size_t recovered_size = writeRecoveredPayload(png_vec, output_path);
-
 	std::println("\nExtracted hidden file: {} ({} bytes).\n\nComplete! Please check your file.\n",
 		output_path.string(), recovered_size);
 }
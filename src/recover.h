@@ -2,4 +2,10 @@
 
 #include "common.h"
 
-void recoverData(vBytes& png_vec);
+#include <optional>
+
+// Streams the payload out of the image at `image_path`: neither the image nor
+// the recovered file is ever held in memory whole. Given `range`, only that
+// part of the recovered file is written, and for a payload that allows random
+// access only the part of it holding the range is decrypted and inflated.
+void recoverData(const fs::path& image_path, const std::optional<ByteRange>& range);
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+// Bounded single-producer/single-consumer ring joining two pipeline stages. A
+// full ring blocks the producer and an empty one blocks the consumer, so a stage
+// that runs ahead waits instead of buffering without limit: memory is the ring
+// capacity times the item size, whatever the payload size.
+//
+// close() ends the stream: the consumer still receives every item already queued
+// and then nullopt, and any later push() is refused. Either side may close, which
+// is how a failing stage stops the other one.
+template <typename T>
+class SpscRing {
+public:
+	explicit SpscRing(std::size_t capacity) : slots_(capacity == 0 ? 1 : capacity) {}
+
+	SpscRing(const SpscRing&) = delete;
+	SpscRing& operator=(const SpscRing&) = delete;
+
+	// Blocks while the ring is full. False if the ring was closed; the value is
+	// then dropped.
+	bool push(T value) {
+		std::unique_lock lock(mutex_);
+		not_full_.wait(lock, [this] { return closed_ || count_ < slots_.size(); });
+		if (closed_) return false;
+		slots_[(head_ + count_) % slots_.size()] = std::move(value);
+		++count_;
+		lock.unlock();
+		not_empty_.notify_one();
+		return true;
+	}
+
+	// Blocks while the ring is empty and open. nullopt once closed and drained.
+	[[nodiscard]] std::optional<T> pop() {
+		std::unique_lock lock(mutex_);
+		not_empty_.wait(lock, [this] { return closed_ || count_ != 0; });
+		if (count_ == 0) return std::nullopt;
+		std::optional<T> value(std::move(slots_[head_]));
+		head_ = (head_ + 1) % slots_.size();
+		--count_;
+		lock.unlock();
+		not_full_.notify_one();
+		return value;
+	}
+
+	void close() noexcept {
+		{
+			const std::lock_guard lock(mutex_);
+			closed_ = true;
+		}
+		not_empty_.notify_all();
+		not_full_.notify_all();
+	}
+
+private:
+	std::mutex mutex_;
+	std::condition_variable not_empty_;
+	std::condition_variable not_full_;
+	std::vector<T> slots_;
+	std::size_t head_{};
+	std::size_t count_{};
+	bool closed_{false};
+};
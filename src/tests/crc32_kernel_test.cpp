@@ -0,0 +1,107 @@
+// Checks every CRC-32 kernel this CPU can run against zlib's crc32(), over
+// random lengths, start alignments and seeds, and pdvrdtCrc32Combine() and
+// pdvrdtCrc32UpdateParallel() over random splits. Unlike the runtime self-test,
+// which quietly drops to a narrower kernel, a mismatch here fails.
+#include "png_utils.h"
+
+#include <zlib.h>
+
+#include <format>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string_view>
+
+namespace {
+
+std::string_view kernelName(Crc32Kernel kernel) {
+	switch (kernel) {
+		case Crc32Kernel::Scalar:     return "scalar";
+		case Crc32Kernel::Pclmul:     return "PCLMULQDQ";
+		case Crc32Kernel::Vpclmul256: return "AVX2 VPCLMULQDQ";
+		case Crc32Kernel::Vpclmul512: return "AVX-512 VPCLMULQDQ";
+	}
+	return "?";
+}
+
+std::uint32_t zlibCrc(std::uint32_t crc, std::span<const Byte> data) {
+	return static_cast<std::uint32_t>(::crc32_z(crc, data.data(), data.size()));
+}
+
+} // namespace
+
+int main() {
+	try {
+		std::mt19937_64 rng(0xC3C32);
+		vBytes buffer(256 * 1024 + 64);
+		for (Byte& value : buffer) value = static_cast<Byte>(rng());
+		const std::span<const Byte> all(buffer);
+
+		std::uniform_int_distribution<std::size_t> start_of(0, 63);
+		std::uniform_int_distribution<std::size_t> short_length(0, 1024);
+		std::uniform_int_distribution<std::size_t> long_length(0, buffer.size() - 64);
+		std::uniform_int_distribution<std::uint32_t> seed_of;
+
+		std::size_t checked = 0;
+		for (const Crc32Kernel kernel : {Crc32Kernel::Scalar, Crc32Kernel::Pclmul, Crc32Kernel::Vpclmul256, Crc32Kernel::Vpclmul512}) {
+			if (!crc32KernelSupported(kernel)) {
+				std::cout << "[SKIP] " << kernelName(kernel) << " CRC-32 kernel: not supported by this CPU\n";
+				continue;
+			}
+			const auto check = [&](std::size_t start, std::size_t length, std::uint32_t seed) {
+				const std::span<const Byte> data = all.subspan(start, length);
+				if (pdvrdtCrc32UpdateWith(kernel, seed, data) != zlibCrc(seed, data)) {
+					throw std::runtime_error(std::format(
+						"{}: CRC-32 of {} bytes at offset {} seeded {:#010x} differs from zlib",
+						kernelName(kernel), length, start, seed));
+				}
+				++checked;
+			};
+			// Every length across each kernel's stage boundaries, from every
+			// alignment of a 64-byte line.
+			for (std::size_t start = 0; start < 64; ++start) {
+				for (std::size_t length = 0; length <= 640; ++length) {
+					check(start, length, 0);
+				}
+			}
+			for (int round = 0; round < 4000; ++round) {
+				check(start_of(rng), short_length(rng), seed_of(rng));
+				check(start_of(rng), long_length(rng), seed_of(rng));
+			}
+			std::cout << "[PASS] " << kernelName(kernel) << " CRC-32 kernel matches zlib\n";
+		}
+
+		for (int round = 0; round < 2000; ++round) {
+			const std::size_t start = start_of(rng);
+			const std::span<const Byte> data = all.subspan(start, long_length(rng));
+			const std::size_t split = std::uniform_int_distribution<std::size_t>(0, data.size())(rng);
+			const std::span<const Byte> head = data.first(split);
+			const std::span<const Byte> tail = data.subspan(split);
+			const std::uint32_t combined = pdvrdtCrc32Combine(
+				pdvrdtCrc32Update(0, head), pdvrdtCrc32Update(0, tail), tail.size());
+			if (combined != zlibCrc(0, data) ||
+				combined != static_cast<std::uint32_t>(::crc32_combine(zlibCrc(0, head), zlibCrc(0, tail), static_cast<z_off_t>(tail.size())))) {
+				throw std::runtime_error(std::format(
+					"pdvrdtCrc32Combine() of {} + {} bytes differs from zlib", head.size(), tail.size()));
+			}
+		}
+		std::cout << "[PASS] pdvrdtCrc32Combine() matches zlib over random splits\n";
+
+		// Large enough to be split across the pool.
+		vBytes large(48 * 1024 * 1024 + 777);
+		for (Byte& value : large) value = static_cast<Byte>(rng());
+		for (const std::size_t start : {std::size_t{0}, std::size_t{5}}) {
+			const std::span<const Byte> data = std::span<const Byte>(large).subspan(start);
+			const std::uint32_t seed = seed_of(rng);
+			if (pdvrdtCrc32UpdateParallel(seed, data) != zlibCrc(seed, data)) {
+				throw std::runtime_error(std::format("pdvrdtCrc32UpdateParallel() of {} bytes differs from zlib", data.size()));
+			}
+		}
+		std::cout << "[PASS] pdvrdtCrc32UpdateParallel() matches zlib\n";
+		std::cout << "[PASS] " << checked << " spans CRC'd exactly\n";
+		return 0;
+	} catch (const std::exception& error) {
+		std::cerr << error.what() << '\n';
+		return 1;
+	}
+}
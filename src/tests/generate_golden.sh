@@ -84,23 +84,31 @@ extract_pin() {
     sed -n 's/.*Recovery PIN: \[\*\*\*\([0-9][0-9]*\)\*\*\*\].*/\1/p' "$1" | tail -n 1
 }
 
-# case_id  option(.|-m)  payload_rel  kind(default|mastodon)
-# "." means the default (no) conceal option.
+# case_id  option(.|-m)  payload_rel  kind(default|mastodon)  format(xchacha|aesgcm)
+# "." means the default (no) conceal option. The format picks the KDF3 payload
+# cipher through PDVRDT_PAYLOAD_CIPHER, so one machine produces both; it needs
+# a CPU with AES-NI for the aesgcm rows.
 CASES=(
-    $'default_text\t.\ttestdata/payloads/payload_text.txt\tdefault'
-    $'default_bin\t.\ttestdata/payloads/payload_bin.bin\tdefault'
-    $'default_stored\t.\ttestdata/payloads/payload_stored.gz\tdefault'
-    $'mastodon_text\t-m\ttestdata/payloads/payload_text.txt\tmastodon'
-    $'mastodon_bin\t-m\ttestdata/payloads/payload_mast.bin\tmastodon'
+    $'kdf3_xchacha_text\t.\ttestdata/payloads/payload_text.txt\tdefault\txchacha'
+    $'kdf3_xchacha_bin\t.\ttestdata/payloads/payload_bin.bin\tdefault\txchacha'
+    $'kdf3_xchacha_mastodon\t-m\ttestdata/payloads/payload_text.txt\tmastodon\txchacha'
+    $'kdf3_aesgcm_text\t.\ttestdata/payloads/payload_text.txt\tdefault\taesgcm'
+    $'kdf3_aesgcm_stored\t.\ttestdata/payloads/payload_stored.gz\tdefault\taesgcm'
+    $'kdf3_aesgcm_mastodon\t-m\ttestdata/payloads/payload_mast.bin\tmastodon\taesgcm'
 )
 
-# Recover-only fixtures for an embed layout no current conceal option produces:
-# the payload IDAT preceded by a 512 KiB all-zero IDAT, as emitted by the
-# retired platform-padding option. They cannot be regenerated, so they are
-# carried forward verbatim from the committed tree — images already published
-# in that layout must keep recovering. Delete these entries (and the matching
-# golden/ directories) only if that compatibility is being dropped on purpose.
-LEGACY_CASES=(
+# Recover-only fixtures no current conceal can produce, carried forward verbatim
+# from the committed tree so that images already published keep recovering:
+# KDF2 (secretstream) payloads in each layout, and the payload IDAT preceded by a
+# 512 KiB all-zero IDAT, as emitted by the retired platform-padding option.
+# Delete these entries (and the matching golden/ directories) only if that
+# compatibility is being dropped on purpose.
+PRESERVED_CASES=(
+    default_text
+    default_bin
+    default_stored
+    mastodon_text
+    mastodon_bin
     legacy_padded_text
     legacy_padded_bin
 )
@@ -113,12 +121,17 @@ STAGED_MANIFEST="$STAGED_GOLDEN/manifest.tsv"
 mkdir -p "$STAGED_GOLDEN"
 
 {
-    printf '%s\t%s\t%s\t%s\t%s\t%s\n' \
-        case_id option payload_rel golden_rel pin kind
+    printf '%s\t%s\t%s\t%s\t%s\t%s\t%s\n' \
+        case_id option payload_rel golden_rel pin kind format
     for row in "${CASES[@]}"; do
-        IFS=$'\t' read -r case_id option payload_rel kind <<<"$row"
+        IFS=$'\t' read -r case_id option payload_rel kind format <<<"$row"
         opt="$option"
         [[ "$opt" == "." ]] && opt=""
+        case "$format" in
+            xchacha) cipher=xchacha20poly1305;;
+            aesgcm) cipher=aes256gcm;;
+            *) echo "Unknown payload format for $case_id: $format" >&2; exit 1;;
+        esac
 
         cover="$TESTS/$COVER_REL"
         payload="$TESTS/$payload_rel"
@@ -133,14 +146,14 @@ mkdir -p "$STAGED_GOLDEN"
         cp "$cover" cover.png
         cp "$payload" "$(basename "$payload")"
         if [[ -n "$opt" ]]; then
-            if ! "$BIN" conceal "$opt" cover.png "$(basename "$payload")" > conceal.log 2>&1; then
+            if ! PDVRDT_PAYLOAD_CIPHER="$cipher" "$BIN" conceal "$opt" cover.png "$(basename "$payload")" > conceal.log 2>&1; then
                 echo "Conceal failed for $case_id:" >&2
                 cat conceal.log >&2
                 popd >/dev/null
                 exit 1
             fi
         else
-            if ! "$BIN" conceal cover.png "$(basename "$payload")" > conceal.log 2>&1; then
+            if ! PDVRDT_PAYLOAD_CIPHER="$cipher" "$BIN" conceal cover.png "$(basename "$payload")" > conceal.log 2>&1; then
                 echo "Conceal failed for $case_id:" >&2
                 cat conceal.log >&2
                 popd >/dev/null
@@ -162,20 +175,20 @@ mkdir -p "$STAGED_GOLDEN"
         rm -rf -- "$CURRENT_WORK"
         CURRENT_WORK=""
 
-        printf '%s\t%s\t%s\t%s\t%s\t%s\n' \
-            "$case_id" "$option" "$payload_rel" "$golden_rel" "$pin" "$kind"
+        printf '%s\t%s\t%s\t%s\t%s\t%s\t%s\n' \
+            "$case_id" "$option" "$payload_rel" "$golden_rel" "$pin" "$kind" "$format"
     done
 
-    for legacy_case in "${LEGACY_CASES[@]}"; do
-        legacy_row="$(awk -F'\t' -v id="$legacy_case" '$1 == id { print; exit }' "$MANIFEST")"
-        legacy_image="$GOLDEN/$legacy_case/embedded.png"
-        if [[ -z "$legacy_row" || ! -f "$legacy_image" ]]; then
-            echo "Missing preserved fixture for $legacy_case (expected $legacy_image and a manifest row)" >&2
+    for preserved_case in "${PRESERVED_CASES[@]}"; do
+        preserved_row="$(awk -F'\t' -v id="$preserved_case" '$1 == id { print; exit }' "$MANIFEST")"
+        preserved_image="$GOLDEN/$preserved_case/embedded.png"
+        if [[ -z "$preserved_row" || ! -f "$preserved_image" ]]; then
+            echo "Missing preserved fixture for $preserved_case (expected $preserved_image and a manifest row)" >&2
             exit 1
         fi
-        mkdir -p "$STAGED_GOLDEN/$legacy_case"
-        cp "$legacy_image" "$STAGED_GOLDEN/$legacy_case/embedded.png"
-        printf '%s\n' "$legacy_row"
+        mkdir -p "$STAGED_GOLDEN/$preserved_case"
+        cp "$preserved_image" "$STAGED_GOLDEN/$preserved_case/embedded.png"
+        printf '%s\n' "$preserved_row"
     done
 } > "$STAGED_MANIFEST"
 
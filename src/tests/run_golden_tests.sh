@@ -3,8 +3,9 @@
 #
 # Each golden/ case ships a pre-built embedded PNG, its recovery PIN, and the
 # expected payload bytes. This catches regressions in recover, PNG chunk
-# parsing, and the per-mode embed layouts (default IDAT / Mastodon iCCP /
-# legacy padded IDAT) without relying on fresh conceal RNG.
+# parsing, the per-mode embed layouts (default IDAT / Mastodon iCCP / legacy
+# padded IDAT) and the payload formats (KDF2 secretstream, KDF3 frames under
+# XChaCha20-Poly1305 or AES-256-GCM) without relying on fresh conceal RNG.
 set -euo pipefail
 
 TESTS="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
@@ -117,31 +118,45 @@ assert_owner_only_permissions() {
     return 0
 }
 
-# Walk the PNG chunks and assert the per-mode embed layout matches `kind`:
-#   default  -> a pdvrdt IDAT profile chunk (zlib prefix 78 5E 5C + KDF2 magic +
+# Walk the PNG chunks and assert the per-mode embed layout matches `kind`, and
+# the profile's KDF region matches `format` (kdf2, or KDF3 naming the xchacha
+# or aesgcm payload cipher):
+#   default  -> a pdvrdt IDAT profile chunk (zlib prefix 78 5E 5C + KDF magic +
 #               PDVRDT_SIG at profile offset 101), and no iCCP/padding IDAT.
 #   mastodon -> a pdvrdt iCCP chunk ("icc\0\0" prefix) and no pdvrdt IDAT.
 #   legacy_padded -> the pdvrdt IDAT profile chunk preceded by a 512 KiB all-zero
 #               IDAT. Recover-only: no current option emits this layout, but
 #               images already published with it must still recover.
 assert_png_structure() {
-    local image="$1" kind="$2" tag="$3"
-    if ! PDVRDT_IMG="$image" PDVRDT_KIND="$kind" python3 - <<'PY'
-import os, sys
+    local image="$1" kind="$2" format="$3" tag="$4"
+    if ! PDVRDT_IMG="$image" PDVRDT_KIND="$kind" PDVRDT_FORMAT="$format" python3 - <<'PY'
+import os, sys, zlib
 from pathlib import Path
 
 data = Path(os.environ["PDVRDT_IMG"]).read_bytes()
 kind = os.environ["PDVRDT_KIND"]
+fmt = os.environ["PDVRDT_FORMAT"]
 
 PNG_SIG   = bytes([0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A])
 IDAT_PFX  = bytes([0x78, 0x5E, 0x5C])
 PDV_SIG   = bytes([0xC6, 0x50, 0x3C, 0xEA, 0x5E, 0x9D, 0xF9])
 ICCP_PFX  = b"icc\x00\x00"
-KDF2      = b"KDF2"
 KDF_OFF   = 0x2D          # DEFAULT_OFFSETS.kdf_metadata
 SIG_OFF   = 101           # DEFAULT_PDV_SIG_OFFSET
+MAST_KDF_OFF = 0x1BE      # MASTODON_OFFSETS.kdf_metadata
+CIPHER_OFF = 6            # KDF_CIPHER_OFFSET, KDF3 only
 PAD_IDAT_LEN = 0x80000
 
+KDF_FORMATS = {"kdf2": (b"KDF2", None), "xchacha": (b"KDF3", 1), "aesgcm": (b"KDF3", 2)}
+if fmt not in KDF_FORMATS:
+    sys.exit(f"unknown payload format {fmt}")
+MAGIC, CIPHER = KDF_FORMATS[fmt]
+
+def kdf_matches(prof, off):
+    if prof[off:off + 4] != MAGIC:
+        return False
+    return CIPHER is None or (len(prof) > off + CIPHER_OFF and prof[off + CIPHER_OFF] == CIPHER)
+
 if data[:8] != PNG_SIG:
     sys.exit("bad PNG signature")
 
@@ -160,12 +175,18 @@ for ct, body, ln in chunks(data):
     if ct == b"IDAT" and body[:3] == IDAT_PFX:
         prof = body[3:]
         if len(prof) >= SIG_OFF + len(PDV_SIG) and \
-           prof[KDF_OFF:KDF_OFF + 4] == KDF2 and \
+           kdf_matches(prof, KDF_OFF) and \
            prof[SIG_OFF:SIG_OFF + len(PDV_SIG)] == PDV_SIG:
             has_pdv_idat = True
     if ct == b"IDAT" and ln == PAD_IDAT_LEN and body == bytes(ln):
         has_pad_idat = True
     if ct == b"iCCP" and body[:5] == ICCP_PFX:
+        try:
+            prof = zlib.decompress(body[5:])
+        except zlib.error:
+            sys.exit("iCCP profile does not inflate")
+        if not kdf_matches(prof, MAST_KDF_OFF):
+            sys.exit(f"iCCP profile is not a {fmt} payload")
         has_pdv_iccp = True
 
 if kind in ("default", "legacy_padded"):
@@ -191,6 +212,12 @@ PY
 }
 
 EXPECTED_CASE_IDS=(
+    kdf3_xchacha_text
+    kdf3_xchacha_bin
+    kdf3_xchacha_mastodon
+    kdf3_aesgcm_text
+    kdf3_aesgcm_stored
+    kdf3_aesgcm_mastodon
     default_text
     default_bin
     default_stored
@@ -207,11 +234,13 @@ done
 
 PASS=0
 FAIL=0
+SKIP=0
 CASE_COUNT=0
 LINE_NUMBER=0
 
+# Returns 2 for an AES-256-GCM case this CPU cannot decrypt.
 run_case() {
-    local case_id="$1" option="$2" payload_rel="$3" golden_rel="$4" pin="$5" kind="$6"
+    local case_id="$1" option="$2" payload_rel="$3" golden_rel="$4" pin="$5" kind="$6" format="$7"
     local payload="$TESTS/$payload_rel"
     local golden="$TESTS/$golden_rel"
     local work="$WORK_ROOT/$case_id"
@@ -229,11 +258,15 @@ run_case() {
     mkdir -p "$work"
     cp "$golden" "$work/input.png"
 
-    assert_png_structure "$golden" "$kind" "$case_id" || return 1
+    assert_png_structure "$golden" "$kind" "$format" "$case_id" || return 1
 
     pushd "$work" >/dev/null
     if ! printf '%s\n' "$pin" | "$BIN" recover input.png > recover.log 2>&1; then
         popd >/dev/null
+        if [[ "$format" == "aesgcm" ]] && grep -q "which this CPU does not support" "$work/recover.log"; then
+            echo "[SKIP] $case_id: AES-256-GCM is not supported by this CPU"
+            return 2
+        fi
         echo "[FAIL] $case_id: recover command failed" >&2
         cat "$work/recover.log" >&2
         return 1
@@ -266,12 +299,12 @@ run_case() {
 
 WORK_ROOT="$(mktemp -d "${TMPDIR:-/tmp}/pdvrdt-golden-work.XXXXXX")"
 
-while IFS=$'\t' read -r case_id option payload_rel golden_rel pin kind; do
+while IFS=$'\t' read -r case_id option payload_rel golden_rel pin kind format; do
     LINE_NUMBER=$((LINE_NUMBER + 1))
     if [[ "$LINE_NUMBER" -eq 1 ]]; then
         if [[ "$case_id" != "case_id" || "$option" != "option" ||
               "$payload_rel" != "payload_rel" || "$golden_rel" != "golden_rel" ||
-              "$pin" != "pin" || "$kind" != "kind" ]]; then
+              "$pin" != "pin" || "$kind" != "kind" || "$format" != "format" ]]; then
             echo "[FAIL] invalid golden manifest header" >&2
             FAIL=$((FAIL + 1))
         fi
@@ -290,17 +323,19 @@ while IFS=$'\t' read -r case_id option payload_rel golden_rel pin kind; do
         continue
     fi
     SEEN_CASES["$case_id"]=1
-    if [[ -z "$payload_rel" || -z "$golden_rel" || -z "$pin" || -z "$kind" ]]; then
+    if [[ -z "$payload_rel" || -z "$golden_rel" || -z "$pin" || -z "$kind" || -z "$format" ]]; then
         echo "[FAIL] malformed manifest row for case: $case_id" >&2
         FAIL=$((FAIL + 1))
         continue
     fi
     [[ "$option" == "." ]] && option=""
-    if run_case "$case_id" "$option" "$payload_rel" "$golden_rel" "$pin" "$kind"; then
-        PASS=$((PASS + 1))
-    else
-        FAIL=$((FAIL + 1))
-    fi
+    case_status=0
+    run_case "$case_id" "$option" "$payload_rel" "$golden_rel" "$pin" "$kind" "$format" || case_status=$?
+    case "$case_status" in
+        0) PASS=$((PASS + 1));;
+        2) SKIP=$((SKIP + 1));;
+        *) FAIL=$((FAIL + 1));;
+    esac
 done < "$MANIFEST"
 
 if [[ "$CASE_COUNT" -eq 0 ]]; then
@@ -319,7 +354,7 @@ for expected_case in "${EXPECTED_CASE_IDS[@]}"; do
 done
 
 echo
-echo "Golden test summary: PASS=$PASS FAIL=$FAIL"
+echo "Golden test summary: PASS=$PASS FAIL=$FAIL SKIP=$SKIP"
 echo "Binary: $BIN"
 
 if [[ "$FAIL" -ne 0 ]]; then
@@ -1,6 +1,7 @@
 #!/bin/bash
-# Focused PNG optimization regressions: 16-bit fidelity, APNG rejection, and
-# color-profile preservation through both exact-copy and palette paths.
+# Focused PNG optimization regressions: 16-bit fidelity, APNG rejection,
+# color-profile preservation through both exact-copy and palette paths, and the
+# SIMD unfilter kernels against lodepng's scalar code.
 set -euo pipefail
 
 TESTS="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
@@ -23,9 +24,22 @@ if [[ ! -x "$BIN" ]]; then
     exit 1
 fi
 
+if ! command -v "${CXX:-g++}" >/dev/null 2>&1; then
+    echo "Missing required C++ compiler: ${CXX:-g++}" >&2
+    exit 1
+fi
+
 WORK="$(mktemp -d)"
 trap 'rm -rf "$WORK"' EXIT
 
+"${CXX:-g++}" -std=c++23 -O2 -I"$ROOT" \
+    "$TESTS/unfilter_kernel_test.cpp" "$ROOT/lodepng_unfilter.cpp" -o "$WORK/unfilter_kernel_test"
+"$WORK/unfilter_kernel_test"
+"${CXX:-g++}" -std=c++23 -O2 -I"$ROOT" \
+    "$TESTS/crc32_kernel_test.cpp" "$ROOT/lodepng_crc32.cpp" "$ROOT/png_utils.cpp" \
+    "$ROOT/io_utils.cpp" "$ROOT/thread_pool.cpp" -lsodium -lz -pthread -o "$WORK/crc32_kernel_test"
+"$WORK/crc32_kernel_test"
+
 BIN="$BIN" WORK="$WORK" python3 - <<'PY'
 import binascii
 import os
@@ -257,4 +271,185 @@ for apng_kind, apng_body in apng_chunks:
     if list(case_dir.glob("prdt_*.png")):
         raise AssertionError(f"apng_{label}: rejection left an output image")
 print("[PASS] acTL/fcTL/fdAT APNG covers are rejected explicitly")
+
+# Truecolor covers of up to 256 colours are palettized row by row straight off
+# the IDAT stream. Decoding the output must give back the source pixels, with
+# PLTE in first-appearance order and tRNS holding their alpha up to the last
+# non-opaque entry. The source rows use every filter type.
+def paeth(a, b, c):
+    p = a + b - c
+    pa, pb, pc = abs(p - a), abs(p - b), abs(p - c)
+    return a if pa <= pb and pa <= pc else (b if pb <= pc else c)
+
+
+def predict(filter_type, row, prev, i, bpp):
+    a = row[i - bpp] if i >= bpp else 0
+    c = prev[i - bpp] if i >= bpp else 0
+    return (0, a, prev[i], (a + prev[i]) // 2, paeth(a, prev[i], c))[filter_type]
+
+
+def write_filtered_png(path, width, height, color_type, rows, metadata=(), idat_size=None):
+    bpp = {2: 3, 6: 4}[color_type]
+    filtered, prev = bytearray(), bytes(len(rows[0]))
+    for y, row in enumerate(rows):
+        filter_type = y % 5
+        filtered.append(filter_type)
+        filtered += bytes((row[i] - predict(filter_type, row, prev, i, bpp)) & 0xFF for i in range(len(row)))
+        prev = row
+    stream = zlib.compress(bytes(filtered), 9)
+    data = SIG + chunk(b"IHDR", struct.pack(">IIBBBBB", width, height, 8, color_type, 0, 0, 0))
+    for kind, body in metadata:
+        data += chunk(kind, body)
+    step = idat_size or len(stream)
+    for offset in range(0, len(stream), step):
+        data += chunk(b"IDAT", stream[offset:offset + step])
+    path.write_bytes(data + chunk(b"IEND", b""))
+
+
+def decode_rgba(path):
+    """Pixels of a non-interlaced 8-bit PNG as RGBA tuples, plus PLTE and tRNS.
+    The image's zlib stream ends before the pdvrdt payload IDAT, which is skipped."""
+    chunks = parse_png(path)
+    width, height, depth, color_type, _, _, interlace = struct.unpack(">IIBBBBB", chunks[0][1])
+    if depth != 8 or interlace != 0:
+        raise AssertionError(f"{path}: unexpected bit depth {depth} or interlace {interlace}")
+    inflater = zlib.decompressobj()
+    raw = b"".join(inflater.decompress(body) for kind, body in chunks if kind == b"IDAT" and not inflater.eof)
+    plte = next((body for kind, body in chunks if kind == b"PLTE"), b"")
+    trns = next((body for kind, body in chunks if kind == b"tRNS"), b"")
+    bpp = {2: 3, 3: 1, 6: 4}[color_type]
+    stride = width * bpp
+    if not inflater.eof or len(raw) != height * (stride + 1):
+        raise AssertionError(f"{path}: image data does not match IHDR")
+    pixels, prev = [], bytes(stride)
+    for y in range(height):
+        filter_type = raw[y * (stride + 1)]
+        row = bytearray(raw[y * (stride + 1) + 1:(y + 1) * (stride + 1)])
+        for i in range(stride):
+            row[i] = (row[i] + predict(filter_type, row, prev, i, bpp)) & 0xFF
+        for x in range(width):
+            sample = bytes(row[x * bpp:(x + 1) * bpp])
+            if color_type == 3:
+                index = sample[0]
+                pixels.append(plte[3 * index:3 * index + 3] + bytes((trns[index] if index < len(trns) else 255,)))
+            elif color_type == 2:
+                pixels.append(sample + (b"\0" if len(trns) == 6 and sample == trns[1::2] else b"\xff"))
+            else:
+                pixels.append(sample)
+        prev = bytes(row)
+    return pixels, plte, trns
+
+
+def check_palettized(case_name, cover):
+    source, _, _ = decode_rgba(cover)
+    output = conceal(case_name, cover)
+    if parse_png(output)[0][1][8:10] != bytes((8, 3)):
+        raise AssertionError(f"{case_name}: expected palette optimization")
+    pixels, plte, trns = decode_rgba(output)
+    if pixels != source:
+        raise AssertionError(f"{case_name}: palettized pixels differ from the source")
+    order = list(dict.fromkeys(source))
+    if plte != b"".join(colour[:3] for colour in order):
+        raise AssertionError(f"{case_name}: PLTE is not the source colours in first-appearance order")
+    if trns != bytes(colour[3] for colour in order).rstrip(b"\xff"):
+        raise AssertionError(f"{case_name}: tRNS does not carry the palette alpha")
+
+
+COLOURS = [bytes((i, (i * 37) & 0xFF, (i * 101 + 7) & 0xFF)) for i in range(256)]
+keyed = WORK / "rgb8_colour_key.png"
+key = COLOURS[7]
+write_filtered_png(keyed, 90, 80, 2,
+    [b"".join(COLOURS[(x * 3 + y * 5) % 120] for x in range(90)) for y in range(80)],
+    ((b"tRNS", bytes((0, key[0], 0, key[1], 0, key[2]))),))
+check_palettized("rgb8_colour_key", keyed)
+print("[PASS] low-colour RGB8 with a tRNS colour key palettizes to the same pixels")
+
+ALPHAS = (0, 64, 200, 255)
+rgba_low = WORK / "rgba8_low_colour.png"
+write_filtered_png(rgba_low, 90, 80, 6,
+    [b"".join(COLOURS[(x + y * 7) % 200] + bytes((ALPHAS[(x + y * 7) % 200 % 4],)) for x in range(90)) for y in range(80)])
+check_palettized("rgba8_low_colour", rgba_low)
+print("[PASS] low-colour RGBA8 palettizes to the same pixels and alpha")
+
+# Exactly 256 colours over 630 KB of image data in 997-byte IDATs: rows straddle
+# chunk boundaries and the inflater's 256 KiB window boundaries.
+multi_idat = WORK / "rgb8_multi_idat.png"
+write_filtered_png(multi_idat, 700, 300, 2,
+    [b"".join(COLOURS[((x // 3) * 11 + y) % 256] for x in range(700)) for y in range(300)], idat_size=997)
+if sum(kind == b"IDAT" for kind, _ in parse_png(multi_idat)) < 3 or 300 * (700 * 3 + 1) < 2 * 256 * 1024:
+    raise AssertionError("rgb8_multi_idat: fixture no longer crosses chunk and window boundaries")
+check_palettized("rgb8_multi_idat", multi_idat)
+print("[PASS] a 256-colour cover split over many IDATs palettizes across chunk and window boundaries")
+
+# One colour too many for a palette: the cover's image chunks go out untouched.
+many_colours = WORK / "rgb8_257_colours.png"
+write_filtered_png(many_colours, 100, 60, 2,
+    [b"".join(COLOURS[(x + y * 100) % 256] if (x, y) != (99, 59) else b"\x01\x02\x03" for x in range(100)) for y in range(60)],
+    idat_size=4096)
+if len(set(decode_rgba(many_colours)[0])) != 257:
+    raise AssertionError("rgb8_257_colours: fixture should hold exactly 257 colours")
+source_chunks = [entry for entry in parse_png(many_colours) if entry[0] != b"IEND"]
+output_chunks = parse_png(conceal("rgb8_257_colours", many_colours))
+if output_chunks[:len(source_chunks)] != source_chunks:
+    raise AssertionError("rgb8_257_colours: IHDR or image IDAT chunks changed")
+print("[PASS] a 257-colour RGB8 cover comes out unchanged")
+
+# Covers are decoded from their IDAT stream without lodepng, but a damaged one
+# must still be refused with the text lodepng gave, before any output exists.
+# Each damage is tried on a cover that is only validated (palette, greyscale,
+# 16-bit) and on one that is palettized row by row (RGB8, RGBA8).
+DECODE_ERRORS = {
+    "bad filter byte": "LodePNG decode error 36: illegal PNG filter type encountered",
+    "trailing data": "PNG Error: The cover image carries an extra IDAT chunk appended by another tool",
+    "IDAT one byte short": "LodePNG decode error 91: invalid decompressed idat size",
+    "IDAT one byte long": "LodePNG decode error 52: jumped past memory while inflating",
+    "bad Adler-32": "LodePNG decode error 52: jumped past memory while inflating",
+    "missing PLTE": "LodePNG decode error 106: PNG file must have PLTE chunk if color type is palette",
+}
+PALETTE = bytes(range(48))
+
+
+def damaged_covers(color_type, bit_depth):
+    channels = {0: 1, 2: 3, 3: 1, 6: 4}[color_type]
+    row_bytes = 68 * channels * bit_depth // 8
+    raw = b"".join(b"\0" + bytes((x * 7 + y) % 16 for x in range(row_bytes)) for y in range(68))
+    good = zlib.compress(raw, 9)
+    bad_filter = bytearray(raw)
+    bad_filter[5 * (row_bytes + 1)] = 7
+    streams = {
+        "bad filter byte": zlib.compress(bytes(bad_filter), 9),
+        "trailing data": good + bytes(4),
+        "IDAT one byte short": zlib.compress(raw[:-1], 9),
+        "IDAT one byte long": zlib.compress(raw + b"\0", 9),
+        "bad Adler-32": good[:-1] + bytes((good[-1] ^ 1,)),
+    }
+    ihdr = chunk(b"IHDR", struct.pack(">IIBBBBB", 68, 68, bit_depth, color_type, 0, 0, 0))
+    plte = chunk(b"PLTE", PALETTE) if color_type == 3 else b""
+    for label, stream in streams.items():
+        yield label, SIG + ihdr + plte + chunk(b"IDAT", stream) + chunk(b"IEND", b"")
+    if color_type == 3:
+        yield "missing PLTE", SIG + ihdr + chunk(b"IDAT", good) + chunk(b"IEND", b"")
+
+
+for cover_label, color_type, bit_depth in (
+        ("palette", 3, 8), ("grey8", 0, 8), ("rgb16", 2, 16), ("rgb8", 2, 8), ("rgba8", 6, 8)):
+    for label, data in damaged_covers(color_type, bit_depth):
+        case_name = f"damaged_{cover_label}_{label.replace(' ', '_')}"
+        damaged = WORK / f"{case_name}.png"
+        damaged.write_bytes(data)
+        case_dir = WORK / case_name
+        case_dir.mkdir()
+        result = subprocess.run(
+            [str(BIN), "conceal", str(damaged), str(WORK / "p.txt")],
+            cwd=case_dir,
+            text=True,
+            stdout=subprocess.PIPE,
+            stderr=subprocess.STDOUT,
+            check=False,
+        )
+        if result.returncode == 0 or DECODE_ERRORS[label] not in result.stdout:
+            raise AssertionError(f"{case_name}: expected \"{DECODE_ERRORS[label]}\"\n{result.stdout}")
+        if list(case_dir.glob("prdt_*.png")):
+            raise AssertionError(f"{case_name}: rejection left an output image")
+print("[PASS] damaged cover IDAT streams are rejected with lodepng's error text")
 PY
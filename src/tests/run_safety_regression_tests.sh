@@ -36,9 +36,15 @@ trap 'rm -rf -- "$WORK"' EXIT
 
 "${CXX:-g++}" -std=c++23 -shared -fPIC "$TESTS/close_eintr_shim.cpp" -ldl -o "$WORK/close_eintr_shim.so"
 "${CXX:-g++}" -std=c++23 -O2 -I"$ROOT" \
-    "$TESTS/input_snapshot_test.cpp" "$ROOT/compression.cpp" "$ROOT/io_utils.cpp" \
-    -lsodium -lz -ldeflate -o "$WORK/input_snapshot_test"
+    "$TESTS/input_snapshot_test.cpp" "$ROOT/compression.cpp" "$ROOT/io_utils.cpp" "$ROOT/png_utils.cpp" \
+    "$ROOT/lodepng_crc32.cpp" "$ROOT/thread_pool.cpp" \
+    -lsodium -lz -ldeflate -pthread -o "$WORK/input_snapshot_test"
 "$WORK/input_snapshot_test" "$WORK/input_snapshot"
+"${CXX:-g++}" -std=c++23 -O2 -I"$ROOT" \
+    "$TESTS/segment_index_test.cpp" "$ROOT/compression.cpp" "$ROOT/io_utils.cpp" "$ROOT/png_utils.cpp" \
+    "$ROOT/lodepng_crc32.cpp" "$ROOT/thread_pool.cpp" \
+    -lsodium -lz -ldeflate -pthread -o "$WORK/segment_index_test"
+"$WORK/segment_index_test" "$WORK/segment_index"
 
 BIN="$BIN" WORK="$WORK" CLOSE_EINTR_SHIM="$WORK/close_eintr_shim.so" python3 - <<'PY'
 import binascii
@@ -85,6 +91,37 @@ def conceal(case_dir, cover, payload, option=None, stdout=None, env=None):
     )
 
 
+def chunk_offsets(data):
+    """(offset, type, length) of every chunk after the signature."""
+    chunks, pos = [], len(PNG_SIG)
+    while pos + 8 <= len(data):
+        length, kind = struct.unpack(">I4s", data[pos:pos + 8])
+        chunks.append((pos, kind, length))
+        pos += 12 + length
+    return chunks
+
+
+def payload_idat(data):
+    """Offset and length of the data of the IDAT that carries the payload."""
+    for offset, kind, length in chunk_offsets(data):
+        if kind == b"IDAT" and data[offset + 8:offset + 11] == b"\x78\x5e\x5c":
+            return offset + 8, length
+    raise AssertionError("no payload IDAT in the concealed image")
+
+
+def recover_without_pin(image, *options):
+    """Recover with no PIN on stdin: only a pre-prompt rejection can succeed."""
+    return subprocess.run(
+        [str(BIN), "recover", *options, str(image)],
+        cwd=image.parent,
+        stdin=subprocess.DEVNULL,
+        stdout=subprocess.PIPE,
+        stderr=subprocess.STDOUT,
+        text=True,
+        check=False,
+    )
+
+
 def parse_conceal(result, case_dir):
     output = result.stdout
     pin_match = PIN_RE.search(output)
@@ -180,6 +217,206 @@ for label, option, limit in (("mastodon", "-m", 16 * 1024 * 1024),):
         raise AssertionError(f"{label}: large compressible round trip failed\n{recovered.stdout}")
     print(f"[PASS] {label} accepts and recovers an input larger than its post-compression limit")
 
+# Stored vs. deflated is decided by sampling content, not by the filename: the
+# same repetitive bytes behind a compressed-format extension must still deflate
+# under the Mastodon limit.
+renamed = WORK / "renamed.zip"
+os.link(large, renamed)
+renamed_case = WORK / "renamed_mastodon"
+renamed_case.mkdir()
+image, _ = parse_conceal(conceal(renamed_case, tiny, renamed, "-m"), renamed_case)
+if image.stat().st_size > 16 * 1024 * 1024:
+    raise AssertionError("compressible payload with a .zip name was stored")
+print("[PASS] a compressible payload is deflated whatever its extension")
+
+# Payloads larger than one deflate window are encoded as independent windows on
+# the thread pool and stitched into one zlib stream, each region stored or
+# deflated on its own. Alternating random and repetitive megabytes cross both
+# window and store/deflate run boundaries.
+blocks_payload = WORK / "blocks.bin"
+with blocks_payload.open("wb") as stream:
+    for index in range(36):
+        stream.write(os.urandom(1024 * 1024))
+        stream.write((b"block %d " % index) * (128 * 1024))
+blocks_case = WORK / "parallel_blocks"
+blocks_case.mkdir()
+image, pin = parse_conceal(conceal(blocks_case, tiny, blocks_payload), blocks_case)
+recovered = subprocess.run(
+    [str(BIN), "recover", str(image)],
+    cwd=blocks_case,
+    input=pin + "\n",
+    text=True,
+    stdout=subprocess.PIPE,
+    stderr=subprocess.STDOUT,
+    check=False,
+)
+recovered_path = blocks_case / "blocks.bin"
+if recovered.returncode != 0 or not recovered_path.is_file() or not filecmp.cmp(recovered_path, blocks_payload, shallow=False):
+    raise AssertionError(f"block-deflated round trip failed\n{recovered.stdout}")
+print("[PASS] default mode round-trips a mixed payload through the window deflater")
+
+# A range is served from just the frames and segments that hold it; this one
+# straddles the boundary between the first two 8 MiB windows.
+recovered_path.unlink()
+range_offset, range_length = 8 * 1024 * 1024 - 1000, 2 * 1024 * 1024
+ranged = subprocess.run(
+    [str(BIN), "recover", "--range", f"{range_offset}:{range_length}", str(image)],
+    cwd=blocks_case,
+    input=pin + "\n",
+    text=True,
+    stdout=subprocess.PIPE,
+    stderr=subprocess.STDOUT,
+    check=False,
+)
+with blocks_payload.open("rb") as stream:
+    stream.seek(range_offset)
+    expected = stream.read(range_length)
+if ranged.returncode != 0 or not recovered_path.is_file() or recovered_path.read_bytes() != expected:
+    raise AssertionError(f"range extraction failed\n{ranged.stdout}")
+print("[PASS] recover --range extracts a slice across a segment boundary")
+
+# A range that starts at or past the end of the file is an error, not an empty
+# file, and a zero length never reaches the PIN prompt.
+recovered_path.unlink()
+past_end = subprocess.run(
+    [str(BIN), "recover", "--range", f"{blocks_payload.stat().st_size}:16", str(image)],
+    cwd=blocks_case,
+    input=pin + "\n",
+    text=True,
+    stdout=subprocess.PIPE,
+    stderr=subprocess.STDOUT,
+    check=False,
+)
+if past_end.returncode == 0 or "Range starts past the end" not in past_end.stdout or recovered_path.exists():
+    raise AssertionError(f"range past the end of the file was not rejected\n{past_end.stdout}")
+zero_length = recover_without_pin(image, "--range", "0:0")
+if zero_length.returncode == 0 or "Usage" not in zero_length.stdout or "PIN:" in zero_length.stdout:
+    raise AssertionError(f"zero-length range was not rejected as a usage error\n{zero_length.stdout}")
+print("[PASS] recover --range rejects a range past the end and a zero length")
+
+# A bit flipped deep inside the payload IDAT is a damaged image, not a wrong
+# PIN: the chunk CRC rejects it before the prompt, with or without a range.
+damaged = blocks_case / "damaged.png"
+damaged_bytes = bytearray(image.read_bytes())
+data_offset, data_length = payload_idat(damaged_bytes)
+damaged_bytes[data_offset + data_length // 2] ^= 0x10
+damaged.write_bytes(damaged_bytes)
+for options in ((), ("--range", f"{range_offset}:{range_length}")):
+    result = recover_without_pin(damaged, *options)
+    if result.returncode == 0 or "Corrupt PNG chunk CRC" not in result.stdout or "PIN:" in result.stdout:
+        raise AssertionError(f"IDAT bit flip was not reported as corruption before the PIN prompt {options}\n{result.stdout}")
+    if recovered_path.exists():
+        raise AssertionError(f"IDAT bit flip left output behind {options}")
+print("[PASS] a bit flip in the payload IDAT is reported as a corrupt chunk before the PIN prompt")
+
+# KDF3 binds every frame to its index and to the final flag, and the sealed
+# metadata record to the frame count, so reordering, truncating or editing the
+# profile must fail authentication even when the chunk CRC is made to match.
+# A stored payload of a little over three frames is concealed under each
+# cipher, checked to round-trip, then tampered with.
+AEAD_FRAME = 1024 * 1024
+AEAD_TAG = 16
+SEALED_RECORD = 48
+PROFILE_CIPHERTEXT = 0x6E  # DEFAULT_OFFSETS.encrypted_file
+KDF_MAGIC = 0x2D           # DEFAULT_OFFSETS.kdf_metadata
+
+
+def with_payload_profile(data, profile):
+    """The image with its payload IDAT carrying `profile`, CRC recomputed."""
+    data_offset, data_length = payload_idat(data)
+    header = data_offset - 8
+    body = b"\x78\x5e\x5c" + profile
+    return data[:header] + chunk(b"IDAT", body) + data[data_offset + data_length + 4:]
+
+
+def frame_layout(profile):
+    """(frame count, plaintext size) of a KDF3 default-mode profile."""
+    cipher_size = len(profile) - PROFILE_CIPHERTEXT - SEALED_RECORD
+    for frames in range(1, cipher_size // AEAD_TAG + 1):
+        plain = cipher_size - frames * AEAD_TAG
+        if plain > 0 and -(-plain // AEAD_FRAME) == frames:
+            return frames, plain
+    raise AssertionError("profile does not split into KDF3 frames")
+
+
+def recover_with_pin(image, pin):
+    return subprocess.run(
+        [str(BIN), "recover", str(image)],
+        cwd=image.parent,
+        input=pin + "\n",
+        text=True,
+        stdout=subprocess.PIPE,
+        stderr=subprocess.STDOUT,
+        check=False,
+    )
+
+
+frames_payload = WORK / "frames.bin"
+frames_payload.write_bytes(os.urandom(3 * AEAD_FRAME + 12345))
+for cipher in ("xchacha20poly1305", "aes256gcm"):
+    case_dir = WORK / f"kdf3_{cipher}"
+    case_dir.mkdir()
+    cipher_env = os.environ.copy()
+    cipher_env["PDVRDT_PAYLOAD_CIPHER"] = cipher
+    result = conceal(case_dir, tiny, frames_payload, env=cipher_env)
+    if cipher == "aes256gcm" and "does not support" in result.stderr:
+        print(f"[SKIP] {cipher}: not supported by this CPU")
+        continue
+    image, pin = parse_conceal(result, case_dir)
+    recovered_path = case_dir / frames_payload.name
+    recovered = recover_with_pin(image, pin)
+    if recovered.returncode != 0 or not recovered_path.is_file() or not filecmp.cmp(recovered_path, frames_payload, shallow=False):
+        raise AssertionError(f"{cipher}: KDF3 round trip failed\n{recovered.stdout}")
+    recovered_path.unlink()
+
+    data = image.read_bytes()
+    data_offset, data_length = payload_idat(data)
+    profile = data[data_offset + 3:data_offset + data_length]
+    if profile[KDF_MAGIC:KDF_MAGIC + 4] != b"KDF3":
+        raise AssertionError(f"{cipher}: payload is not KDF3")
+    frames, plain = frame_layout(profile)
+    if frames < 3:
+        raise AssertionError(f"{cipher}: expected a multi-frame payload, got {frames} frame(s)")
+    head = profile[:PROFILE_CIPHERTEXT]
+    body = profile[PROFILE_CIPHERTEXT:PROFILE_CIPHERTEXT + plain]
+    tags = profile[PROFILE_CIPHERTEXT + plain:len(profile) - SEALED_RECORD]
+    record = profile[len(profile) - SEALED_RECORD:]
+
+    def frame(index):
+        return body[index * AEAD_FRAME:(index + 1) * AEAD_FRAME]
+
+    def tag(index):
+        return tags[index * AEAD_TAG:(index + 1) * AEAD_TAG]
+
+    def flipped(blob, at):
+        blob = bytearray(blob)
+        blob[at] ^= 0x01
+        return bytes(blob)
+
+    swapped_body = frame(1) + frame(0) + body[2 * AEAD_FRAME:]
+    swapped_tags = tag(1) + tag(0) + tags[2 * AEAD_TAG:]
+    last = frames - 1
+    tampered = {
+        "frames swapped with their tags": head + swapped_body + swapped_tags + record,
+        "final frame dropped": head + body[:last * AEAD_FRAME] + tags[:last * AEAD_TAG] + record,
+        "tag table byte flipped": head + body + flipped(tags, AEAD_TAG + 3) + record,
+        "metadata record changed": head + body + tags + flipped(record, 8),
+        "metadata record stripped": head + body + tags,
+        "KDF3 magic rewritten to KDF2": head[:KDF_MAGIC] + b"KDF2" + head[KDF_MAGIC + 4:] + body + tags + record,
+    }
+    for label, mutated in tampered.items():
+        victim = case_dir / "tampered.png"
+        victim.write_bytes(with_payload_profile(data, mutated))
+        result = recover_with_pin(victim, pin)
+        if result.returncode == 0 or "File Recovery Error" not in result.stdout:
+            raise AssertionError(f"{cipher}: {label} was accepted\n{result.stdout}")
+        if "Corrupt PNG chunk CRC" in result.stdout:
+            raise AssertionError(f"{cipher}: {label} was caught by the chunk CRC, not the payload\n{result.stdout}")
+        if recovered_path.exists():
+            raise AssertionError(f"{cipher}: {label} left output behind")
+        victim.unlink()
+    print(f"[PASS] {cipher}: KDF3 round-trips and rejects reordered, truncated and edited profiles")
+
 # Conversely, incompressible data that cannot fit must fail without publishing
 # an image. One payload is reused for both modes.
 random_payload = WORK / "random.bin"
@@ -0,0 +1,221 @@
+// A segment index travels inside the authenticated payload, so a damaged one
+// can only come from a bug or a hostile encoder; either way decoding it must
+// throw rather than misplace output. Checks every truncation and a spread of
+// corrupted fields against a real multi-window stream, and that the stream,
+// stored or deflated, is one that plain zlib inflate() decodes.
+#include "compression.h"
+#include "io_utils.h"
+#include "png_utils.h"
+
+#include <sodium.h>
+#include <zlib.h>
+
+#include <cstdio>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace {
+
+constexpr std::size_t ENTRY_OFFSET = 8;
+constexpr std::size_t ENTRY_BYTES = 8;
+
+// Runs the whole stream through ZlibSegmentInflater under `encoded`, and
+// returns the reassembled output. Throws whatever decoding throws.
+vBytes inflateWithIndex(std::span<const Byte> stream, std::span<const Byte> encoded, std::size_t original_size) {
+	vBytes output(original_size);
+	std::mutex output_mutex;
+	ZlibSegmentInflater inflater(
+		decodeDeflateSegmentIndex(encoded, original_size, stream.size()),
+		original_size,
+		[&](std::size_t offset, std::span<const Byte> data) {
+			if (offset > output.size() || data.size() > output.size() - offset) {
+				throw std::runtime_error("segment placed outside the output");
+			}
+			const std::scoped_lock lock(output_mutex);
+			std::ranges::copy(data, output.begin() + static_cast<std::ptrdiff_t>(offset));
+		});
+	// Odd-sized pieces, so segment boundaries fall mid-feed.
+	constexpr std::size_t FEED_SIZE = 777'777;
+	for (std::size_t offset = 0; offset < stream.size(); offset += FEED_SIZE) {
+		inflater.feed(stream.subspan(offset, std::min(FEED_SIZE, stream.size() - offset)));
+	}
+	inflater.finish();
+	return output;
+}
+
+void expectRejected(std::string_view label, std::span<const Byte> stream, std::span<const Byte> encoded, std::size_t original_size) {
+	try {
+		(void)inflateWithIndex(stream, encoded, original_size);
+	} catch (const std::runtime_error& error) {
+		if (std::string_view(error.what()).starts_with("zlib inflate failed")) {
+			return;
+		}
+		throw std::runtime_error(std::format("{}: rejected with the wrong error: {}", label, error.what()));
+	}
+	throw std::runtime_error(std::format("{}: corrupt segment index was accepted", label));
+}
+
+// Decodes `stream` with nothing but zlib's own inflate(), as any third-party
+// reader would, and throws unless it is exactly one complete zlib stream.
+vBytes plainInflate(std::span<const Byte> stream, std::size_t original_size) {
+	vBytes output(original_size + 1);
+	z_stream strm{};
+	if (inflateInit(&strm) != Z_OK) throw std::runtime_error("inflateInit failed");
+	strm.next_in = const_cast<Byte*>(stream.data());
+	strm.avail_in = static_cast<uInt>(stream.size());
+	strm.next_out = output.data();
+	strm.avail_out = static_cast<uInt>(output.size());
+	const int ret = inflate(&strm, Z_FINISH);
+	const std::size_t produced = output.size() - strm.avail_out;
+	const uInt left = strm.avail_in;
+	inflateEnd(&strm);
+	if (ret != Z_STREAM_END || left != 0) {
+		throw std::runtime_error(std::format("plain zlib inflate() stopped with {} after {} bytes, {} input bytes left",
+			ret, produced, left));
+	}
+	output.resize(produced);
+	return output;
+}
+
+vBytes withEntry(const vBytes& encoded, std::size_t entry, std::uint64_t value) {
+	vBytes changed = encoded;
+	storeLe(changed.data() + ENTRY_OFFSET + entry * ENTRY_BYTES, value, ENTRY_BYTES);
+	return changed;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	try {
+		if (argc != 2 || sodium_init() < 0) return 2;
+		const fs::path root(argv[1]);
+		fs::create_directories(root);
+
+		// Three windows, random and repetitive, the last one short.
+		constexpr std::size_t MEGABYTE = 1024 * 1024;
+		vBytes original;
+		for (std::size_t index = 0; index < 10; ++index) {
+			vBytes random(MEGABYTE);
+			randombytes_buf(random.data(), random.size());
+			original.insert(original.end(), random.begin(), random.end());
+			original.insert(original.end(), MEGABYTE, static_cast<Byte>(index));
+		}
+		original.resize(original.size() - 12345);
+
+		const fs::path input = root / "segments.bin";
+		{
+			std::ofstream out(input, std::ios::binary | std::ios::trunc);
+			out.write(reinterpret_cast<const char*>(original.data()), static_cast<std::streamsize>(original.size()));
+			if (!out) throw std::runtime_error("unable to write segment-index fixture");
+		}
+		const OpenInputFile opened = openInputFile(input);
+		vBytes stream;
+		DeflateSegmentIndex segments;
+		zlibDeflateFd(opened.fd(), opened.size(), false, [&](std::span<const Byte> chunk) {
+			appendBytes(stream, chunk, "test compressed-size overflow");
+		}, &segments);
+
+		if (plainInflate(stream, original.size()) != original) {
+			throw std::runtime_error("plain zlib inflate() of a deflated multi-window stream did not reproduce the input");
+		}
+		if (zlibInflateSpanBounded(stream, original.size()) != original) {
+			throw std::runtime_error("inflateDriver did not reproduce a deflated multi-window stream");
+		}
+		if (stream.size() > zlibDeflatedSizeBound(original.size(), false)) {
+			throw std::runtime_error("deflated multi-window stream exceeds zlibDeflatedSizeBound()");
+		}
+		vBytes stored;
+		zlibDeflateFd(opened.fd(), opened.size(), true, [&](std::span<const Byte> chunk) {
+			appendBytes(stored, chunk, "test compressed-size overflow");
+		});
+		if (plainInflate(stored, original.size()) != original) {
+			throw std::runtime_error("plain zlib inflate() of a stored multi-window stream did not reproduce the input");
+		}
+		if (stored.size() != zlibDeflatedSizeBound(original.size(), true)) {
+			throw std::runtime_error("stored multi-window stream size differs from zlibDeflatedSizeBound()");
+		}
+		std::cout << "[PASS] plain zlib inflate() decodes a " << original.size() << "-byte multi-window stream, stored and deflated\n";
+		if (segments.compressed_sizes.size() != 3) {
+			throw std::runtime_error(std::format("expected 3 segments, got {}", segments.compressed_sizes.size()));
+		}
+		const vBytes encoded = encodeDeflateSegmentIndex(segments);
+		if (encoded.size() != deflateSegmentIndexSize(original.size())) {
+			throw std::runtime_error("encoded index size differs from deflateSegmentIndexSize()");
+		}
+		if (inflateWithIndex(stream, encoded, original.size()) != original) {
+			throw std::runtime_error("segmented inflate did not reproduce the input");
+		}
+		std::cout << "[PASS] a multi-window stream inflates byte-exact through its segment index\n";
+
+		for (std::size_t size = 0; size < encoded.size(); ++size) {
+			expectRejected(std::format("truncated to {} bytes", size),
+				stream, std::span<const Byte>(encoded.data(), size), original.size());
+		}
+		vBytes extended = encoded;
+		extended.push_back(0);
+		expectRejected("one byte too long", stream, extended, original.size());
+		std::cout << "[PASS] every truncation of the segment index is rejected\n";
+
+		const std::uint64_t segment_size = loadLe(encoded.data(), 4);
+		const std::uint64_t count = loadLe(encoded.data() + 4, 4);
+		const auto withHeader = [&](std::uint64_t new_segment_size, std::uint64_t new_count) {
+			vBytes changed = encoded;
+			storeLe(changed.data(), new_segment_size, 4);
+			storeLe(changed.data() + 4, new_count, 4);
+			return changed;
+		};
+		expectRejected("segment size zero", stream, withHeader(0, count), original.size());
+		expectRejected("segment size halved", stream, withHeader(segment_size / 2, count), original.size());
+		expectRejected("segment size doubled", stream, withHeader(segment_size * 2, count), original.size());
+		expectRejected("segment size one short", stream, withHeader(segment_size - 1, count), original.size());
+		expectRejected("count one short", stream, withHeader(segment_size, count - 1), original.size());
+		expectRejected("count one over", stream, withHeader(segment_size, count + 1), original.size());
+
+		const std::size_t first = segments.compressed_sizes[0];
+		const std::size_t second = segments.compressed_sizes[1];
+		expectRejected("entry zero", stream, withEntry(encoded, 1, 0), original.size());
+		expectRejected("entry one over", stream, withEntry(encoded, 0, first + 1), original.size());
+		expectRejected("entry one short", stream, withEntry(encoded, 2, segments.compressed_sizes[2] - 1), original.size());
+		expectRejected("entry past the stream", stream, withEntry(encoded, 0, ~std::uint64_t{0}), original.size());
+		// The total still adds up, so only decoding the segments can tell.
+		expectRejected("boundary moved forward", stream,
+			withEntry(withEntry(encoded, 0, first + 1), 1, second - 1), original.size());
+		expectRejected("boundary moved back", stream,
+			withEntry(withEntry(encoded, 0, first - 1), 1, second + 1), original.size());
+		expectRejected("entries swapped", stream,
+			withEntry(withEntry(encoded, 0, second), 1, first), original.size());
+		expectRejected("wrong original size", stream, encoded, original.size() + segment_size);
+		std::cout << "[PASS] corrupted segment index fields are rejected\n";
+
+		// A range read decodes one segment on its own, from the index's spans.
+		const DeflateSegmentIndex shifted = decodeDeflateSegmentIndex(
+			withEntry(withEntry(encoded, 0, first + 1), 1, second - 1), original.size(), stream.size());
+		for (std::size_t segment = 0; segment < 2; ++segment) {
+			const DeflateSegmentSpan where = deflateSegmentAt(shifted, original.size(), segment);
+			vBytes input(stream.begin() + static_cast<std::ptrdiff_t>(where.compressed_offset),
+				stream.begin() + static_cast<std::ptrdiff_t>(where.compressed_offset + where.compressed_size));
+			input.resize(input.size() + DEFLATE_SEGMENT_SLACK_BYTES);
+			vBytes decoded(where.output_size);
+			bool rejected = false;
+			try {
+				(void)inflateDeflateSegment(input, false, decoded);
+			} catch (const std::runtime_error&) {
+				rejected = true;
+			}
+			if (!rejected) {
+				throw std::runtime_error(std::format("segment {} decoded from a shifted boundary", segment));
+			}
+		}
+		std::cout << "[PASS] a single segment read through a shifted boundary is rejected\n";
+		return 0;
+	} catch (const std::exception& error) {
+		std::cerr << error.what() << '\n';
+		return 1;
+	}
+}
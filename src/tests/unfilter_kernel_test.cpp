@@ -0,0 +1,126 @@
+// Checks every unfilter kernel this CPU can run byte-for-byte against the
+// vendored lodepng unfilterScanline(), which the pdvrdt build no longer calls.
+#include "png_utils.h"
+
+// Built as plain lodepng, without pdvrdt's configuration, for the reference.
+#include "lodepng/lodepng.cpp"
+
+#include <array>
+#include <cstring>
+#include <format>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+constexpr std::size_t GUARD = 64;
+constexpr Byte GUARD_BYTE = 0xA5;
+
+std::string_view kernelName(UnfilterKernel kernel) {
+	switch (kernel) {
+		case UnfilterKernel::Scalar: return "scalar";
+		case UnfilterKernel::Sse41:  return "SSE4.1";
+		case UnfilterKernel::Avx2:   return "AVX2";
+	}
+	return "?";
+}
+
+// One row through `kernel`, either into its own buffer or in place the way
+// lodepng does it, `recon` starting `shift` bytes before `scanline`.
+void checkRow(
+	UnfilterKernel kernel,
+	const vBytes& scanline,
+	const vBytes* precon,
+	std::size_t bytewidth,
+	Byte filter_type,
+	std::size_t shift,
+	bool in_place) {
+
+	const std::size_t length = scanline.size();
+	const Byte* above = precon ? precon->data() : nullptr;
+
+	vBytes expected(length);
+	const unsigned expected_error = unfilterScanline(expected.data(), scanline.data(), above, bytewidth, filter_type, length);
+
+	unsigned error = 0;
+	vBytes actual;
+	if (in_place) {
+		vBytes buffer(shift + length + GUARD, GUARD_BYTE);
+		std::memcpy(buffer.data() + shift, scanline.data(), length);
+		error = pdvrdtUnfilterScanlineWith(kernel, buffer.data(), buffer.data() + shift, above, bytewidth, filter_type, length);
+		// Past the row only the unread tail of the input may remain.
+		for (std::size_t i = length; i < shift + length; ++i) {
+			if (buffer[i] != (i < shift ? GUARD_BYTE : scanline[i - shift])) {
+				throw std::runtime_error(std::format("{}: in-place write past the row end", kernelName(kernel)));
+			}
+		}
+		actual.assign(buffer.begin(), buffer.begin() + static_cast<std::ptrdiff_t>(length));
+	} else {
+		vBytes buffer(length + GUARD, GUARD_BYTE);
+		error = pdvrdtUnfilterScanlineWith(kernel, buffer.data(), scanline.data(), above, bytewidth, filter_type, length);
+		for (std::size_t i = length; i < buffer.size(); ++i) {
+			if (buffer[i] != GUARD_BYTE) {
+				throw std::runtime_error(std::format("{}: write past the row end", kernelName(kernel)));
+			}
+		}
+		actual.assign(buffer.begin(), buffer.begin() + static_cast<std::ptrdiff_t>(length));
+	}
+
+	if (error != expected_error || (error == 0 && actual != expected)) {
+		throw std::runtime_error(std::format(
+			"{}: filter {} bytewidth {} length {} {}{} differs from lodepng",
+			kernelName(kernel), filter_type, bytewidth, length,
+			in_place ? "in place" : "separate", precon ? "" : " first row"));
+	}
+}
+
+} // namespace
+
+int main() {
+	try {
+		std::mt19937 rng(0x5EED);
+		std::uniform_int_distribution<int> byte_value(0, 255);
+		const auto random_row = [&](std::size_t length) {
+			vBytes row(length);
+			for (Byte& value : row) value = static_cast<Byte>(byte_value(rng));
+			return row;
+		};
+
+		std::size_t checked = 0;
+		for (const UnfilterKernel kernel : {UnfilterKernel::Scalar, UnfilterKernel::Sse41, UnfilterKernel::Avx2}) {
+			if (!unfilterKernelSupported(kernel)) {
+				std::cout << "[SKIP] " << kernelName(kernel) << " unfilter kernels: not supported by this CPU\n";
+				continue;
+			}
+			for (std::size_t bytewidth = 1; bytewidth <= 8; ++bytewidth) {
+				for (const std::size_t pixels : {1, 2, 3, 4, 5, 7, 8, 11, 16, 33, 64, 257}) {
+					const std::size_t length = pixels * bytewidth;
+					for (Byte filter_type = 0; filter_type <= 5; ++filter_type) {
+						const vBytes scanline = random_row(length);
+						const vBytes precon = random_row(length);
+						// Flat rows give the Paeth ties.
+						const vBytes flat(length, static_cast<Byte>(byte_value(rng)));
+						for (const std::size_t shift : {std::size_t{0}, std::size_t{1}, bytewidth, std::size_t{17}}) {
+							checkRow(kernel, scanline, &precon, bytewidth, filter_type, shift, true);
+							checkRow(kernel, scanline, nullptr, bytewidth, filter_type, shift, true);
+						}
+						checkRow(kernel, scanline, &precon, bytewidth, filter_type, 0, false);
+						checkRow(kernel, scanline, &flat, bytewidth, filter_type, 0, false);
+						checkRow(kernel, flat, &flat, bytewidth, filter_type, 0, false);
+						checkRow(kernel, scanline, nullptr, bytewidth, filter_type, 0, false);
+						checked += 12;
+					}
+				}
+			}
+			std::cout << "[PASS] " << kernelName(kernel) << " unfilter kernels match lodepng\n";
+		}
+		std::cout << "[PASS] " << checked << " rows unfiltered byte-exact\n";
+		return 0;
+	} catch (const std::exception& error) {
+		std::cerr << error.what() << '\n';
+		return 1;
+	}
+}
@@ -0,0 +1,65 @@
+#include "thread_pool.h"
+
+#include <pthread.h>
+#include <signal.h>
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(std::size_t thread_count) {
+	// Workers start with every signal blocked, so a signal sent to the process
+	// always lands on a thread that chose how to take it. PIN entry blocks the
+	// terminating signals on its own thread and reads them from a signalfd; a
+	// worker started earlier with them unblocked would take the default action
+	// and leave the terminal without echo.
+	struct BlockSignalsInScope {
+		sigset_t old_mask{};
+		bool masked{false};
+		BlockSignalsInScope() {
+			sigset_t all_signals;
+			sigfillset(&all_signals);
+			masked = pthread_sigmask(SIG_BLOCK, &all_signals, &old_mask) == 0;
+		}
+		~BlockSignalsInScope() {
+			if (masked) pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+		}
+	} block_signals;
+
+	workers_.reserve(std::max<std::size_t>(thread_count, 1));
+	for (std::size_t i = 0; i < std::max<std::size_t>(thread_count, 1); ++i) {
+		workers_.emplace_back([this](std::stop_token stop) { workerLoop(stop); });
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	for (auto& worker : workers_) {
+		worker.request_stop();
+	}
+	ready_.notify_all();
+	// jthread joins on destruction. Queued tasks that never ran are dropped with
+	// the queue, which breaks their promises; nobody is left waiting on them.
+}
+
+void ThreadPool::workerLoop(std::stop_token stop) {
+	while (true) {
+		std::move_only_function<void()> task;
+		{
+			std::unique_lock lock(mutex_);
+			if (!ready_.wait(lock, stop, [this] { return !queue_.empty(); })) {
+				return;
+			}
+			task = std::move(queue_.front());
+			queue_.pop_front();
+		}
+		// packaged_task captures any exception into its future, so nothing escapes.
+		task();
+	}
+}
+
+std::size_t hardwareWorkerCount() noexcept {
+	return std::max(1U, std::thread::hardware_concurrency());
+}
+
+ThreadPool& sharedThreadPool() {
+	static ThreadPool pool(hardwareWorkerCount());
+	return pool;
+}
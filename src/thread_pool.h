@@ -0,0 +1,60 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Fixed-size worker pool for the CPU-bound stages (block deflate, frame crypto,
+// CRC). Tasks are plain closures; results and exceptions travel back through the
+// std::future that submit() returns, so a failing worker surfaces at the caller's
+// get() exactly as if the work had run inline.
+//
+// Tasks must not block on other tasks of the same pool: every wait in this code
+// base happens on a thread that is not a pool worker, which is what keeps a pool
+// of any size (including one worker) deadlock-free.
+class ThreadPool {
+public:
+	explicit ThreadPool(std::size_t thread_count);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	[[nodiscard]] std::size_t size() const noexcept { return workers_.size(); }
+
+	template <typename Task>
+	[[nodiscard]] std::future<std::invoke_result_t<std::decay_t<Task>>> submit(Task&& task) {
+		using Result = std::invoke_result_t<std::decay_t<Task>>;
+		std::packaged_task<Result()> packaged(std::forward<Task>(task));
+		std::future<Result> result = packaged.get_future();
+		{
+			const std::lock_guard lock(mutex_);
+			queue_.emplace_back(std::move(packaged));
+		}
+		ready_.notify_one();
+		return result;
+	}
+
+private:
+	void workerLoop(std::stop_token stop);
+
+	std::mutex mutex_;
+	std::condition_variable_any ready_;
+	std::deque<std::move_only_function<void()>> queue_;
+	std::vector<std::jthread> workers_;
+};
+
+// Worker count for the process-wide pool: one per hardware thread, never zero.
+[[nodiscard]] std::size_t hardwareWorkerCount() noexcept;
+
+// The process-wide pool, started on first use. Every parallel stage shares it so
+// the tool never oversubscribes the machine with competing pools.
+[[nodiscard]] ThreadPool& sharedThreadPool();